@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "stats.h"
+
+#define MAX_CLIENTS 64
+#define MAX_ARGS 32
+// server which is not done by then is killed and its run fails
+#define RUN_TIMEOUT_S 300
+#define READY_TIMEOUT_MS 5000
+
+/*
+ * Server and client of one transport, built in build_dir/dir.
+ */
+struct transport {
+    const char *name;
+    const char *dir;
+    int threaded_client; // client takes -t threads
+};
+
+struct run_result {
+    double seconds;
+    uint64_t tasks; // dispatches with result
+    uint64_t latency[STATS_LATENCY_BUCKETS];
+    double cpu_seconds; // server and clients, user and system
+    uint64_t syscall_stops; // server and clients, two per syscall, counted only in traced run
+};
+
+int read_args(int argc, char *argv[]);
+int run_transport(const struct transport *transport, int traced, struct run_result *result);
+int build_args(const struct transport *transport, int server, char *args[], char *buffers);
+pid_t start_process(char *args[], int traced);
+int wait_ready(const char *stats_name, pid_t server, int traced, uint64_t *syscall_stops,
+               struct stats_segment **stats, size_t *size);
+int wait_server(pid_t server, int traced, uint64_t *syscall_stops);
+void stop_clients(pid_t *clients, int count, int traced, uint64_t *syscall_stops);
+int trace_until(pid_t awaited, uint64_t *syscall_stops);
+int handle_traced(pid_t pid, int status, uint64_t *syscall_stops);
+void collect_stats(struct stats_segment *stats, struct run_result *result);
+double latency_percentile(uint64_t *latency, uint64_t count, double percentile);
+void print_result(const struct transport *transport, struct run_result *result, int traced);
+double now();
+
+struct transport transports[] = {
+    {"sysv", "zad1", 1},
+    {"posix", "zad2", 1},
+    {"shm", "zad3", 0},
+    {"unix", "zad4", 1},
+    {"tcp", "zad4", 1},
+};
+#define TRANSPORTS_NUM (sizeof(transports) / sizeof(transports[0]))
+
+char *build_dir = NULL;
+uint64_t numbers = 100000;
+int client_count = 4;
+int batch_size = 100;
+int thread_count = 1;
+uint64_t range_size = 0;
+char *work_model = "none";
+int count_syscalls = 1;
+int run_id = 0;
+
+/*
+ * Runs the same workload on every transport: server tests numbers
+ * [0, numbers) with client_count clients and exits when all are done.
+ * Numbers come from statistics segment of server, which stays mapped
+ * after server exits. Syscalls are counted in a second run under ptrace,
+ * which slows processes down too much for other numbers of that run.
+ */
+int main(int argc, char *argv[]) {
+    if (read_args(argc, argv) != 0) {
+        printf("Enter build directory with zad1 - zad4 built in subdirectories (options:"
+               " -n numbers to test, default 100000, -c clients, default 4, -b batch size, default 100,"
+               " -r range size instead of batches, -t threads of SysV, POSIX and socket clients, default 1,"
+               " -l client work model, default none, -x do not count syscalls).\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    printf("%-8s %12s %12s %10s %10s %10s %14s %12s\n",
+           "transport", "tasks/s", "numbers/s", "p50 ms", "p99 ms", "p999 ms", "syscalls/task", "cpu us/task");
+    int failed = 0;
+    for (int i = 0; i < TRANSPORTS_NUM; i++) {
+        struct run_result result;
+        if (run_transport(&transports[i], 0, &result) != 0) {
+            printf("%-8s run failed.\n", transports[i].name);
+            failed = 1;
+            continue;
+        }
+        if (count_syscalls) {
+            struct run_result traced;
+            if (run_transport(&transports[i], 1, &traced) != 0) {
+                printf("%-8s traced run failed, syscalls are not counted.\n", transports[i].name);
+                count_syscalls = 0;
+            } else {
+                result.syscall_stops = traced.syscall_stops;
+            }
+        }
+        print_result(&transports[i], &result, count_syscalls);
+    }
+    return failed;
+}
+
+int read_args(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:b:r:t:l:x")) != -1) {
+        switch (opt) {
+            case 'n':
+                numbers = strtoull(optarg, NULL, 10);
+                if (numbers == 0)
+                    return 1;
+                break;
+            case 'c':
+                client_count = atoi(optarg);
+                if (client_count <= 0 || client_count > MAX_CLIENTS)
+                    return 1;
+                break;
+            case 'b':
+                batch_size = atoi(optarg);
+                if (batch_size <= 0)
+                    return 1;
+                break;
+            case 'r':
+                range_size = strtoull(optarg, NULL, 10);
+                if (range_size == 0)
+                    return 1;
+                break;
+            case 't':
+                thread_count = atoi(optarg);
+                if (thread_count <= 0)
+                    return 1;
+                break;
+            case 'l':
+                work_model = optarg;
+                break;
+            case 'x':
+                count_syscalls = 0;
+                break;
+            default:
+                return 1;
+        }
+    }
+    if (argc - optind != 1)
+        return 1;
+    build_dir = argv[optind];
+    return 0;
+}
+
+int run_transport(const struct transport *transport, int traced, struct run_result *result) {
+    memset(result, 0, sizeof(struct run_result));
+    run_id++;
+    char *server_args[MAX_ARGS];
+    char server_buffers[MAX_ARGS * 256];
+    char *client_args[MAX_ARGS];
+    char client_buffers[MAX_ARGS * 256];
+    build_args(transport, 1, server_args, server_buffers);
+    build_args(transport, 0, client_args, client_buffers);
+    char *stats_name = server_args[2]; // -m name comes first
+
+    struct rusage before, after;
+    getrusage(RUSAGE_CHILDREN, &before);
+    pid_t server = start_process(server_args, traced);
+    if (server == -1)
+        return -1;
+    struct stats_segment *stats = NULL;
+    size_t size;
+    if (wait_ready(stats_name, server, traced, &result->syscall_stops, &stats, &size) != 0) {
+        printf("Server %s did not start.\n", server_args[0]);
+        kill(server, SIGKILL);
+        waitpid(server, NULL, __WALL);
+        return -1;
+    }
+
+    double start = now();
+    pid_t clients[MAX_CLIENTS];
+    int started = 0;
+    for (; started < client_count; started++) {
+        clients[started] = start_process(client_args, traced);
+        if (clients[started] == -1)
+            break;
+    }
+    if (started < client_count)
+        kill(server, SIGKILL);
+    int error = wait_server(server, traced, &result->syscall_stops);
+    result->seconds = now() - start;
+    stop_clients(clients, started, traced, &result->syscall_stops);
+    getrusage(RUSAGE_CHILDREN, &after);
+    result->cpu_seconds = after.ru_utime.tv_sec - before.ru_utime.tv_sec + after.ru_stime.tv_sec
+                          - before.ru_stime.tv_sec + (after.ru_utime.tv_usec - before.ru_utime.tv_usec
+                          + after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e6;
+    collect_stats(stats, result);
+    munmap(stats, size);
+    shm_unlink(stats_name); // left behind by killed server
+    return error;
+}
+
+/*
+ * Fills argv of server or client. Names of queues, sockets and segments are unique
+ * for every run, so runs do not meet leftovers of each other.
+ */
+int build_args(const struct transport *transport, int server, char *args[], char *buffers) {
+    int count = 0;
+#define ARG(...) do { \
+        args[count] = buffers + count * 256; \
+        snprintf(args[count++], 256, __VA_ARGS__); \
+    } while (0)
+    ARG("%s/%s/%s", build_dir, transport->dir, server ? "server" : "client");
+    if (server) {
+        ARG("-m");
+        ARG("/bench_stats_%d_%d", getpid(), run_id);
+        ARG("-s");
+        ARG("counters");
+        ARG("-g");
+        ARG("scan:0:%" PRIu64, numbers);
+        if (range_size > 0) {
+            ARG("-r");
+            ARG("%" PRIu64, range_size);
+        }
+    } else {
+        ARG("-l");
+        ARG("%s", work_model);
+        if (transport->threaded_client) {
+            ARG("-t");
+            ARG("%d", thread_count);
+        }
+    }
+    if (strcmp(transport->dir, "zad1") == 0) { // key of queue comes from build directory
+        ARG("%s", build_dir);
+        ARG("%d", (getpid() + run_id) % 250 + 1);
+    } else if (strcmp(transport->name, "unix") == 0) {
+        ARG("/tmp/bench_%d_%d.sock", getpid(), run_id);
+    } else if (strcmp(transport->name, "tcp") == 0) {
+        ARG("127.0.0.1:%d", 20000 + (getpid() + run_id) % 20000);
+    } else {
+        ARG("/bench_%d_%d", getpid(), run_id);
+    }
+    if (!server)
+        ARG("%d", batch_size);
+#undef ARG
+    args[count] = NULL;
+    return count;
+}
+
+/*
+ * Output of server and clients is dropped. Traced process stops at exec,
+ * then its threads are traced from their first syscall.
+ */
+pid_t start_process(char *args[], int traced) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        printf("Error while starting %s occurred.\n", args[0]);
+        return -1;
+    }
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        if (traced)
+            ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        execv(args[0], args);
+        _exit(127);
+    }
+    if (traced) {
+        int status;
+        if (waitpid(pid, &status, __WALL) != pid || !WIFSTOPPED(status)
+            || ptrace(PTRACE_SETOPTIONS, pid, NULL,
+                      PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL) != 0
+            || ptrace(PTRACE_SYSCALL, pid, NULL, NULL) != 0) {
+            printf("Error while tracing %s occurred.\n", args[0]);
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, __WALL);
+            return -1;
+        }
+    }
+    return pid;
+}
+
+/*
+ * Server creates its queue before statistics segment, so clients can
+ * connect once the segment is there.
+ */
+int wait_ready(const char *stats_name, pid_t server, int traced, uint64_t *syscall_stops,
+               struct stats_segment **stats, size_t *size) {
+    double deadline = now() + READY_TIMEOUT_MS / 1000.0;
+    while (now() < deadline) {
+        *stats = stats_open(stats_name, size);
+        if (*stats != NULL)
+            return 0;
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(traced ? -1 : server, &status, WNOHANG | __WALL)) > 0) {
+            if (!traced || handle_traced(pid, status, syscall_stops))
+                if (pid == server)
+                    return -1;
+        }
+        usleep(1000);
+    }
+    return -1;
+}
+
+/*
+ * Returns 0 when server exits by itself with status 0. Server is always
+ * gone when it returns.
+ */
+int wait_server(pid_t server, int traced, uint64_t *syscall_stops) {
+    if (traced)
+        return trace_until(server, syscall_stops);
+    double deadline = now() + RUN_TIMEOUT_S;
+    while (now() < deadline) {
+        int status;
+        pid_t pid = waitpid(server, &status, WNOHANG);
+        if (pid == server)
+            return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+        usleep(200);
+    }
+    printf("Server did not finish in %d seconds.\n", RUN_TIMEOUT_S);
+    kill(server, SIGKILL);
+    waitpid(server, NULL, 0);
+    return -1;
+}
+
+/*
+ * Clients stay connected until they are told to close.
+ */
+void stop_clients(pid_t *clients, int count, int traced, uint64_t *syscall_stops) {
+    for (int i = 0; i < count; i++)
+        kill(clients[i], SIGINT);
+    for (int i = 0; i < count; i++) {
+        if (traced)
+            trace_until(clients[i], syscall_stops);
+        else
+            waitpid(clients[i], NULL, 0);
+    }
+}
+
+/*
+ * Resumes traced threads until awaited process exits. Returns 0 when it
+ * exits with status 0.
+ */
+int trace_until(pid_t awaited, uint64_t *syscall_stops) {
+    double deadline = now() + RUN_TIMEOUT_S;
+    int killed = 0;
+    while (1) {
+        int status;
+        pid_t pid = waitpid(-1, &status, __WALL);
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (handle_traced(pid, status, syscall_stops) && pid == awaited)
+            return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+        if (!killed && now() > deadline) {
+            printf("Traced process did not finish in %d seconds.\n", RUN_TIMEOUT_S);
+            kill(awaited, SIGKILL);
+            killed = 1;
+        }
+    }
+}
+
+/*
+ * Every syscall stops thread on entry and on exit. New threads are traced
+ * automatically and start with SIGSTOP, which is swallowed as is SIGTRAP
+ * of exec, other signals are passed on. Returns 1 if pid exited.
+ */
+int handle_traced(pid_t pid, int status, uint64_t *syscall_stops) {
+    if (WIFEXITED(status) || WIFSIGNALED(status))
+        return 1;
+    if (!WIFSTOPPED(status))
+        return 0;
+    int signum = WSTOPSIG(status);
+    if (signum == (SIGTRAP | 0x80)) {
+        (*syscall_stops)++;
+        signum = 0;
+    } else if (signum == SIGTRAP || signum == SIGSTOP) {
+        signum = 0;
+    }
+    ptrace(PTRACE_SYSCALL, pid, NULL, signum);
+    return 0;
+}
+
+void collect_stats(struct stats_segment *stats, struct run_result *result) {
+    for (int i = 0; i < stats->client_max; i++) {
+        struct client_stats *client = &stats->clients[i];
+        if (atomic_load(&client->client_id) == -1)
+            continue;
+        result->tasks += atomic_load(&client->results);
+        for (int j = 0; j < STATS_LATENCY_BUCKETS; j++)
+            result->latency[j] += atomic_load(&client->latency[j]);
+    }
+}
+
+/*
+ * Upper bound of histogram bucket in milliseconds, 0 if there is no result.
+ */
+double latency_percentile(uint64_t *latency, uint64_t count, double percentile) {
+    if (count == 0)
+        return 0;
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+        seen += latency[i];
+        if (seen >= count * percentile)
+            return (double) (1ULL << i) / 1000;
+    }
+    return (double) (1ULL << (STATS_LATENCY_BUCKETS - 1)) / 1000;
+}
+
+void print_result(const struct transport *transport, struct run_result *result, int traced) {
+    uint64_t count = 0;
+    for (int i = 0; i < STATS_LATENCY_BUCKETS; i++)
+        count += result->latency[i];
+    uint64_t tasks = result->tasks > 0 ? result->tasks : 1;
+    char syscalls[32] = "-";
+    if (traced)
+        snprintf(syscalls, sizeof(syscalls), "%.1f", (double) result->syscall_stops / 2 / tasks);
+    printf("%-8s %12.0f %12.0f %10.3f %10.3f %10.3f %14s %12.1f\n", transport->name,
+           result->tasks / result->seconds, numbers / result->seconds,
+           latency_percentile(result->latency, count, 0.5), latency_percentile(result->latency, count, 0.99),
+           latency_percentile(result->latency, count, 0.999), syscalls, result->cpu_seconds * 1e6 / tasks);
+}
+
+double now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
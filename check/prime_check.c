@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "prime.h"
+
+// batches of random numbers checked with every kernel
+#define RANDOM_BATCHES 20000
+#define MAX_COUNT 64
+// edge cases are also checked in windows of every size up to that, so final
+// vector of kernel is filled partially in every way
+#define MAX_WINDOW (2 * PRIME_MAX_LANES + 1)
+
+int check_kernel(int lanes, const char *name);
+int check_batch(const char *name, const uint64_t *numbers, int count);
+uint64_t random_number();
+uint64_t next_random();
+
+static const uint64_t edge_cases[] = {
+    0, 1, 2, 3, 4, 5, 7, 9, 25, 49,
+    53, 59, 61, 2809, 3481, // around the last trial prime and base 61
+    2047, 3277, 4033, 4681, 8321, // strong pseudoprimes to base 2
+    561, 1105, 1729, 2465, 2821, 6601, // Carmichael numbers
+    25326001, 3215031751ULL, // strong pseudoprimes to bases 2, 3, 5 (and 7)
+    65537, 2013265921, 3221225473ULL, // n - 1 divisible by high power of 2
+    2147483647, 2147483649ULL, 2147483659ULL, // R mod n close to n
+    4293001441ULL, 4292870399ULL, // products of primes near 2^16
+    4294967279ULL, 4294967291ULL, 4294967295ULL, // R mod n close to 0
+    4294967296ULL, 4294967297ULL, 4294967311ULL, // first numbers above 2^32
+    4759123141ULL, // strong pseudoprime to bases 2, 7, 61 of 32-bit test
+    999999937, 1000000007,
+    18446744073709551557ULL, 18446744073709551615ULL
+};
+
+/*
+ * Compares verdicts of is_prime_batch with is_prime for every kernel CPU
+ * has, on edge cases and random batches. Returns 1 if any verdict differs.
+ */
+int main() {
+    int failed = 0;
+    failed |= check_kernel(0, "Scalar");
+    failed |= check_kernel(4, "AVX2");
+    failed |= check_kernel(8, "AVX-512");
+    if (failed) {
+        printf("Kernels differ from is_prime.\n");
+        return 1;
+    }
+    printf("Kernels agree with is_prime.\n");
+    return 0;
+}
+
+int check_kernel(int lanes, const char *name) {
+    if (prime_use_kernel(lanes) != 0) {
+        printf("%s kernel is not supported by CPU, skipped.\n", name);
+        return 0;
+    }
+    int edge_count = sizeof(edge_cases) / sizeof(edge_cases[0]);
+    if (check_batch(name, edge_cases, edge_count) != 0)
+        return 1;
+    for (int size = 1; size <= MAX_WINDOW; size++)
+        for (int i = 0; i + size <= edge_count; i++)
+            if (check_batch(name, edge_cases + i, size) != 0)
+                return 1;
+    uint64_t numbers[MAX_COUNT];
+    for (int i = 0; i < RANDOM_BATCHES; i++) {
+        int count = 1 + (int) (next_random() % MAX_COUNT);
+        for (int j = 0; j < count; j++)
+            numbers[j] = random_number();
+        if (check_batch(name, numbers, count) != 0)
+            return 1;
+    }
+    printf("%s kernel agrees with is_prime.\n", name);
+    return 0;
+}
+
+int check_batch(const char *name, const uint64_t *numbers, int count) {
+    uint8_t bitmap[(MAX_COUNT + 7) / 8];
+    is_prime_batch(numbers, count, bitmap);
+    for (int i = 0; i < count; i++) {
+        int verdict = bitmap[i / 8] >> (i % 8) & 1;
+        if (verdict != is_prime(numbers[i])) {
+            printf("%s kernel: %" PRIu64 " is %s, is_prime says otherwise.\n", name, numbers[i],
+                   verdict ? "prime" : "composite");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Mostly odd numbers below 2^32, which reach the kernel, mixed with numbers
+ * near 2^32 and above it, which do not.
+ */
+uint64_t random_number() {
+    uint64_t number = next_random();
+    switch (number % 4) {
+        case 0: // odd below 2^32
+        case 1:
+            return number >> 32 | 1;
+        case 2: // near 2^32 from both sides
+            return (1ULL << 32) - (1 << 16) + (number >> 47);
+        default: // any 64-bit
+            return number;
+    }
+}
+
+/*
+ * Fixed seed, so failure can be reproduced.
+ */
+uint64_t next_random() {
+    static uint64_t state = 1;
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return state ^ state >> 29;
+}
@@ -0,0 +1,29 @@
+#include "batch_sizer.h"
+
+void batch_sizer_init(struct batch_sizer *sizer, uint64_t max_size) {
+    sizer->unit_cost = 0;
+    sizer->size = max_size < BATCH_SIZER_INITIAL ? max_size : BATCH_SIZER_INITIAL;
+}
+
+/*
+ * Takes result of dispatch of units numbers, elapsed nanoseconds after it
+ * was sent. Target is in nanoseconds too.
+ */
+void batch_sizer_update(struct batch_sizer *sizer, uint64_t units, uint64_t elapsed, uint64_t target,
+                        uint64_t max_size) {
+    if (units == 0)
+        return;
+    uint64_t sample = elapsed / units;
+    if (sample == 0)
+        sample = 1;
+    if (sizer->unit_cost == 0)
+        sizer->unit_cost = sample;
+    else
+        sizer->unit_cost = (sizer->unit_cost * (BATCH_SIZER_SMOOTHING - 1) + sample) / BATCH_SIZER_SMOOTHING;
+    uint64_t size = target / sizer->unit_cost;
+    if (size > 2 * sizer->size)
+        size = 2 * sizer->size;
+    if (size > max_size)
+        size = max_size;
+    sizer->size = size < 1 ? 1 : size;
+}
@@ -0,0 +1,26 @@
+#ifndef COMMON_BATCH_SIZER_H
+#define COMMON_BATCH_SIZER_H
+
+#include <stdint.h>
+
+// size of first dispatch, before anything is measured
+#define BATCH_SIZER_INITIAL 16
+// weight of new sample in average cost is 1 / BATCH_SIZER_SMOOTHING
+#define BATCH_SIZER_SMOOTHING 4
+
+/*
+ * Sizes dispatches of one client, so each of them takes target time from
+ * send to result. Cost of a number is averaged over results, it grows with
+ * magnitude of numbers and differs between clients. Size at most doubles
+ * per result, so one fast sample does not send a huge range.
+ */
+struct batch_sizer {
+    uint64_t unit_cost; // nanoseconds per number, 0 - not measured yet
+    uint64_t size; // numbers in next dispatch
+};
+
+void batch_sizer_init(struct batch_sizer *sizer, uint64_t max_size);
+void batch_sizer_update(struct batch_sizer *sizer, uint64_t units, uint64_t elapsed, uint64_t target,
+                        uint64_t max_size);
+
+#endif //COMMON_BATCH_SIZER_H
@@ -0,0 +1,372 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+
+void add_run(struct checkpoint *checkpoint, uint64_t lo, uint64_t hi);
+int valid_state(const struct checkpoint_file *file, size_t file_size, const struct checkpoint_state *state);
+int load_state(struct checkpoint *checkpoint, const struct checkpoint_state *state);
+int make_room(struct checkpoint *checkpoint, uint32_t index, uint32_t run_count);
+void requeue_gaps(const struct checkpoint *checkpoint, struct retry_queue *retry, uint64_t chunk);
+void write_state(struct checkpoint *checkpoint, struct task_source *source, struct result_sink *results);
+void *run_syncer(void *arg);
+
+/*
+ * Creates checkpoint file of scan source or resumes from the one left by
+ * previous server: cursor of source is moved and numbers which were in
+ * flight are put to retry queue in pieces of chunk numbers, or whole gaps
+ * when chunk is 0. Returns 1 if scan was resumed, 0 if it starts from the
+ * beginning and -1 on error (also when file belongs to another scan).
+ */
+int checkpoint_open(struct checkpoint *checkpoint, const char *path, struct task_source *source,
+                    struct retry_queue *retry, uint64_t chunk) {
+    memset(checkpoint, 0, sizeof(struct checkpoint));
+    pthread_mutex_init(&checkpoint->lock, NULL);
+    pthread_mutex_init(&checkpoint->sync_lock, NULL);
+    if (source->spec.kind != TASK_SOURCE_SCAN) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+        return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    size_t initial_size = sizeof(struct checkpoint_file) + 2 * CHECKPOINT_INITIAL_RUNS * sizeof(struct checkpoint_run);
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || (file_stat.st_size != 0 && (size_t) file_stat.st_size < initial_size)
+        || (file_stat.st_size == 0 && ftruncate(fd, initial_size) != 0)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    size_t file_size = file_stat.st_size == 0 ? initial_size : (size_t) file_stat.st_size;
+    struct checkpoint_file *file = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (file == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    int resumed = file->magic != 0;
+    if (!resumed) { // new file or one which was not set up whole
+        memset(file, 0, sizeof(struct checkpoint_file));
+        file->version = CHECKPOINT_VERSION;
+        file->lo = source->spec.lo;
+        file->hi = source->spec.hi;
+        for (int i = 0; i < 2; i++) {
+            file->states[i].cursor = file->states[i].watermark = source->spec.lo;
+            file->states[i].runs = sizeof(struct checkpoint_file) + i * CHECKPOINT_INITIAL_RUNS
+                                   * sizeof(struct checkpoint_run);
+            file->states[i].run_capacity = CHECKPOINT_INITIAL_RUNS;
+        }
+        msync(file, file_size, MS_SYNC);
+        file->magic = CHECKPOINT_MAGIC;
+        msync(file, file_size, MS_SYNC);
+    } else if (file->magic != CHECKPOINT_MAGIC || file->version != CHECKPOINT_VERSION || file->current > 1
+               || file->lo != source->spec.lo || file->hi != source->spec.hi
+               || !valid_state(file, file_size, &file->states[file->current])) {
+        munmap(file, file_size);
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    checkpoint->file = file;
+    checkpoint->file_size = file_size;
+    checkpoint->fd = fd;
+    if (load_state(checkpoint, &file->states[file->current]) != 0) {
+        munmap(file, file_size);
+        close(fd);
+        checkpoint->file = NULL;
+        return -1;
+    }
+    if (resumed) {
+        atomic_store(&source->cursor, checkpoint->cursor - source->spec.lo);
+        requeue_gaps(checkpoint, retry, chunk);
+    }
+    return resumed;
+}
+
+/*
+ * Numbers [lo, hi) are done.
+ */
+void checkpoint_done(struct checkpoint *checkpoint, uint64_t lo, uint64_t hi) {
+    if (checkpoint->file == NULL || hi <= lo)
+        return;
+    pthread_mutex_lock(&checkpoint->lock);
+    if (hi > checkpoint->watermark) {
+        add_run(checkpoint, lo > checkpoint->watermark ? lo : checkpoint->watermark, hi);
+        // only the first run can reach watermark
+        if (checkpoint->runs[0].lo == checkpoint->watermark) {
+            checkpoint->watermark = checkpoint->runs[0].hi;
+            checkpoint->run_count--;
+            memmove(&checkpoint->runs[0], &checkpoint->runs[1], checkpoint->run_count * sizeof(struct checkpoint_run));
+        }
+        checkpoint->dirty = 1;
+    }
+    pthread_mutex_unlock(&checkpoint->lock);
+}
+
+/*
+ * Numbers of batch, consecutive ones are marked as one run.
+ */
+void checkpoint_done_numbers(struct checkpoint *checkpoint, const uint64_t *numbers, int count) {
+    for (int i = 0; i < count; ) {
+        int j = i + 1;
+        while (j < count && numbers[j] == numbers[j - 1] + 1)
+            j++;
+        checkpoint_done(checkpoint, numbers[i], numbers[j - 1] + 1);
+        i = j;
+    }
+}
+
+/*
+ * Task taken from table with inflight_take.
+ */
+void checkpoint_done_task(struct checkpoint *checkpoint, const struct inflight_table *table,
+                          const struct inflight_task *task) {
+    if (task->hi != 0)
+        checkpoint_done(checkpoint, task->lo, task->hi);
+    else
+        checkpoint_done_numbers(checkpoint, inflight_task_numbers(table, task), task->count);
+}
+
+/*
+ * Returns 1 if every number of scan is done.
+ */
+int checkpoint_finished(struct checkpoint *checkpoint) {
+    if (checkpoint->file == NULL)
+        return 0;
+    pthread_mutex_lock(&checkpoint->lock);
+    int finished = checkpoint->watermark >= checkpoint->file->hi;
+    pthread_mutex_unlock(&checkpoint->lock);
+    return finished;
+}
+
+/*
+ * Writes state to the file if it changed. Servers mark numbers done only
+ * after their results were put to result sink, which keeps every result
+ * until it is written. Sink is flushed before the state becomes current, so
+ * numbers marked done have their results in the file. Called by syncing
+ * thread and once at exit.
+ */
+void checkpoint_sync(struct checkpoint *checkpoint, struct task_source *source, struct result_sink *results) {
+    if (checkpoint->file == NULL)
+        return;
+    pthread_mutex_lock(&checkpoint->sync_lock);
+    write_state(checkpoint, source, results);
+    pthread_mutex_unlock(&checkpoint->sync_lock);
+}
+
+/*
+ * Calls checkpoint_sync every CHECKPOINT_SYNC_MS from separate thread, so
+ * waiting for result writer and disk stays out of message handling.
+ */
+int checkpoint_start_syncer(struct checkpoint *checkpoint, struct task_source *source, struct result_sink *results) {
+    if (checkpoint->file == NULL)
+        return 0;
+    checkpoint->source = source;
+    checkpoint->results = results;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    // signals are left to server threads
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    int error = pthread_create(&thread, &attr, run_syncer, checkpoint);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    return error == 0 ? 0 : -1;
+}
+
+void *run_syncer(void *arg) {
+    struct checkpoint *checkpoint = arg;
+    struct timespec interval;
+    interval.tv_sec = CHECKPOINT_SYNC_MS / 1000;
+    interval.tv_nsec = CHECKPOINT_SYNC_MS % 1000 * 1000000L;
+    while (1) {
+        nanosleep(&interval, NULL);
+        checkpoint_sync(checkpoint, checkpoint->source, checkpoint->results);
+    }
+    return NULL;
+}
+
+/*
+ * Saves state for the last time. It has to come before result sink is
+ * closed, results put after that are ignored and must not be counted.
+ */
+void checkpoint_close(struct checkpoint *checkpoint, struct task_source *source, struct result_sink *results) {
+    if (checkpoint->file == NULL)
+        return;
+    pthread_mutex_lock(&checkpoint->sync_lock);
+    write_state(checkpoint, source, results);
+    munmap(checkpoint->file, checkpoint->file_size);
+    close(checkpoint->fd);
+    pthread_mutex_lock(&checkpoint->lock);
+    checkpoint->file = NULL;
+    free(checkpoint->runs);
+    checkpoint->runs = NULL;
+    pthread_mutex_unlock(&checkpoint->lock);
+    pthread_mutex_unlock(&checkpoint->sync_lock);
+}
+
+/*
+ * Adds [lo, hi) above watermark to runs, merging it with runs it touches.
+ * Runs grow when they are full. Only if memory runs out the highest run is
+ * forgotten - its numbers are done again after restart.
+ */
+void add_run(struct checkpoint *checkpoint, uint64_t lo, uint64_t hi) {
+    struct checkpoint_run *runs = checkpoint->runs;
+    int count = (int) checkpoint->run_count;
+    // first run which ends at lo or later
+    int first = 0, end = count;
+    while (first < end) {
+        int middle = (first + end) / 2;
+        if (runs[middle].hi < lo)
+            first = middle + 1;
+        else
+            end = middle;
+    }
+    int last = first;
+    while (last < count && runs[last].lo <= hi) {
+        if (runs[last].lo < lo)
+            lo = runs[last].lo;
+        if (runs[last].hi > hi)
+            hi = runs[last].hi;
+        last++;
+    }
+    if (last == first) { // touches no run
+        if ((uint32_t) count == checkpoint->run_capacity) {
+            runs = realloc(runs, 2 * (size_t) count * sizeof(struct checkpoint_run));
+            if (runs != NULL) {
+                checkpoint->runs = runs;
+                checkpoint->run_capacity = 2 * count;
+            } else if (first == count) {
+                return;
+            } else {
+                runs = checkpoint->runs;
+                count--;
+            }
+        }
+        memmove(&runs[first + 1], &runs[first], (count - first) * sizeof(struct checkpoint_run));
+        count++;
+    } else {
+        memmove(&runs[first + 1], &runs[last], (count - last) * sizeof(struct checkpoint_run));
+        count -= last - first - 1;
+    }
+    runs[first].lo = lo;
+    runs[first].hi = hi;
+    checkpoint->run_count = count;
+}
+
+/*
+ * Runs of state have to lie in file after its header.
+ */
+int valid_state(const struct checkpoint_file *file, size_t file_size, const struct checkpoint_state *state) {
+    if (state->watermark < file->lo || state->watermark > state->cursor || state->cursor > file->hi
+        || state->run_count > state->run_capacity || state->runs < sizeof(struct checkpoint_file)
+        || state->runs > file_size || (file_size - state->runs) / sizeof(struct checkpoint_run) < state->run_capacity)
+        return 0;
+    const struct checkpoint_run *runs = (const void *) ((const char *) file + state->runs);
+    uint64_t previous = state->watermark;
+    for (uint32_t i = 0; i < state->run_count; i++) {
+        if (runs[i].lo <= previous || runs[i].hi <= runs[i].lo)
+            return 0;
+        previous = runs[i].hi;
+    }
+    return 1;
+}
+
+int load_state(struct checkpoint *checkpoint, const struct checkpoint_state *state) {
+    uint32_t capacity = state->run_count > CHECKPOINT_INITIAL_RUNS ? state->run_count : CHECKPOINT_INITIAL_RUNS;
+    checkpoint->runs = malloc(capacity * sizeof(struct checkpoint_run));
+    if (checkpoint->runs == NULL)
+        return -1;
+    memcpy(checkpoint->runs, (char *) checkpoint->file + state->runs, state->run_count * sizeof(struct checkpoint_run));
+    checkpoint->run_count = state->run_count;
+    checkpoint->run_capacity = capacity;
+    checkpoint->cursor = state->cursor;
+    checkpoint->watermark = state->watermark;
+    return 0;
+}
+
+/*
+ * Gives state at index room for run_count runs at the end of file, twice
+ * as big as needed so it is not done often. Its old room is left unused.
+ * Locks of checkpoint have to be held.
+ */
+int make_room(struct checkpoint *checkpoint, uint32_t index, uint32_t run_count) {
+    size_t offset = checkpoint->file_size;
+    size_t file_size = offset + 2 * (size_t) run_count * sizeof(struct checkpoint_run);
+    if (ftruncate(checkpoint->fd, file_size) != 0)
+        return -1;
+    struct checkpoint_file *file = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, checkpoint->fd, 0);
+    if (file == MAP_FAILED)
+        return -1;
+    munmap(checkpoint->file, checkpoint->file_size);
+    checkpoint->file = file;
+    checkpoint->file_size = file_size;
+    file->states[index].runs = offset;
+    file->states[index].run_capacity = 2 * run_count;
+    return 0;
+}
+
+/*
+ * Lock for syncing has to be held. State which does not fit in file is
+ * left dirty, so it is tried again by next sync.
+ */
+void write_state(struct checkpoint *checkpoint, struct task_source *source, struct result_sink *results) {
+    struct checkpoint_file *file = checkpoint->file;
+    if (file == NULL)
+        return;
+    pthread_mutex_lock(&checkpoint->lock);
+    uint64_t cursor = atomic_load(&source->cursor);
+    if (cursor > file->hi - file->lo) // cursor of exhausted source can go past the end
+        cursor = file->hi - file->lo;
+    cursor += file->lo;
+    int changed = checkpoint->dirty || cursor != checkpoint->cursor;
+    uint32_t next = 1 - file->current;
+    if (changed && checkpoint->run_count > file->states[next].run_capacity
+        && make_room(checkpoint, next, checkpoint->run_count) != 0) {
+        pthread_mutex_unlock(&checkpoint->lock);
+        return;
+    }
+    file = checkpoint->file;
+    if (changed) {
+        struct checkpoint_state *state = &file->states[next];
+        checkpoint->cursor = cursor;
+        state->cursor = checkpoint->cursor;
+        state->watermark = checkpoint->watermark;
+        state->run_count = checkpoint->run_count;
+        memcpy((char *) file + state->runs, checkpoint->runs, checkpoint->run_count * sizeof(struct checkpoint_run));
+        checkpoint->dirty = 0;
+    }
+    pthread_mutex_unlock(&checkpoint->lock);
+    if (changed) {
+        result_sink_flush(results);
+        msync(file, checkpoint->file_size, MS_SYNC);
+        file->current = next;
+        msync(file, checkpoint->file_size, MS_SYNC);
+    }
+}
+
+/*
+ * Numbers given out without result are [watermark, cursor) without runs.
+ */
+void requeue_gaps(const struct checkpoint *checkpoint, struct retry_queue *retry, uint64_t chunk) {
+    const struct checkpoint_run *runs = checkpoint->runs;
+    uint64_t lo = checkpoint->watermark;
+    for (uint32_t i = 0; i <= checkpoint->run_count && lo < checkpoint->cursor; i++) {
+        uint64_t hi = i < checkpoint->run_count && runs[i].lo < checkpoint->cursor ? runs[i].lo : checkpoint->cursor;
+        for (uint64_t next = lo; next < hi; next += chunk > 0 ? chunk : hi - next)
+            retry_queue_push(retry, next, chunk > 0 && hi - next > chunk ? next + chunk : hi);
+        if (i < checkpoint->run_count)
+            lo = runs[i].hi;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef COMMON_CHECKPOINT_H
+#define COMMON_CHECKPOINT_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "task_source.h"
+#include "retry_queue.h"
+#include "inflight.h"
+#include "result_sink.h"
+
+#define CHECKPOINT_MAGIC 0x54504b43 // "CKPT"
+#define CHECKPOINT_VERSION 2
+// room for runs of each state in new file, it is added to when runs do not fit
+#define CHECKPOINT_INITIAL_RUNS 4096
+// how often syncing thread saves state
+#define CHECKPOINT_SYNC_MS 1000
+
+struct checkpoint_run {
+    uint64_t lo;
+    uint64_t hi; // run is [lo, hi)
+};
+
+/*
+ * Progress of scan as saved in file. Every number below watermark is done,
+ * numbers in runs are done too and the rest of [watermark, cursor) was
+ * given out without result - those are the tasks in flight, redone after
+ * restart. Runs are sorted, disjoint and above watermark.
+ */
+struct checkpoint_state {
+    uint64_t cursor; // next number of scan source
+    uint64_t watermark;
+    uint64_t runs; // offset of runs in file
+    uint32_t run_count;
+    uint32_t run_capacity; // runs which fit at the offset
+};
+
+/*
+ * Checkpoint file is mapped and holds two states. The one not in use is
+ * written and synced before current is switched to it, so a crash in the
+ * middle of writing leaves the previous state whole. When runs do not fit
+ * room of the state, bigger room is added at the end of file - room of
+ * current state is never written.
+ */
+struct checkpoint_file {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t lo; // scan the checkpoint belongs to
+    uint64_t hi;
+    uint32_t current; // index of valid state
+    uint32_t reserved;
+    struct checkpoint_state states[2];
+};
+
+/*
+ * Progress is kept in memory, where runs grow as needed, and written to
+ * file by checkpoint_sync. Thread-safe.
+ */
+struct checkpoint {
+    struct checkpoint_file *file; // NULL - checkpoint is disabled
+    size_t file_size;
+    int fd; // kept to make room in file
+    pthread_mutex_t lock;
+    pthread_mutex_t sync_lock; // file is written outside of lock
+    uint64_t cursor;
+    uint64_t watermark;
+    struct checkpoint_run *runs;
+    uint32_t run_count;
+    uint32_t run_capacity;
+    int dirty;
+    struct task_source *source; // set for syncing thread
+    struct result_sink *results;
+};
+
+int checkpoint_open(struct checkpoint *checkpoint, const char *path, struct task_source *source,
+                    struct retry_queue *retry, uint64_t chunk);
+void checkpoint_done(struct checkpoint *checkpoint, uint64_t lo, uint64_t hi);
+void checkpoint_done_numbers(struct checkpoint *checkpoint, const uint64_t *numbers, int count);
+void checkpoint_done_task(struct checkpoint *checkpoint, const struct inflight_table *table,
+                          const struct inflight_task *task);
+int checkpoint_finished(struct checkpoint *checkpoint);
+void checkpoint_sync(struct checkpoint *checkpoint, struct task_source *source, struct result_sink *results);
+int checkpoint_start_syncer(struct checkpoint *checkpoint, struct task_source *source, struct result_sink *results);
+void checkpoint_close(struct checkpoint *checkpoint, struct task_source *source, struct result_sink *results);
+
+#endif //COMMON_CHECKPOINT_H
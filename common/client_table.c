@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include "client_table.h"
+
+#define STATE_USED 1
+#define STATE_GENERATION(state) ((state) >> 1)
+
+int client_table_init(struct client_table *table, int size) {
+    if (size <= 0 || size > CLIENT_TABLE_MAX)
+        return -1;
+    table->entries = malloc(size * sizeof(struct client_entry));
+    if (table->entries == NULL)
+        return -1;
+    table->size = size;
+    atomic_init(&table->available, size);
+    atomic_init(&table->free_head, 0);
+    for (int i = 0; i < size; i++) {
+        atomic_init(&table->entries[i].next_free, i + 1 < size ? i + 1 : CLIENT_FREE_LIST_END);
+        atomic_init(&table->entries[i].state, 0);
+    }
+    return 0;
+}
+
+void client_table_destroy(struct client_table *table) {
+    free(table->entries);
+    table->entries = NULL;
+    table->size = 0;
+    atomic_store(&table->available, 0);
+    atomic_store(&table->free_head, CLIENT_FREE_LIST_END);
+}
+
+/*
+ * Returns new client id or -1 if there is no free slot.
+ */
+int client_table_alloc(struct client_table *table) {
+    uint64_t head = atomic_load(&table->free_head);
+    uint32_t slot;
+    while (1) {
+        slot = (uint32_t) head;
+        if (slot == CLIENT_FREE_LIST_END)
+            return -1;
+        uint32_t next = atomic_load(&table->entries[slot].next_free);
+        uint64_t new_head = ((head >> 32) + 1) << 32 | next;
+        if (atomic_compare_exchange_weak(&table->free_head, &head, new_head))
+            break;
+    }
+    atomic_fetch_or(&table->entries[slot].state, STATE_USED);
+    atomic_fetch_sub(&table->available, 1);
+    return client_table_id(table, slot);
+}
+
+/*
+ * Returns slot of client or -1 if client_id is incorrect or stale.
+ */
+int client_table_slot(struct client_table *table, int client_id) {
+    if (client_id < 0)
+        return -1;
+    int slot = client_id & (CLIENT_TABLE_MAX - 1);
+    if (slot >= table->size)
+        return -1;
+    int state = atomic_load(&table->entries[slot].state);
+    if (!(state & STATE_USED) || STATE_GENERATION(state) != client_id >> CLIENT_SLOT_BITS)
+        return -1;
+    return slot;
+}
+
+/*
+ * Only one of concurrent releases of the same client succeeds, the others
+ * get -1.
+ */
+int client_table_release(struct client_table *table, int client_id) {
+    int slot = client_table_slot(table, client_id);
+    if (slot == -1)
+        return -1;
+    struct client_entry *entry = &table->entries[slot];
+    int state = (client_id >> CLIENT_SLOT_BITS) << 1 | STATE_USED;
+    int new_state = ((STATE_GENERATION(state) + 1) & CLIENT_GENERATION_MASK) << 1;
+    if (!atomic_compare_exchange_strong(&entry->state, &state, new_state))
+        return -1;
+    uint64_t head = atomic_load(&table->free_head);
+    uint64_t new_head;
+    do {
+        atomic_store(&entry->next_free, (uint32_t) head);
+        new_head = ((head >> 32) + 1) << 32 | (uint32_t) slot;
+    } while (!atomic_compare_exchange_weak(&table->free_head, &head, new_head));
+    atomic_fetch_add(&table->available, 1);
+    return slot;
+}
+
+int client_table_id(struct client_table *table, int slot) {
+    return STATE_GENERATION(atomic_load(&table->entries[slot].state)) << CLIENT_SLOT_BITS | slot;
+}
@@ -0,0 +1,43 @@
+#ifndef COMMON_CLIENT_TABLE_H
+#define COMMON_CLIENT_TABLE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Client id = generation << CLIENT_SLOT_BITS | slot. Generation of a slot
+ * changes every time it is released, so id of departed client is rejected.
+ */
+#define CLIENT_SLOT_BITS 16
+#define CLIENT_GENERATION_MASK 0x7fff
+#define CLIENT_TABLE_MAX (1 << CLIENT_SLOT_BITS)
+
+#define CLIENT_FREE_LIST_END UINT32_MAX
+
+/*
+ * state = generation << 1 | used, so both change with one compare-and-swap.
+ */
+struct client_entry {
+    _Atomic uint32_t next_free; // next slot on free list
+    _Atomic int state;
+};
+
+/*
+ * All operations are lock-free and may be called from many threads. Free
+ * slots form a stack, free_head is ABA tag << 32 | slot.
+ */
+struct client_table {
+    int size;
+    _Atomic int available;
+    _Atomic uint64_t free_head;
+    struct client_entry *entries;
+};
+
+int client_table_init(struct client_table *table, int size);
+void client_table_destroy(struct client_table *table);
+int client_table_alloc(struct client_table *table);
+int client_table_slot(struct client_table *table, int client_id);
+int client_table_release(struct client_table *table, int client_id);
+int client_table_id(struct client_table *table, int slot);
+
+#endif //COMMON_CLIENT_TABLE_H
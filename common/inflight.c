@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <string.h>
+#include "inflight.h"
+
+int add_task(struct inflight_table *table, uint64_t key, uint64_t sent_at, uint64_t deadline);
+int find_task(struct inflight_table *table, uint64_t key);
+void requeue_task(struct inflight_table *table, int index, struct retry_queue *retry);
+
+void inflight_init(struct inflight_table *table, struct timer_wheel *wheel, int slot) {
+    memset(table, 0, sizeof(struct inflight_table));
+    table->wheel = wheel;
+    table->slot = slot;
+}
+
+/*
+ * Makes room for capacity tasks of batch_size numbers, table has to be
+ * empty. Numbers are kept between clients of the slot.
+ */
+int inflight_reserve(struct inflight_table *table, int capacity, int batch_size) {
+    if (capacity > INFLIGHT_MAX)
+        capacity = INFLIGHT_MAX;
+    if ((size_t) capacity * batch_size > (size_t) table->capacity * table->batch_size) {
+        uint64_t *numbers = realloc(table->numbers, (size_t) capacity * batch_size * sizeof(uint64_t));
+        if (numbers == NULL)
+            return -1;
+        table->numbers = numbers;
+    }
+    table->capacity = capacity;
+    table->batch_size = batch_size;
+    return 0;
+}
+
+/*
+ * First number is key of the task. Returns -1 if table is full.
+ */
+int inflight_add_numbers(struct inflight_table *table, uint64_t sent_at, uint64_t deadline, const uint64_t *numbers,
+                         int count) {
+    if (count < 1 || count > table->batch_size)
+        return -1;
+    int index = add_task(table, numbers[0], sent_at, deadline);
+    if (index == -1)
+        return -1;
+    table->tasks[index].count = count;
+    memcpy(table->numbers + (size_t) index * table->batch_size, numbers, count * sizeof(uint64_t));
+    return 0;
+}
+
+int inflight_add_range(struct inflight_table *table, uint64_t sent_at, uint64_t deadline, uint64_t lo, uint64_t hi) {
+    int index = add_task(table, lo, sent_at, deadline);
+    if (index == -1)
+        return -1;
+    table->tasks[index].lo = lo;
+    table->tasks[index].hi = hi;
+    return 0;
+}
+
+/*
+ * Removes the oldest task with given key and copies it to task. Returns -1
+ * if there is none - result is late and its task was sent again.
+ */
+int inflight_take(struct inflight_table *table, uint64_t key, struct inflight_task *task) {
+    int found = find_task(table, key);
+    if (found == -1)
+        return -1;
+    // node is unlinked first, then nothing else changes it
+    timer_wheel_remove(table->wheel, &table->tasks[found].timer);
+    *task = table->tasks[found];
+    table->tasks[found].used = 0;
+    table->count--;
+    return 0;
+}
+
+/*
+ * Copies the oldest task with given key and leaves it in table. Timer of the
+ * copy is not set, as the node is still linked.
+ */
+int inflight_find(struct inflight_table *table, uint64_t key, struct inflight_task *task) {
+    int found = find_task(table, key);
+    if (found == -1)
+        return -1;
+    struct inflight_task *source = &table->tasks[found];
+    task->used = source->used;
+    task->key = source->key;
+    task->sent_at = source->sent_at;
+    task->lo = source->lo;
+    task->hi = source->hi;
+    task->count = source->count;
+    task->index = source->index;
+    task->timer.next = NULL;
+    task->timer.prev = NULL;
+    task->timer.deadline = 0;
+    task->timer.owner = 0;
+    return 0;
+}
+
+/*
+ * Numbers in task.
+ */
+uint64_t inflight_task_size(const struct inflight_task *task) {
+    return task->hi != 0 ? task->hi - task->lo : (uint64_t) task->count;
+}
+
+/*
+ * Numbers of task copied by inflight_take, valid until another task is added.
+ */
+const uint64_t *inflight_task_numbers(const struct inflight_table *table, const struct inflight_task *task) {
+    return table->numbers + (size_t) task->index * table->batch_size;
+}
+
+/*
+ * Task expired in timer wheel could be answered and replaced by another
+ * before lock of the slot was taken, so it is checked again. Returns 1 if
+ * task was put to retry queue.
+ */
+int inflight_requeue_expired(struct inflight_table *table, int index, uint64_t now, struct retry_queue *retry) {
+    struct inflight_task *task = &table->tasks[index];
+    if (!task->used || timer_wheel_pending(table->wheel, &task->timer) || task->timer.deadline > now)
+        return 0;
+    requeue_task(table, index, retry);
+    return 1;
+}
+
+/*
+ * Returns number of tasks put to retry queue.
+ */
+int inflight_requeue_all(struct inflight_table *table, struct retry_queue *retry) {
+    int count = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        if (!table->tasks[i].used)
+            continue;
+        timer_wheel_remove(table->wheel, &table->tasks[i].timer);
+        requeue_task(table, i, retry);
+        count++;
+    }
+    return count;
+}
+
+int find_task(struct inflight_table *table, uint64_t key) {
+    int found = -1;
+    for (int i = 0; i < table->capacity; i++)
+        if (table->tasks[i].used && table->tasks[i].key == key
+            && (found == -1 || table->tasks[i].sent_at < table->tasks[found].sent_at))
+            found = i;
+    return found;
+}
+
+int add_task(struct inflight_table *table, uint64_t key, uint64_t sent_at, uint64_t deadline) {
+    for (int i = 0; i < table->capacity; i++) {
+        struct inflight_task *task = &table->tasks[i];
+        if (task->used)
+            continue;
+        task->used = 1;
+        task->key = key;
+        task->sent_at = sent_at;
+        task->lo = 0;
+        task->hi = 0;
+        task->count = 0;
+        task->index = i;
+        timer_wheel_add(table->wheel, &task->timer, deadline, table->slot * INFLIGHT_MAX + i);
+        table->count++;
+        return i;
+    }
+    return -1;
+}
+
+/*
+ * Task has to be unlinked from timer wheel.
+ */
+void requeue_task(struct inflight_table *table, int index, struct retry_queue *retry) {
+    struct inflight_task *task = &table->tasks[index];
+    if (task->hi != 0)
+        retry_queue_push(retry, task->lo, task->hi);
+    else
+        retry_queue_push_numbers(retry, table->numbers + (size_t) index * table->batch_size, task->count);
+    task->used = 0;
+    table->count--;
+}
@@ -0,0 +1,52 @@
+#ifndef COMMON_INFLIGHT_H
+#define COMMON_INFLIGHT_H
+
+#include <stdint.h>
+#include "timer_wheel.h"
+#include "retry_queue.h"
+
+// at least MAX_WINDOW of every server
+#define INFLIGHT_MAX 64
+// slot of table which task expired in timer wheel
+#define INFLIGHT_OWNER_SLOT(owner) ((owner) / INFLIGHT_MAX)
+#define INFLIGHT_OWNER_INDEX(owner) ((owner) % INFLIGHT_MAX)
+
+struct inflight_task {
+    int used;
+    uint64_t key; // tested number, first number of batch or start of range
+    uint64_t sent_at; // nanoseconds, CLOCK_MONOTONIC
+    uint64_t lo; // range task
+    uint64_t hi; // 0 - task of numbers
+    int count; // numbers of task, kept in numbers of table
+    int index; // in table, numbers of task start at index * batch_size
+    struct timer_node timer;
+};
+
+/*
+ * Tasks sent to one client and not answered yet, with their numbers, so
+ * they can be sent again when the client is gone or misses deadline. Not
+ * thread-safe, server guards it with lock of client slot.
+ */
+struct inflight_table {
+    int count;
+    int capacity; // at most INFLIGHT_MAX
+    int batch_size;
+    uint64_t *numbers; // batch_size numbers for every task
+    struct timer_wheel *wheel;
+    int slot;
+    struct inflight_task tasks[INFLIGHT_MAX];
+};
+
+void inflight_init(struct inflight_table *table, struct timer_wheel *wheel, int slot);
+int inflight_reserve(struct inflight_table *table, int capacity, int batch_size);
+int inflight_add_numbers(struct inflight_table *table, uint64_t sent_at, uint64_t deadline, const uint64_t *numbers,
+                         int count);
+int inflight_add_range(struct inflight_table *table, uint64_t sent_at, uint64_t deadline, uint64_t lo, uint64_t hi);
+int inflight_take(struct inflight_table *table, uint64_t key, struct inflight_task *task);
+int inflight_find(struct inflight_table *table, uint64_t key, struct inflight_task *task);
+uint64_t inflight_task_size(const struct inflight_task *task);
+const uint64_t *inflight_task_numbers(const struct inflight_table *table, const struct inflight_task *task);
+int inflight_requeue_expired(struct inflight_table *table, int index, uint64_t now, struct retry_queue *retry);
+int inflight_requeue_all(struct inflight_table *table, struct retry_queue *retry);
+
+#endif //COMMON_INFLIGHT_H
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include "options.h"
+#include "client_table.h"
+
+/*
+ * Parses options and leaves optind at first positional argument.
+ */
+int parse_server_options(int argc, char *argv[], struct server_options *options,
+                         uint64_t max_range_size, uint64_t max_bitmap_range_size, int max_threads) {
+    options->client_max = DEFAULT_CLIENT_MAX;
+    options->range_size = 0;
+    options->range_bitmap = 0;
+    options->threads = 1;
+    options->result_sink = RESULT_SINK_TEXT;
+    options->result_path = NULL;
+    task_source_parse("random", &options->task_source);
+    options->stats_name = NULL;
+    options->task_deadline = DEFAULT_TASK_DEADLINE;
+    options->result_priority = 0;
+    options->pool_tasks = 0;
+    options->target_ms = 0;
+    options->factorize = 0;
+    options->checkpoint_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:r:bt:s:f:g:m:d:p:q:a:ko:")) != -1) {
+        switch (opt) {
+            case 'c':
+                options->client_max = atoi(optarg);
+                if (options->client_max <= 0 || options->client_max > CLIENT_TABLE_MAX) {
+                    printf("Incorrect max number of clients. It should be between 1 and %d.\n", CLIENT_TABLE_MAX);
+                    return 1;
+                }
+                break;
+            case 'r':
+                options->range_size = strtoull(optarg, NULL, 10);
+                if (options->range_size == 0 || options->range_size > max_range_size) {
+                    printf("Incorrect range size. It should be between 1 and %llu.\n",
+                           (unsigned long long) max_range_size);
+                    return 1;
+                }
+                break;
+            case 'b':
+                options->range_bitmap = 1;
+                break;
+            case 't':
+                options->threads = atoi(optarg);
+                if (options->threads <= 0 || options->threads > max_threads) {
+                    printf("Incorrect number of threads. It should be between 1 and %d.\n", max_threads);
+                    return 1;
+                }
+                break;
+            case 's':
+                if (strcmp(optarg, "text") == 0) {
+                    options->result_sink = RESULT_SINK_TEXT;
+                } else if (strcmp(optarg, "binary") == 0) {
+                    options->result_sink = RESULT_SINK_BINARY;
+                } else if (strcmp(optarg, "counters") == 0) {
+                    options->result_sink = RESULT_SINK_COUNTERS;
+                } else {
+                    printf("Incorrect result sink. It should be text, binary or counters.\n");
+                    return 1;
+                }
+                break;
+            case 'f':
+                options->result_path = optarg;
+                break;
+            case 'g':
+                if (task_source_parse(optarg, &options->task_source) != 0) {
+                    printf("Incorrect task source. It should be random, scan:lo:hi, unique:lo:hi or file:path"
+                           " (with lo < hi).\n");
+                    return 1;
+                }
+                break;
+            case 'm':
+                if (optarg[0] != '/' || strlen(optarg) < 2 || strchr(optarg + 1, '/') != NULL) {
+                    printf("Statistics segment name must start with / and contain no other / character.\n");
+                    return 1;
+                }
+                options->stats_name = optarg;
+                break;
+            case 'd':
+                options->task_deadline = atoi(optarg);
+                if (options->task_deadline <= 0) {
+                    printf("Incorrect task deadline. It should be > 0.\n");
+                    return 1;
+                }
+                break;
+            case 'p':
+                options->result_priority = atoi(optarg);
+                if (options->result_priority < 0 || options->result_priority > MAX_RESULT_PRIORITY) {
+                    printf("Incorrect result priority. It should be between 0 and %d.\n", MAX_RESULT_PRIORITY);
+                    return 1;
+                }
+                break;
+            case 'q':
+                options->pool_tasks = atoi(optarg);
+                if (options->pool_tasks <= 0) {
+                    printf("Incorrect number of tasks in shared queue. It should be > 0.\n");
+                    return 1;
+                }
+                break;
+            case 'a':
+                options->target_ms = atoi(optarg);
+                if (options->target_ms <= 0) {
+                    printf("Incorrect time per dispatch. It should be > 0.\n");
+                    return 1;
+                }
+                break;
+            case 'k':
+                options->factorize = 1;
+                break;
+            case 'o':
+                options->checkpoint_path = optarg;
+                break;
+            default:
+                return 1;
+        }
+    }
+    if (options->range_bitmap && options->range_size > max_bitmap_range_size) {
+        printf("Range size with bitmap should be at most %llu.\n", (unsigned long long) max_bitmap_range_size);
+        return 1;
+    }
+    if (options->range_size > 0 && options->task_source.kind != TASK_SOURCE_RANDOM
+        && options->task_source.kind != TASK_SOURCE_SCAN) {
+        printf("Range tasks can be taken only from random or scan task source.\n");
+        return 1;
+    }
+    if (options->factorize && options->range_size > 0) {
+        printf("Factorization tasks cannot be combined with range tasks.\n");
+        return 1;
+    }
+    if (options->checkpoint_path != NULL && options->task_source.kind != TASK_SOURCE_SCAN) {
+        printf("Checkpoint can be kept only for scan task source.\n");
+        return 1;
+    }
+    if (options->result_sink == RESULT_SINK_BINARY && options->result_path == NULL) {
+        printf("Binary result sink needs a file.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Batch size granted to client or range size.
+ */
+uint64_t server_dispatch_limit(const struct server_options *options, int batch_size) {
+    return options->range_size > 0 ? options->range_size : (uint64_t) batch_size;
+}
+
+/*
+ * With -a the size measured to take target time, up to the limit.
+ */
+uint64_t server_dispatch_size(const struct server_options *options, const struct batch_sizer *sizer, int batch_size) {
+    return options->target_ms > 0 ? sizer->size : server_dispatch_limit(options, batch_size);
+}
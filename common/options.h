@@ -0,0 +1,59 @@
+#ifndef COMMON_OPTIONS_H
+#define COMMON_OPTIONS_H
+
+#include <stdint.h>
+#include "result_sink.h"
+#include "task_source.h"
+#include "batch_sizer.h"
+
+#define DEFAULT_CLIENT_MAX 1024
+#define MAX_SERVER_THREADS 64
+#define DEFAULT_TASK_DEADLINE 60
+// intro messages go in lane of this priority, results with lower
+// priority wait for them, with higher one they go first and with the same
+// one they share lane
+#define CONTROL_LANE_PRIORITY 1
+#define MAX_RESULT_PRIORITY 2
+
+#define SERVER_OPTIONS_HELP \
+    "Options:\n" \
+    "  -c max_clients  max number of connected clients (default 1024)\n" \
+    "  -r range_size   send ranges of numbers instead of single numbers\n" \
+    "  -b              return bitmap of primes for ranges (prime count by default)\n" \
+    "  -t threads      number of threads receiving client messages (default 1)\n" \
+    "  -s sink         where results go: text (default), binary or counters\n" \
+    "  -f file         file for results (standard output by default, required for binary)\n" \
+    "  -g source       numbers to test: random (default), scan:lo:hi, unique:lo:hi or file:path\n" \
+    "  -m name         publish statistics in shared memory segment name (with preceding /)\n" \
+    "  -d seconds      task without result for that long is sent to another client (default 60)\n" \
+    "  -p priority     lane of results in server queue: 0 - after intro messages (default),\n" \
+    "                  1 - in order with them, 2 - before them (no effect on shared memory and socket servers)\n" \
+    "  -q tasks        keep that many tasks in shared queue, clients take them themselves (SysV server only)\n" \
+    "  -a ms           size batches and ranges of every client to take about ms from send to result\n" \
+    "                  (batch size and -r range size are upper bounds)\n" \
+    "  -k              clients factorize numbers instead of testing them, one number per task\n" \
+    "  -o file         keep progress of scan source in file, restarted server resumes from it\n"
+
+struct server_options {
+    int client_max;
+    uint64_t range_size; // 0 - no range tasks
+    int range_bitmap;
+    int threads;
+    int result_sink; // RESULT_SINK_*
+    char *result_path; // NULL - standard output
+    struct task_source_spec task_source;
+    char *stats_name; // NULL - statistics are not published
+    int task_deadline; // seconds
+    int result_priority; // other than CONTROL_LANE_PRIORITY puts results in their own lane
+    int pool_tasks; // high-water mark of shared task queue, 0 - tasks are sent to clients
+    int target_ms; // time per dispatch, 0 - batches and ranges have fixed size
+    int factorize; // tasks ask for prime factors instead of verdict
+    char *checkpoint_path; // NULL - progress is not kept
+};
+
+int parse_server_options(int argc, char *argv[], struct server_options *options,
+                         uint64_t max_range_size, uint64_t max_bitmap_range_size, int max_threads);
+uint64_t server_dispatch_limit(const struct server_options *options, int batch_size);
+uint64_t server_dispatch_size(const struct server_options *options, const struct batch_sizer *sizer, int batch_size);
+
+#endif //COMMON_OPTIONS_H
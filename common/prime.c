@@ -0,0 +1,454 @@
+#include <string.h>
+#include <pthread.h>
+#include "prime.h"
+#include "prime_tables.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define PRIME_VECTOR_KERNELS
+#endif
+
+// is_prime divides by primes up to 53, factorize by all small primes
+#define TRIAL_PRIMES_NUM 16
+// small_primes[WHEEL_PRIMES_NUM] is the first prime wheel does not rule out
+#define WHEEL_PRIMES_NUM 4
+
+// bases for which Miller-Rabin test is deterministic below given bound
+static const uint64_t bases_32[] = {2, 7, 61};
+static const uint64_t bases_64[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+
+/*
+ * Montgomery arithmetic modulo odd n with R = 2^64.
+ */
+struct montgomery {
+    uint64_t n;
+    uint64_t n_inv; // n^-1 mod 2^64
+    uint64_t one;   // R mod n
+    uint64_t r2;    // R^2 mod n
+};
+
+static void montgomery_init(struct montgomery *m, uint64_t n) {
+    uint64_t inv = n; // correct on 3 lowest bits for odd n
+    for (int i = 0; i < 5; i++)
+        inv *= 2 - n * inv;
+    m->n = n;
+    m->n_inv = inv;
+    m->one = (0 - n) % n;
+    m->r2 = (uint64_t) (((unsigned __int128) m->one << 64) % n);
+}
+
+/*
+ * Returns t / R mod n for t < n * R.
+ */
+static inline uint64_t montgomery_reduce(const struct montgomery *m, unsigned __int128 t) {
+    uint64_t q = (uint64_t) t * m->n_inv;
+    uint64_t t_high = t >> 64;
+    uint64_t qn_high = ((unsigned __int128) q * m->n) >> 64;
+    uint64_t result = t_high - qn_high;
+    if (t_high < qn_high)
+        result += m->n;
+    return result;
+}
+
+static inline uint64_t montgomery_mul(const struct montgomery *m, uint64_t a, uint64_t b) {
+    return montgomery_reduce(m, (unsigned __int128) a * b);
+}
+
+static inline uint64_t montgomery_from(const struct montgomery *m, uint64_t a) {
+    return montgomery_mul(m, a % m->n, m->r2);
+}
+
+static uint64_t montgomery_pow(const struct montgomery *m, uint64_t base, uint64_t exp) {
+    uint64_t result = m->one;
+    while (exp > 0) {
+        if (exp & 1)
+            result = montgomery_mul(m, result, base);
+        base = montgomery_mul(m, base, base);
+        exp >>= 1;
+    }
+    return result;
+}
+
+/*
+ * Strong probable prime test of odd n > 2 to given base, n - 1 = d * 2^s.
+ */
+static int miller_rabin(const struct montgomery *m, uint64_t base, uint64_t d, int s) {
+    uint64_t minus_one = m->n - m->one;
+    if (base % m->n == 0)
+        return 1;
+    uint64_t x = montgomery_pow(m, montgomery_from(m, base), d);
+    if (x == m->one || x == minus_one)
+        return 1;
+    for (int i = 1; i < s; i++) {
+        x = montgomery_mul(m, x, x);
+        if (x == minus_one)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Returns -1 if num has no small factor and needs Miller-Rabin test. Small
+ * numbers are looked up and one wheel lookup rules out multiples of 2, 3,
+ * 5 and 7.
+ */
+static int trial_division(uint64_t num) {
+    if (num < PRIME_TABLE_LIMIT)
+        return prime_table[num / 64] >> (num % 64) & 1;
+    if (!wheel_coprime[num % WHEEL_MODULUS])
+        return 0;
+    for (int i = WHEEL_PRIMES_NUM; i < TRIAL_PRIMES_NUM; i++)
+        if (num % small_primes[i] == 0)
+            return 0;
+    return -1;
+}
+
+/*
+ * Deterministic for all 64-bit numbers.
+ */
+int is_prime(uint64_t num) {
+    int verdict = trial_division(num);
+    if (verdict != -1)
+        return verdict;
+
+    uint64_t d = num - 1;
+    int s = 0;
+    while ((d & 1) == 0) {
+        d >>= 1;
+        s++;
+    }
+    struct montgomery m;
+    montgomery_init(&m, num);
+    const uint64_t *bases = bases_64;
+    int bases_num = sizeof(bases_64) / sizeof(bases_64[0]);
+    if (num < (1ULL << 32)) {
+        bases = bases_32;
+        bases_num = sizeof(bases_32) / sizeof(bases_32[0]);
+    }
+    for (int i = 0; i < bases_num; i++)
+        if (!miller_rabin(&m, bases[i], d, s))
+            return 0;
+    return 1;
+}
+
+/*
+ * Vector kernels test odd numbers below 2^32 left after trial division,
+ * one number in every 64-bit lane. Montgomery arithmetic is done with
+ * R = 2^32, so products of two residues fit lanes of _mul_epu32.
+ */
+struct prime_lanes {
+    uint64_t n[PRIME_MAX_LANES];
+    uint64_t n_inv[PRIME_MAX_LANES]; // n^-1 mod 2^32
+    uint64_t one[PRIME_MAX_LANES];   // R mod n
+    uint64_t r2[PRIME_MAX_LANES];    // R^2 mod n
+    uint64_t d[PRIME_MAX_LANES];     // n - 1 = d * 2^s
+    uint64_t s[PRIME_MAX_LANES];
+    int max_s;
+};
+
+static void prime_lanes_init(struct prime_lanes *lanes, const uint32_t *numbers, int count) {
+    lanes->max_s = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t n = numbers[i];
+        uint32_t inv = n;
+        for (int j = 0; j < 4; j++)
+            inv *= 2 - n * inv;
+        uint64_t d = n - 1;
+        int s = 0;
+        while ((d & 1) == 0) {
+            d >>= 1;
+            s++;
+        }
+        lanes->n[i] = n;
+        lanes->n_inv[i] = inv;
+        lanes->one[i] = (1ULL << 32) % n;
+        lanes->r2[i] = lanes->one[i] * lanes->one[i] % n;
+        lanes->d[i] = d;
+        lanes->s[i] = s;
+        if (s > lanes->max_s)
+            lanes->max_s = s;
+    }
+}
+
+#ifdef PRIME_VECTOR_KERNELS
+
+__attribute__((target("avx2")))
+static inline __m256i montgomery_mul_avx2(__m256i a, __m256i b, __m256i n, __m256i n_inv) {
+    __m256i t = _mm256_mul_epu32(a, b);
+    __m256i qn = _mm256_mul_epu32(_mm256_mul_epu32(t, n_inv), n);
+    __m256i t_high = _mm256_srli_epi64(t, 32);
+    __m256i qn_high = _mm256_srli_epi64(qn, 32);
+    __m256i borrow = _mm256_cmpgt_epi64(qn_high, t_high); // both are below 2^32
+    return _mm256_add_epi64(_mm256_sub_epi64(t_high, qn_high), _mm256_and_si256(borrow, n));
+}
+
+__attribute__((target("avx2")))
+static void test_lanes_avx2(const uint32_t *numbers, uint8_t *verdicts) {
+    struct prime_lanes lanes;
+    prime_lanes_init(&lanes, numbers, 4);
+    __m256i n = _mm256_loadu_si256((__m256i *) lanes.n);
+    __m256i n_inv = _mm256_loadu_si256((__m256i *) lanes.n_inv);
+    __m256i one = _mm256_loadu_si256((__m256i *) lanes.one);
+    __m256i r2 = _mm256_loadu_si256((__m256i *) lanes.r2);
+    __m256i s = _mm256_loadu_si256((__m256i *) lanes.s);
+    __m256i minus_one = _mm256_sub_epi64(n, one);
+    __m256i bit = _mm256_set1_epi64x(1);
+    __m256i prime = _mm256_set1_epi64x(-1);
+    for (int i = 0; i < sizeof(bases_32) / sizeof(bases_32[0]); i++) {
+        __m256i base = montgomery_mul_avx2(_mm256_set1_epi64x(bases_32[i]), r2, n, n_inv);
+        __m256i exp = _mm256_loadu_si256((__m256i *) lanes.d);
+        __m256i x = one;
+        while (!_mm256_testz_si256(exp, exp)) { // exponents differ, lanes with lower bit set multiply
+            __m256i odd = _mm256_cmpeq_epi64(_mm256_and_si256(exp, bit), bit);
+            x = _mm256_blendv_epi8(x, montgomery_mul_avx2(x, base, n, n_inv), odd);
+            base = montgomery_mul_avx2(base, base, n, n_inv);
+            exp = _mm256_srli_epi64(exp, 1);
+        }
+        __m256i passed = _mm256_or_si256(_mm256_cmpeq_epi64(x, one), _mm256_cmpeq_epi64(x, minus_one));
+        for (int j = 1; j < lanes.max_s; j++) {
+            x = montgomery_mul_avx2(x, x, n, n_inv);
+            __m256i active = _mm256_cmpgt_epi64(s, _mm256_set1_epi64x(j));
+            passed = _mm256_or_si256(passed, _mm256_and_si256(active, _mm256_cmpeq_epi64(x, minus_one)));
+        }
+        prime = _mm256_and_si256(prime, passed);
+    }
+    uint64_t result[4];
+    _mm256_storeu_si256((__m256i *) result, prime);
+    for (int i = 0; i < 4; i++)
+        verdicts[i] = result[i] != 0;
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i montgomery_mul_avx512(__m512i a, __m512i b, __m512i n, __m512i n_inv) {
+    __m512i t = _mm512_mul_epu32(a, b);
+    __m512i qn = _mm512_mul_epu32(_mm512_mul_epu32(t, n_inv), n);
+    __m512i t_high = _mm512_srli_epi64(t, 32);
+    __m512i qn_high = _mm512_srli_epi64(qn, 32);
+    __m512i result = _mm512_sub_epi64(t_high, qn_high);
+    return _mm512_mask_add_epi64(result, _mm512_cmpgt_epu64_mask(qn_high, t_high), result, n);
+}
+
+__attribute__((target("avx512f")))
+static void test_lanes_avx512(const uint32_t *numbers, uint8_t *verdicts) {
+    struct prime_lanes lanes;
+    prime_lanes_init(&lanes, numbers, 8);
+    __m512i n = _mm512_loadu_si512(lanes.n);
+    __m512i n_inv = _mm512_loadu_si512(lanes.n_inv);
+    __m512i one = _mm512_loadu_si512(lanes.one);
+    __m512i r2 = _mm512_loadu_si512(lanes.r2);
+    __m512i s = _mm512_loadu_si512(lanes.s);
+    __m512i minus_one = _mm512_sub_epi64(n, one);
+    __m512i bit = _mm512_set1_epi64(1);
+    __mmask8 prime = 0xff;
+    for (int i = 0; i < sizeof(bases_32) / sizeof(bases_32[0]); i++) {
+        __m512i base = montgomery_mul_avx512(_mm512_set1_epi64(bases_32[i]), r2, n, n_inv);
+        __m512i exp = _mm512_loadu_si512(lanes.d);
+        __m512i x = one;
+        while (_mm512_test_epi64_mask(exp, exp) != 0) {
+            __mmask8 odd = _mm512_test_epi64_mask(exp, bit);
+            x = _mm512_mask_mov_epi64(x, odd, montgomery_mul_avx512(x, base, n, n_inv));
+            base = montgomery_mul_avx512(base, base, n, n_inv);
+            exp = _mm512_srli_epi64(exp, 1);
+        }
+        __mmask8 passed = _mm512_cmpeq_epu64_mask(x, one) | _mm512_cmpeq_epu64_mask(x, minus_one);
+        for (int j = 1; j < lanes.max_s; j++) {
+            x = montgomery_mul_avx512(x, x, n, n_inv);
+            __mmask8 active = _mm512_cmpgt_epu64_mask(s, _mm512_set1_epi64(j));
+            passed |= active & _mm512_cmpeq_epu64_mask(x, minus_one);
+        }
+        prime &= passed;
+    }
+    for (int i = 0; i < 8; i++)
+        verdicts[i] = prime >> i & 1;
+}
+
+#endif
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static int kernel_lanes = 0; // 0 - no vector kernel, every number is tested by is_prime
+static void (*test_lanes)(const uint32_t *numbers, uint8_t *verdicts) = NULL;
+
+/*
+ * Widest kernel supported by CPU the client runs on.
+ */
+static void select_kernel() {
+#ifdef PRIME_VECTOR_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        kernel_lanes = 8;
+        test_lanes = test_lanes_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        kernel_lanes = 4;
+        test_lanes = test_lanes_avx2;
+    }
+#endif
+}
+
+/*
+ * Makes is_prime_batch use kernel with that many lanes: 8 - AVX-512, 4 - AVX2,
+ * 0 - none. Returns -1 if CPU does not have it. Clients keep the widest
+ * kernel, others are chosen only to check them against is_prime.
+ */
+int prime_use_kernel(int lanes) {
+    pthread_once(&kernel_once, select_kernel);
+    if (lanes == 0) {
+        kernel_lanes = 0;
+        test_lanes = NULL;
+        return 0;
+    }
+#ifdef PRIME_VECTOR_KERNELS
+    if (lanes == 8 && __builtin_cpu_supports("avx512f")) {
+        kernel_lanes = 8;
+        test_lanes = test_lanes_avx512;
+        return 0;
+    }
+    if (lanes == 4 && __builtin_cpu_supports("avx2")) {
+        kernel_lanes = 4;
+        test_lanes = test_lanes_avx2;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+static void flush_lanes(const uint32_t *numbers, const int *indexes, int count, uint8_t *bitmap) {
+    uint32_t lanes[PRIME_MAX_LANES];
+    uint8_t verdicts[PRIME_MAX_LANES];
+    for (int i = 0; i < PRIME_MAX_LANES; i++) // unused lanes repeat the first number
+        lanes[i] = numbers[i < count ? i : 0];
+    test_lanes(lanes, verdicts);
+    for (int i = 0; i < count; i++)
+        if (verdicts[i])
+            bitmap[indexes[i] / 8] |= 1 << (indexes[i] % 8);
+}
+
+/*
+ * Sets bit i of bitmap if numbers[i] is prime. Numbers below 2^32 without
+ * small factor are tested by vector kernel, when CPU has one.
+ */
+void is_prime_batch(const uint64_t *numbers, int count, uint8_t *bitmap) {
+    pthread_once(&kernel_once, select_kernel);
+    uint32_t candidates[PRIME_MAX_LANES];
+    int indexes[PRIME_MAX_LANES];
+    int filled = 0;
+    if (count <= 0)
+        return;
+    memset(bitmap, 0, (count + 7) / 8);
+    for (int i = 0; i < count; i++) {
+        int verdict = kernel_lanes == 0 || numbers[i] >> 32 != 0 ? is_prime(numbers[i]) : trial_division(numbers[i]);
+        if (verdict == -1) {
+            candidates[filled] = (uint32_t) numbers[i];
+            indexes[filled++] = i;
+            if (filled == kernel_lanes) {
+                flush_lanes(candidates, indexes, filled, bitmap);
+                filled = 0;
+            }
+        } else if (verdict) {
+            bitmap[i / 8] |= 1 << (i % 8);
+        }
+    }
+    if (filled > 0)
+        flush_lanes(candidates, indexes, filled, bitmap);
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+    if (a == 0)
+        return b;
+    if (b == 0)
+        return a;
+    int shift = __builtin_ctzll(a | b);
+    a >>= __builtin_ctzll(a);
+    while (b != 0) {
+        b >>= __builtin_ctzll(b);
+        if (a > b) {
+            uint64_t t = a;
+            a = b;
+            b = t;
+        }
+        b -= a;
+    }
+    return a << shift;
+}
+
+static inline uint64_t add_mod(uint64_t a, uint64_t b, uint64_t n) {
+    return a >= n - b ? a - (n - b) : a + b;
+}
+
+/*
+ * Returns factor of odd composite n other than 1 and n. Brent's variant of
+ * Pollard's rho with f(x) = x^2 + c in Montgomery form - differences are
+ * multiplied together and gcd is taken once for RHO_GCD_STEPS of them. When
+ * the product hits n, the last steps are repeated one by one, and when that
+ * does not help either, next c is tried.
+ */
+#define RHO_GCD_STEPS 128
+
+static uint64_t pollard_brent(uint64_t n) {
+    struct montgomery m;
+    montgomery_init(&m, n);
+    for (uint64_t c = 1; ; c++) {
+        uint64_t mc = montgomery_from(&m, c);
+        uint64_t x, ys, y = montgomery_from(&m, 2);
+        uint64_t q = m.one;
+        uint64_t g = 1;
+        for (uint64_t r = 1; g == 1; r *= 2) {
+            x = y;
+            for (uint64_t i = 0; i < r; i++)
+                y = add_mod(montgomery_mul(&m, y, y), mc, n);
+            for (uint64_t k = 0; k < r && g == 1; k += RHO_GCD_STEPS) {
+                ys = y;
+                for (uint64_t i = 0; i < RHO_GCD_STEPS && i < r - k; i++) {
+                    y = add_mod(montgomery_mul(&m, y, y), mc, n);
+                    q = montgomery_mul(&m, q, x > y ? x - y : y - x);
+                }
+                g = gcd(q, n);
+            }
+        }
+        if (g == n) {
+            do {
+                ys = add_mod(montgomery_mul(&m, ys, ys), mc, n);
+                g = gcd(x > ys ? x - ys : ys - x, n);
+            } while (g == 1);
+        }
+        if (g != n)
+            return g;
+    }
+}
+
+static int split(uint64_t num, uint64_t *factors, int count) {
+    if (is_prime(num)) {
+        factors[count] = num;
+        return count + 1;
+    }
+    uint64_t factor = pollard_brent(num);
+    count = split(factor, factors, count);
+    return split(num / factor, factors, count);
+}
+
+/*
+ * Fills factors with prime factors of num in ascending order, repeated as
+ * many times as they divide num, and returns their count (0 for 0 and 1).
+ * Small factors are found by trial division, the rest by Pollard's rho,
+ * every cofactor is checked with Miller-Rabin first.
+ */
+int factorize(uint64_t num, uint64_t *factors) {
+    int count = 0;
+    if (num < 2)
+        return 0;
+    for (int i = 0; i < SMALL_PRIMES_NUM && (uint64_t) small_primes[i] * small_primes[i] <= num; i++) {
+        while (num % small_primes[i] == 0) {
+            factors[count++] = small_primes[i];
+            num /= small_primes[i];
+        }
+    }
+    if (num > 1)
+        count = split(num, factors, count);
+    for (int i = 1; i < count; i++) {
+        uint64_t factor = factors[i];
+        int j = i;
+        for (; j > 0 && factors[j - 1] > factor; j--)
+            factors[j] = factors[j - 1];
+        factors[j] = factor;
+    }
+    return count;
+}
@@ -0,0 +1,16 @@
+#ifndef COMMON_PRIME_H
+#define COMMON_PRIME_H
+
+#include <stdint.h>
+
+// widest vector kernel tests that many numbers at once
+#define PRIME_MAX_LANES 8
+// 64-bit number has less prime factors, counted with repetition
+#define PRIME_MAX_FACTORS 64
+
+int is_prime(uint64_t num);
+void is_prime_batch(const uint64_t *numbers, int count, uint8_t *bitmap);
+int prime_use_kernel(int lanes);
+int factorize(uint64_t num, uint64_t *factors);
+
+#endif //COMMON_PRIME_H
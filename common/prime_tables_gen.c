@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Prints prime_tables.h for prime.c, run by the build, so tables are
+ * constant data of the client binary and cost nothing at startup:
+ * - primality bitmap of numbers below PRIME_TABLE_LIMIT,
+ * - primes below TRIAL_PRIMES_LIMIT for trial division,
+ * - numbers below WHEEL_MODULUS coprime to it (2 * 3 * 5 * 7).
+ */
+#define PRIME_TABLE_LIMIT (1 << 16)
+#define TRIAL_PRIMES_LIMIT 1024
+#define WHEEL_MODULUS 210
+
+static uint8_t composite[PRIME_TABLE_LIMIT];
+
+int main() {
+    composite[0] = composite[1] = 1;
+    for (uint32_t i = 2; i * i < PRIME_TABLE_LIMIT; i++)
+        if (!composite[i])
+            for (uint32_t j = i * i; j < PRIME_TABLE_LIMIT; j += i)
+                composite[j] = 1;
+
+    printf("// Generated by prime_tables_gen, do not edit.\n");
+    printf("#ifndef PRIME_TABLES_H\n#define PRIME_TABLES_H\n\n#include <stdint.h>\n\n");
+
+    printf("#define PRIME_TABLE_LIMIT %d\n", PRIME_TABLE_LIMIT);
+    printf("// bit n %% 64 of word n / 64 is set if n is prime\n");
+    printf("static const uint64_t prime_table[%d] = {", PRIME_TABLE_LIMIT / 64);
+    for (int word = 0; word < PRIME_TABLE_LIMIT / 64; word++) {
+        uint64_t bits = 0;
+        for (int bit = 0; bit < 64; bit++)
+            if (!composite[word * 64 + bit])
+                bits |= 1ULL << bit;
+        printf("%s0x%016llxULL,", word % 4 == 0 ? "\n    " : " ", (unsigned long long) bits);
+    }
+    printf("\n};\n\n");
+
+    int count = 0;
+    for (int i = 2; i < TRIAL_PRIMES_LIMIT; i++)
+        count += !composite[i];
+    printf("#define SMALL_PRIMES_NUM %d\n", count);
+    printf("static const uint32_t small_primes[SMALL_PRIMES_NUM] = {");
+    for (int i = 2, printed = 0; i < TRIAL_PRIMES_LIMIT; i++)
+        if (!composite[i])
+            printf("%s%d,", printed++ % 12 == 0 ? "\n    " : " ", i);
+    printf("\n};\n\n");
+
+    printf("#define WHEEL_MODULUS %d\n", WHEEL_MODULUS);
+    printf("// 1 if n is coprime to WHEEL_MODULUS, so it has no prime factor below 11\n");
+    printf("static const uint8_t wheel_coprime[WHEEL_MODULUS] = {");
+    for (int i = 0; i < WHEEL_MODULUS; i++)
+        printf("%s%d,", i % 30 == 0 ? "\n    " : " ", i % 2 != 0 && i % 3 != 0 && i % 5 != 0 && i % 7 != 0);
+    printf("\n};\n\n#endif //PRIME_TABLES_H\n");
+    return 0;
+}
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <signal.h>
+#include "result_sink.h"
+
+void *write_results(void *arg);
+void append_result(struct result_sink *sink, const char *data, size_t size);
+int write_all(int fd, const char *data, size_t size);
+
+/*
+ * With append results are added to existing file (of server resumed from
+ * checkpoint) instead of replacing it.
+ */
+int result_sink_open(struct result_sink *sink, int kind, const char *path, int append) {
+    memset(sink, 0, sizeof(struct result_sink));
+    sink->kind = kind;
+    sink->fd = -1;
+    if (kind == RESULT_SINK_COUNTERS)
+        return 0;
+    if (kind == RESULT_SINK_BINARY && path == NULL)
+        return -1;
+
+    if (path == NULL) {
+        sink->fd = STDOUT_FILENO;
+    } else {
+        sink->fd = open(path, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+        if (sink->fd == -1)
+            return -1;
+    }
+    if (kind == RESULT_SINK_BINARY && lseek(sink->fd, 0, SEEK_END) == 0) {
+        struct result_log_header header;
+        header.magic = RESULT_LOG_MAGIC;
+        header.version = RESULT_LOG_VERSION;
+        header.record_size = sizeof(struct result_record);
+        header.reserved = 0;
+        if (write_all(sink->fd, (char *) &header, sizeof(header)) != 0) {
+            close(sink->fd);
+            return -1;
+        }
+    }
+    for (int i = 0; i < RESULT_SINK_BUFFERS; i++) {
+        sink->buffers[i] = malloc(RESULT_SINK_BUFFER_SIZE);
+        if (sink->buffers[i] == NULL)
+            return -1;
+    }
+    pthread_mutex_init(&sink->lock, NULL);
+    pthread_cond_init(&sink->full, NULL);
+    pthread_cond_init(&sink->flushed, NULL);
+    // signals are left to server threads
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int error = pthread_create(&sink->writer, NULL, write_results, sink);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return error == 0 ? 0 : -1;
+}
+
+/*
+ * Blocks on output only when writer is behind by all buffers.
+ */
+void result_sink_put(struct result_sink *sink, uint64_t lo, uint64_t hi, uint64_t primes, int client_id) {
+    if (hi - lo == 1) {
+        atomic_fetch_add_explicit(&sink->numbers, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&sink->number_primes, primes, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&sink->ranges, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&sink->range_primes, primes, memory_order_relaxed);
+    }
+    if (sink->kind == RESULT_SINK_COUNTERS)
+        return;
+
+    char text[128];
+    struct result_record record;
+    char *data = text;
+    size_t size;
+    if (sink->kind == RESULT_SINK_BINARY) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        record.lo = lo;
+        record.hi = hi;
+        record.timestamp = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+        record.client_id = client_id;
+        record.primes = (uint32_t) primes;
+        data = (char *) &record;
+        size = sizeof(record);
+    } else if (hi - lo == 1) {
+        size = snprintf(text, sizeof(text), "%s: %" PRIu64 " (client: %d)\n",
+                        primes ? "Prime number" : "Composite number", lo, client_id);
+    } else {
+        size = snprintf(text, sizeof(text), "Primes in [%" PRIu64 ", %" PRIu64 "): %" PRIu64 " (client: %d)\n",
+                        lo, hi, primes, client_id);
+    }
+    append_result(sink, data, size);
+}
+
+void result_sink_put_number(struct result_sink *sink, uint64_t number, int is_prime, int client_id) {
+    result_sink_put(sink, number, number + 1, is_prime ? 1 : 0, client_id);
+}
+
+/*
+ * Prime factors of number in ascending order. Binary log gets a record for
+ * every distinct factor, with exponent in primes.
+ */
+void result_sink_put_factors(struct result_sink *sink, uint64_t number, const uint64_t *factors, int count,
+                             int client_id) {
+    atomic_fetch_add_explicit(&sink->numbers, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sink->number_primes, count == 1 && factors[0] == number, memory_order_relaxed);
+    if (sink->kind == RESULT_SINK_COUNTERS)
+        return;
+
+    char text[RESULT_SINK_MAX_FACTORS * 21 + 64];
+    struct result_record records[RESULT_SINK_MAX_FACTORS];
+    if (sink->kind == RESULT_SINK_BINARY) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        uint64_t timestamp = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+        int distinct = 0;
+        for (int i = 0; i < count && i < RESULT_SINK_MAX_FACTORS; i++) {
+            if (distinct > 0 && records[distinct - 1].hi == factors[i]) {
+                records[distinct - 1].primes++;
+                continue;
+            }
+            records[distinct].lo = number;
+            records[distinct].hi = factors[i];
+            records[distinct].timestamp = timestamp;
+            records[distinct].client_id = client_id;
+            records[distinct].primes = 1;
+            distinct++;
+        }
+        if (distinct == 0) { // 0 and 1
+            records[0].lo = number;
+            records[0].hi = 0;
+            records[0].timestamp = timestamp;
+            records[0].client_id = client_id;
+            records[0].primes = 0;
+            distinct = 1;
+        }
+        append_result(sink, (char *) records, distinct * sizeof(struct result_record));
+        return;
+    }
+    size_t size = snprintf(text, sizeof(text), "Factors of %" PRIu64 ":", number);
+    for (int i = 0; i < count && i < RESULT_SINK_MAX_FACTORS; i++)
+        size += snprintf(text + size, sizeof(text) - size, " %" PRIu64, factors[i]);
+    size += snprintf(text + size, sizeof(text) - size, " (client: %d)\n", client_id);
+    append_result(sink, text, size);
+}
+
+/*
+ * Results are appended whole, so writer never splits a record or a line.
+ * Result put after close is ignored, server is exiting then.
+ */
+void append_result(struct result_sink *sink, const char *data, size_t size) {
+    pthread_mutex_lock(&sink->lock);
+    int current = (sink->written + sink->pending) % RESULT_SINK_BUFFERS;
+    while (!sink->closed && sink->lengths[current] + size > RESULT_SINK_BUFFER_SIZE) {
+        if (sink->pending + 1 < RESULT_SINK_BUFFERS) { // hand full buffer over to writer
+            sink->pending++;
+            pthread_cond_signal(&sink->full);
+        } else { // every other buffer waits for writer
+            pthread_cond_wait(&sink->flushed, &sink->lock);
+        }
+        current = (sink->written + sink->pending) % RESULT_SINK_BUFFERS;
+    }
+    if (sink->closed) {
+        pthread_mutex_unlock(&sink->lock);
+        return;
+    }
+    memcpy(sink->buffers[current] + sink->lengths[current], data, size);
+    sink->lengths[current] += size;
+    pthread_mutex_unlock(&sink->lock);
+}
+
+/*
+ * Waits until results put so far are written, so checkpoint saved after it
+ * never counts results which were only in buffers.
+ */
+void result_sink_flush(struct result_sink *sink) {
+    if (sink->kind == RESULT_SINK_COUNTERS)
+        return;
+    pthread_mutex_lock(&sink->lock);
+    int current = (sink->written + sink->pending) % RESULT_SINK_BUFFERS;
+    while (!sink->closed && sink->lengths[current] > 0 && sink->pending + 1 >= RESULT_SINK_BUFFERS) {
+        pthread_cond_wait(&sink->flushed, &sink->lock);
+        current = (sink->written + sink->pending) % RESULT_SINK_BUFFERS;
+    }
+    if (!sink->closed && sink->lengths[current] > 0) { // hand partly filled buffer over to writer
+        sink->pending++;
+        pthread_cond_signal(&sink->full);
+    }
+    uint64_t target = sink->written_count + sink->pending;
+    while (!sink->closed && sink->written_count < target)
+        pthread_cond_wait(&sink->flushed, &sink->lock);
+    pthread_mutex_unlock(&sink->lock);
+}
+
+/*
+ * Writes everything put so far. Results put later are ignored.
+ */
+void result_sink_close(struct result_sink *sink) {
+    if (sink->kind != RESULT_SINK_COUNTERS) {
+        pthread_mutex_lock(&sink->lock);
+        int was_closed = sink->closed;
+        sink->closed = 1;
+        pthread_cond_signal(&sink->full);
+        pthread_cond_broadcast(&sink->flushed);
+        pthread_mutex_unlock(&sink->lock);
+        if (was_closed)
+            return;
+        pthread_join(sink->writer, NULL);
+        if (sink->fd != STDOUT_FILENO)
+            close(sink->fd);
+        return;
+    }
+    printf("Results: %" PRIu64 " numbers (%" PRIu64 " prime), %" PRIu64 " ranges (%" PRIu64 " primes).\n",
+           atomic_load(&sink->numbers), atomic_load(&sink->number_primes),
+           atomic_load(&sink->ranges), atomic_load(&sink->range_primes));
+}
+
+/*
+ * Writes handed over buffers. Idle writer takes partly filled buffer itself,
+ * so results show up even at low rate.
+ */
+void *write_results(void *arg) {
+    struct result_sink *sink = arg;
+    pthread_mutex_lock(&sink->lock);
+    while (1) {
+        if (sink->pending == 0) {
+            if (sink->lengths[sink->written] > 0) {
+                sink->pending = 1;
+            } else if (sink->closed) {
+                break;
+            } else {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_nsec += RESULT_SINK_FLUSH_MS * 1000000L;
+                deadline.tv_sec += deadline.tv_nsec / 1000000000;
+                deadline.tv_nsec %= 1000000000;
+                pthread_cond_timedwait(&sink->full, &sink->lock, &deadline);
+                continue;
+            }
+        }
+        int index = sink->written;
+        pthread_mutex_unlock(&sink->lock);
+        write_all(sink->fd, sink->buffers[index], sink->lengths[index]);
+        pthread_mutex_lock(&sink->lock);
+        sink->lengths[index] = 0;
+        sink->written = (index + 1) % RESULT_SINK_BUFFERS;
+        sink->pending--;
+        sink->written_count++;
+        pthread_cond_broadcast(&sink->flushed);
+    }
+    pthread_mutex_unlock(&sink->lock);
+    return NULL;
+}
+
+int write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t count = write(fd, data, size);
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += count;
+        size -= count;
+    }
+    return 0;
+}
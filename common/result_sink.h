@@ -0,0 +1,77 @@
+#ifndef COMMON_RESULT_SINK_H
+#define COMMON_RESULT_SINK_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define RESULT_SINK_TEXT 0
+#define RESULT_SINK_BINARY 1
+#define RESULT_SINK_COUNTERS 2
+
+#define RESULT_SINK_BUFFER_SIZE (1 << 16)
+#define RESULT_SINK_BUFFERS 8
+// idle writer looks for partly filled buffer that often
+#define RESULT_SINK_FLUSH_MS 500
+// prime factors of 64-bit number, counted with repetition
+#define RESULT_SINK_MAX_FACTORS 64
+
+#define RESULT_LOG_MAGIC 0x474f4c52 // "RLOG"
+#define RESULT_LOG_VERSION 1
+
+/*
+ * Binary log starts with header followed by records. Every record says
+ * that there are primes primes in [lo, hi) - for single number hi = lo + 1
+ * and primes is 0 or 1. Factors have records with hi <= lo instead: prime
+ * hi divides lo primes times (number without prime factors, 0 or 1, has
+ * one record with hi = 0 and primes = 0).
+ */
+struct result_log_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+};
+
+struct result_record {
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t timestamp; // nanoseconds since epoch
+    int32_t client_id;
+    uint32_t primes;
+};
+
+/*
+ * Results are appended to buffers which are written by a separate thread,
+ * so threads handling messages do not wait for terminal, pipe or disk as
+ * long as writer keeps up. When it falls behind and all buffers are full,
+ * the thread putting result waits for it - no result is lost.
+ */
+struct result_sink {
+    int kind;
+    int fd;
+    pthread_mutex_t lock;
+    pthread_cond_t full; // writer waits for buffer to write
+    pthread_cond_t flushed; // result_sink_flush and threads putting results wait for writer
+    char *buffers[RESULT_SINK_BUFFERS];
+    size_t lengths[RESULT_SINK_BUFFERS];
+    int written; // first buffer waiting for writer
+    int pending; // buffers waiting for writer, buffer after them is filled
+    int closed;
+    uint64_t written_count; // buffers written so far
+    pthread_t writer;
+    _Atomic uint64_t numbers;
+    _Atomic uint64_t number_primes;
+    _Atomic uint64_t ranges;
+    _Atomic uint64_t range_primes;
+};
+
+int result_sink_open(struct result_sink *sink, int kind, const char *path, int append);
+void result_sink_put(struct result_sink *sink, uint64_t lo, uint64_t hi, uint64_t primes, int client_id);
+void result_sink_put_number(struct result_sink *sink, uint64_t number, int is_prime, int client_id);
+void result_sink_put_factors(struct result_sink *sink, uint64_t number, const uint64_t *factors, int count,
+                             int client_id);
+void result_sink_flush(struct result_sink *sink);
+void result_sink_close(struct result_sink *sink);
+
+#endif //COMMON_RESULT_SINK_H
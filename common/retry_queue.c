@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+#include "retry_queue.h"
+
+int retry_queue_init(struct retry_queue *queue) {
+    pthread_mutex_init(&queue->lock, NULL);
+    queue->items = malloc(RETRY_QUEUE_INITIAL_CAPACITY * sizeof(struct retry_item));
+    queue->head = 0;
+    queue->capacity = RETRY_QUEUE_INITIAL_CAPACITY;
+    atomic_init(&queue->count, 0);
+    return queue->items == NULL ? -1 : 0;
+}
+
+void retry_queue_destroy(struct retry_queue *queue) {
+    free(queue->items);
+    queue->items = NULL;
+}
+
+/*
+ * Returns -1 if queue cannot grow.
+ */
+int retry_queue_push(struct retry_queue *queue, uint64_t lo, uint64_t hi) {
+    pthread_mutex_lock(&queue->lock);
+    size_t count = atomic_load(&queue->count);
+    if (count == queue->capacity) { // unwrap items into twice bigger array
+        struct retry_item *items = malloc(2 * queue->capacity * sizeof(struct retry_item));
+        if (items == NULL) {
+            pthread_mutex_unlock(&queue->lock);
+            return -1;
+        }
+        size_t first = queue->capacity - queue->head;
+        memcpy(items, queue->items + queue->head, first * sizeof(struct retry_item));
+        memcpy(items + first, queue->items, queue->head * sizeof(struct retry_item));
+        free(queue->items);
+        queue->items = items;
+        queue->head = 0;
+        queue->capacity *= 2;
+    }
+    struct retry_item *item = &queue->items[(queue->head + count) % queue->capacity];
+    item->lo = lo;
+    item->hi = hi;
+    atomic_store(&queue->count, count + 1);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+/*
+ * Numbers of task which is not answered, consecutive ones as one item.
+ */
+int retry_queue_push_numbers(struct retry_queue *queue, const uint64_t *numbers, int count) {
+    for (int i = 0; i < count; ) {
+        int j = i + 1;
+        while (j < count && numbers[j] == numbers[j - 1] + 1)
+            j++;
+        if (retry_queue_push(queue, numbers[i], numbers[j - 1] + 1) != 0)
+            return -1;
+        i = j;
+    }
+    return 0;
+}
+
+/*
+ * Returns -1 if queue is empty.
+ */
+int retry_queue_pop(struct retry_queue *queue, uint64_t *lo, uint64_t *hi) {
+    if (atomic_load(&queue->count) == 0)
+        return -1;
+    pthread_mutex_lock(&queue->lock);
+    size_t count = atomic_load(&queue->count);
+    if (count == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+    *lo = queue->items[queue->head].lo;
+    *hi = queue->items[queue->head].hi;
+    queue->head = (queue->head + 1) % queue->capacity;
+    atomic_store(&queue->count, count - 1);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+/*
+ * Takes the first number of the first item, the rest of its range stays in
+ * queue. Returns -1 if queue is empty.
+ */
+int retry_queue_pop_number(struct retry_queue *queue, uint64_t *number) {
+    if (atomic_load(&queue->count) == 0)
+        return -1;
+    pthread_mutex_lock(&queue->lock);
+    size_t count = atomic_load(&queue->count);
+    if (count == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+    struct retry_item *item = &queue->items[queue->head];
+    *number = item->lo++;
+    if (item->lo >= item->hi) {
+        queue->head = (queue->head + 1) % queue->capacity;
+        atomic_store(&queue->count, count - 1);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+int retry_queue_empty(struct retry_queue *queue) {
+    return atomic_load(&queue->count) == 0;
+}
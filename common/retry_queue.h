@@ -0,0 +1,37 @@
+#ifndef COMMON_RETRY_QUEUE_H
+#define COMMON_RETRY_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define RETRY_QUEUE_INITIAL_CAPACITY 1024
+
+struct retry_item {
+    uint64_t lo;
+    uint64_t hi;
+};
+
+/*
+ * Work of lost tasks, given out before new numbers of task source. Every
+ * item is a range [lo, hi), single number has hi = lo + 1. Thread-safe,
+ * grows when needed.
+ */
+struct retry_queue {
+    pthread_mutex_t lock;
+    struct retry_item *items;
+    size_t head;
+    size_t capacity;
+    _Atomic size_t count; // read without lock to skip empty queue
+};
+
+int retry_queue_init(struct retry_queue *queue);
+void retry_queue_destroy(struct retry_queue *queue);
+int retry_queue_push(struct retry_queue *queue, uint64_t lo, uint64_t hi);
+int retry_queue_push_numbers(struct retry_queue *queue, const uint64_t *numbers, int count);
+int retry_queue_pop(struct retry_queue *queue, uint64_t *lo, uint64_t *hi);
+int retry_queue_pop_number(struct retry_queue *queue, uint64_t *number);
+int retry_queue_empty(struct retry_queue *queue);
+
+#endif //COMMON_RETRY_QUEUE_H
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sieve.h"
+#include "prime.h"
+
+/*
+ * Ranges with sqrt(hi) above this limit are sieved only with base primes
+ * up to the limit and survivors are checked with is_prime().
+ */
+#define SIEVE_BASE_LIMIT (1 << 22)
+#define DEFAULT_SEGMENT_SIZE 32768
+
+// buffers are kept per thread, so worker threads of one client can sieve in parallel
+static _Thread_local uint32_t *base_primes = NULL; // odd primes up to base_primes_limit
+static _Thread_local int base_primes_num = 0;
+static _Thread_local uint32_t base_primes_limit = 0;
+static _Thread_local uint8_t *segment = NULL;
+static _Thread_local uint64_t *next_multiple = NULL;
+static _Thread_local size_t segment_size = 0;
+
+static uint64_t isqrt(uint64_t n) {
+    uint64_t r = 0;
+    for (uint64_t bit = 1ULL << 62; bit != 0; bit >>= 2) {
+        if (n >= r + bit) {
+            n -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+    }
+    return r;
+}
+
+static int init_base_primes(uint32_t limit) {
+    if (limit <= base_primes_limit)
+        return 0;
+    uint8_t *composite = calloc(limit + 1, 1);
+    uint32_t *primes = malloc((limit / 2 + 1) * sizeof(uint32_t));
+    uint64_t *next = malloc((limit / 2 + 1) * sizeof(uint64_t));
+    if (composite == NULL || primes == NULL || next == NULL) {
+        free(composite);
+        free(primes);
+        free(next);
+        return -1;
+    }
+    int num = 0;
+    for (uint32_t i = 3; i <= limit; i += 2) {
+        if (composite[i])
+            continue;
+        primes[num++] = i;
+        for (uint64_t j = (uint64_t) i * i; j <= limit; j += 2 * i)
+            composite[j] = 1;
+    }
+    free(composite);
+    free(base_primes);
+    free(next_multiple);
+    base_primes = primes;
+    next_multiple = next;
+    base_primes_num = num;
+    base_primes_limit = limit;
+    return 0;
+}
+
+/*
+ * Segment is sized to L1 data cache, so crossing off stays in cache.
+ */
+static int init_segment() {
+    if (segment != NULL)
+        return 0;
+    long size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    segment_size = size > 0 ? size : DEFAULT_SEGMENT_SIZE;
+    segment = malloc(segment_size);
+    return segment == NULL ? -1 : 0;
+}
+
+/*
+ * Finds primes in [lo, hi) with segmented sieve over odd numbers. If bitmap
+ * is not NULL, bit i (LSB first) is set when lo + i is prime - it has to
+ * hold (hi - lo + 7) / 8 bytes. Number of primes is put to count. Returns
+ * -1 if there is not enough memory.
+ */
+int sieve_range(uint64_t lo, uint64_t hi, uint8_t *bitmap, uint64_t *count) {
+    *count = 0;
+    if (hi <= lo)
+        return 0;
+    if (bitmap != NULL)
+        memset(bitmap, 0, (hi - lo + 7) / 8);
+    uint64_t sqrt_hi = isqrt(hi - 1);
+    int exact = sqrt_hi <= SIEVE_BASE_LIMIT;
+    if (init_segment() != 0 || init_base_primes(exact ? sqrt_hi : SIEVE_BASE_LIMIT) != 0)
+        return -1;
+
+    if (lo <= 2 && 2 < hi) {
+        (*count)++;
+        if (bitmap != NULL)
+            bitmap[(2 - lo) / 8] |= 1 << ((2 - lo) % 8);
+    }
+    uint64_t start = lo < 3 ? 3 : lo | 1;
+    if (start >= hi)
+        return 0;
+    uint64_t odd_num = (hi - start + 1) / 2; // odd numbers in [start, hi), i-th is start + 2i
+
+    int primes_num = 0;
+    for (; primes_num < base_primes_num; primes_num++) {
+        uint64_t p = base_primes[primes_num];
+        if (p > sqrt_hi)
+            break;
+        // first odd multiple of p not smaller than max(p * p, start)
+        uint64_t m = p * p;
+        if (m < start) {
+            uint64_t offset = (p - start % p) % p;
+            if (offset >= hi - start) {
+                next_multiple[primes_num] = UINT64_MAX;
+                continue;
+            }
+            m = start + offset;
+        }
+        if (m % 2 == 0) {
+            if (p >= hi - m) {
+                next_multiple[primes_num] = UINT64_MAX;
+                continue;
+            }
+            m += p;
+        }
+        next_multiple[primes_num] = m < hi ? (m - start) / 2 : UINT64_MAX;
+    }
+
+    for (uint64_t seg_start = 0; seg_start < odd_num; seg_start += segment_size) {
+        uint64_t seg_len = odd_num - seg_start < segment_size ? odd_num - seg_start : segment_size;
+        memset(segment, 1, seg_len);
+        for (int i = 0; i < primes_num; i++) {
+            uint64_t j = next_multiple[i];
+            if (j >= seg_start + seg_len)
+                continue;
+            uint32_t p = base_primes[i];
+            for (j -= seg_start; j < seg_len; j += p)
+                segment[j] = 0;
+            next_multiple[i] = seg_start + j;
+        }
+        for (uint64_t j = 0; j < seg_len; j++) {
+            if (!segment[j])
+                continue;
+            uint64_t num = start + 2 * (seg_start + j);
+            if (!exact && !is_prime(num))
+                continue;
+            (*count)++;
+            if (bitmap != NULL)
+                bitmap[(num - lo) / 8] |= 1 << ((num - lo) % 8);
+        }
+    }
+    return 0;
+}
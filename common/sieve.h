@@ -0,0 +1,8 @@
+#ifndef COMMON_SIEVE_H
+#define COMMON_SIEVE_H
+
+#include <stdint.h>
+
+int sieve_range(uint64_t lo, uint64_t hi, uint8_t *bitmap, uint64_t *count);
+
+#endif //COMMON_SIEVE_H
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include "stats.h"
+
+int read_args(int argc, char *argv[], char **name, int *interval);
+void print_stats(struct stats_segment *stats);
+double latency_percentile(uint64_t *latency, uint64_t count, double percentile);
+
+/*
+ * Prints statistics published by server started with -m name, once or
+ * every interval seconds until server exits.
+ */
+int main(int argc, char *argv[]) {
+    char *name;
+    int interval = 0;
+    if (read_args(argc, argv, &name, &interval) != 0) {
+        printf("Enter statistics segment name (with preceding /) and optional interval in seconds.\n");
+        return 1;
+    }
+    size_t size;
+    struct stats_segment *stats = stats_open(name, &size);
+    if (stats == NULL) {
+        printf("Cannot open statistics segment.\n");
+        return 1;
+    }
+    while (1) {
+        if (kill(stats->pid, 0) != 0) {
+            printf("Server is not running.\n");
+            break;
+        }
+        print_stats(stats);
+        if (interval == 0)
+            break;
+        sleep(interval);
+        printf("\n");
+    }
+    munmap(stats, size);
+    return 0;
+}
+
+int read_args(int argc, char *argv[], char **name, int *interval) {
+    if (argc != 2 && argc != 3)
+        return 1;
+    if (argv[1][0] != '/')
+        return 1;
+    *name = argv[1];
+    if (argc == 3) {
+        *interval = atoi(argv[2]);
+        if (*interval <= 0)
+            return 1;
+    }
+    return 0;
+}
+
+void print_stats(struct stats_segment *stats) {
+    uint64_t sampled_at = atomic_load(&stats->sampled_at);
+    printf("Server %d, queue: %d messages (sampled %" PRIu64 " s ago), cache hits: %" PRIu64 "\n",
+           stats->pid, atomic_load(&stats->queue_depth),
+           sampled_at == 0 ? 0 : (uint64_t) time(NULL) - sampled_at, atomic_load(&stats->cache_hits));
+    printf("%10s %12s %12s %10s %8s %10s %10s %10s\n",
+           "client", "dispatched", "results", "in flight", "queue", "p50 ms", "p90 ms", "p99 ms");
+    uint64_t dispatched = 0;
+    uint64_t results = 0;
+    int in_flight = 0;
+    for (int i = 0; i < stats->client_max; i++) {
+        struct client_stats *client = &stats->clients[i];
+        int client_id = atomic_load(&client->client_id);
+        if (client_id == -1)
+            continue;
+        uint64_t latency[STATS_LATENCY_BUCKETS];
+        uint64_t count = 0;
+        for (int j = 0; j < STATS_LATENCY_BUCKETS; j++) {
+            latency[j] = atomic_load_explicit(&client->latency[j], memory_order_relaxed);
+            count += latency[j];
+        }
+        uint64_t client_dispatched = atomic_load(&client->dispatched);
+        uint64_t client_results = atomic_load(&client->results);
+        int client_in_flight = atomic_load(&client->in_flight);
+        char name[16];
+        if (client_id == STATS_POOL_CLIENT_ID)
+            snprintf(name, sizeof(name), "pool");
+        else
+            snprintf(name, sizeof(name), "%d", client_id);
+        printf("%10s %12" PRIu64 " %12" PRIu64 " %10d %8d %10.3f %10.3f %10.3f\n",
+               name, client_dispatched, client_results, client_in_flight, atomic_load(&client->queue_depth),
+               latency_percentile(latency, count, 0.5), latency_percentile(latency, count, 0.9),
+               latency_percentile(latency, count, 0.99));
+        dispatched += client_dispatched;
+        results += client_results;
+        in_flight += client_in_flight;
+    }
+    printf("%10s %12" PRIu64 " %12" PRIu64 " %10d\n", "total", dispatched, results, in_flight);
+}
+
+/*
+ * Upper bound of histogram bucket in milliseconds, 0 if there is no result.
+ */
+double latency_percentile(uint64_t *latency, uint64_t count, double percentile) {
+    if (count == 0)
+        return 0;
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+        seen += latency[i];
+        if (seen >= count * percentile)
+            return (double) (1ULL << i) / 1000;
+    }
+    return (double) (1ULL << (STATS_LATENCY_BUCKETS - 1)) / 1000;
+}
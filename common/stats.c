@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats.h"
+
+struct sampler {
+    struct stats_segment *stats;
+    void (*sample)(struct stats_segment *stats);
+};
+
+void *run_sampler(void *arg);
+
+struct stats_segment *stats_create(const char *name, int client_max) {
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1)
+        return NULL;
+    size_t size = STATS_SIZE(client_max);
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    struct stats_segment *stats = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+    stats->version = STATS_VERSION;
+    stats->client_max = client_max;
+    stats->pid = getpid();
+    for (int i = 0; i < client_max; i++)
+        atomic_store(&stats->clients[i].client_id, -1);
+    atomic_thread_fence(memory_order_release);
+    stats->magic = STATS_MAGIC;
+    return stats;
+}
+
+void stats_remove(const char *name, struct stats_segment *stats) {
+    if (stats != NULL)
+        munmap(stats, STATS_SIZE(stats->client_max));
+    shm_unlink(name);
+}
+
+/*
+ * Maps segment of running server read-only. Returns NULL if it does not
+ * exist or is not a stats segment.
+ */
+struct stats_segment *stats_open(const char *name, size_t *size) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return NULL;
+    struct stat shm_stat;
+    if (fstat(fd, &shm_stat) != 0 || shm_stat.st_size < sizeof(struct stats_segment)) {
+        close(fd);
+        return NULL;
+    }
+    *size = shm_stat.st_size;
+    struct stats_segment *stats = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats == MAP_FAILED)
+        return NULL;
+    if (stats->magic != STATS_MAGIC || stats->version != STATS_VERSION
+        || *size < STATS_SIZE(stats->client_max)) {
+        munmap(stats, *size);
+        return NULL;
+    }
+    return stats;
+}
+
+/*
+ * Calls sample every STATS_SAMPLE_MS from separate thread, so sampling
+ * syscalls stay out of message handling.
+ */
+int stats_start_sampler(struct stats_segment *stats, void (*sample)(struct stats_segment *stats)) {
+    if (stats == NULL)
+        return 0;
+    struct sampler *sampler = malloc(sizeof(struct sampler));
+    if (sampler == NULL)
+        return -1;
+    sampler->stats = stats;
+    sampler->sample = sample;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    // signals are left to server threads
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    int error = pthread_create(&thread, &attr, run_sampler, sampler);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    if (error != 0) {
+        free(sampler);
+        return -1;
+    }
+    return 0;
+}
+
+void *run_sampler(void *arg) {
+    struct sampler *sampler = arg;
+    struct timespec interval;
+    interval.tv_sec = STATS_SAMPLE_MS / 1000;
+    interval.tv_nsec = STATS_SAMPLE_MS % 1000 * 1000000L;
+    while (1) {
+        sampler->sample(sampler->stats);
+        atomic_store(&sampler->stats->sampled_at, (uint64_t) time(NULL));
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+/*
+ * Nanoseconds, CLOCK_MONOTONIC.
+ */
+uint64_t stats_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void stats_client_start(struct stats_segment *stats, int slot, int client_id) {
+    if (stats == NULL)
+        return;
+    struct client_stats *client = &stats->clients[slot];
+    atomic_store(&client->queue_depth, 0);
+    atomic_store(&client->in_flight, 0);
+    atomic_store(&client->dispatched, 0);
+    atomic_store(&client->results, 0);
+    for (int i = 0; i < STATS_LATENCY_BUCKETS; i++)
+        atomic_store(&client->latency[i], 0);
+    atomic_store(&client->client_id, client_id);
+}
+
+void stats_client_end(struct stats_segment *stats, int slot) {
+    if (stats == NULL)
+        return;
+    atomic_store(&stats->clients[slot].client_id, -1);
+}
+
+void stats_dispatched(struct stats_segment *stats, int slot) {
+    if (stats == NULL)
+        return;
+    atomic_fetch_add_explicit(&stats->clients[slot].dispatched, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->clients[slot].in_flight, 1, memory_order_relaxed);
+}
+
+/*
+ * Latency in nanoseconds.
+ */
+void stats_result(struct stats_segment *stats, int slot, uint64_t latency) {
+    if (stats == NULL)
+        return;
+    struct client_stats *client = &stats->clients[slot];
+    atomic_fetch_add_explicit(&client->results, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&client->in_flight, 1, memory_order_relaxed);
+    uint64_t micros = latency / 1000;
+    int bucket = micros == 0 ? 0 : 64 - __builtin_clzll(micros);
+    if (bucket >= STATS_LATENCY_BUCKETS)
+        bucket = STATS_LATENCY_BUCKETS - 1;
+    atomic_fetch_add_explicit(&client->latency[bucket], 1, memory_order_relaxed);
+}
+
+/*
+ * Tasks taken back from client without result - they missed deadline, the
+ * client is gone or they could not be sent.
+ */
+void stats_requeued(struct stats_segment *stats, int slot, int count) {
+    if (stats == NULL)
+        return;
+    atomic_fetch_sub_explicit(&stats->clients[slot].in_flight, count, memory_order_relaxed);
+}
@@ -0,0 +1,58 @@
+#ifndef COMMON_STATS_H
+#define COMMON_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define STATS_MAGIC 0x53544154 // "STAT"
+#define STATS_VERSION 1
+// bucket i counts latencies below 2^i microseconds (and not below 2^(i-1))
+#define STATS_LATENCY_BUCKETS 32
+// how often queue depths are sampled
+#define STATS_SAMPLE_MS 1000
+// tasks taken by clients themselves from shared queue of server
+#define STATS_POOL_CLIENT_ID -2
+
+struct client_stats {
+    _Atomic int client_id; // -1 - slot not used, STATS_POOL_CLIENT_ID - shared task queue
+    _Atomic int queue_depth; // tasks waiting in client queue at last sample
+    _Atomic int in_flight;
+    _Atomic uint64_t dispatched;
+    _Atomic uint64_t results;
+    _Atomic uint64_t latency[STATS_LATENCY_BUCKETS]; // from dispatch to result
+};
+
+/*
+ * Shared memory segment published by server. Server only updates counters
+ * with relaxed atomics, readers never lock anything.
+ */
+struct stats_segment {
+    uint32_t magic;
+    uint32_t version;
+    int client_max;
+    int pid;
+    _Atomic uint64_t sampled_at; // seconds since epoch of last sample
+    _Atomic int queue_depth; // messages waiting in server queue at last sample
+    _Atomic uint64_t cache_hits; // at last sample
+    struct client_stats clients[];
+};
+
+#define STATS_SIZE(client_max) (sizeof(struct stats_segment) + (client_max) * sizeof(struct client_stats))
+
+/*
+ * All functions updating stats accept NULL, so server does not have to check
+ * if stats are published.
+ */
+struct stats_segment *stats_create(const char *name, int client_max);
+void stats_remove(const char *name, struct stats_segment *stats);
+struct stats_segment *stats_open(const char *name, size_t *size);
+int stats_start_sampler(struct stats_segment *stats, void (*sample)(struct stats_segment *stats));
+uint64_t stats_now();
+void stats_client_start(struct stats_segment *stats, int slot, int client_id);
+void stats_client_end(struct stats_segment *stats, int slot);
+void stats_dispatched(struct stats_segment *stats, int slot);
+void stats_result(struct stats_segment *stats, int slot, uint64_t latency);
+void stats_requeued(struct stats_segment *stats, int slot, int count);
+
+#endif //COMMON_STATS_H
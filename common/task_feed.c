@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "task_feed.h"
+
+/*
+ * Numbers with cached verdict are answered at once, without client. After
+ * VERDICT_CACHE_MAX_HITS of them a number is returned anyway, so server
+ * does not spin when all numbers are cached. Lost numbers are sent again
+ * before new ones, ranges of retry queue are walked one number at a time. Returns -1 when task source is exhausted.
+ */
+int task_feed_next(struct task_feed *feed, uint64_t *number) {
+    for (int i = 0; ; i++) {
+        if (retry_queue_pop_number(feed->retry, number) != 0 && task_source_next(feed->source, number) != 0)
+            return -1;
+        if (i == VERDICT_CACHE_MAX_HITS)
+            return 0;
+        int verdict = verdict_cache_get(feed->verdicts, *number);
+        if (verdict == -1)
+            return 0;
+        result_sink_put_number(feed->results, *number, verdict, VERDICT_CACHE_CLIENT_ID);
+        checkpoint_done(feed->checkpoint, *number, *number + 1);
+    }
+}
+
+/*
+ * Every task is counted before it is built, so server is not done while the
+ * last numbers of task source are being built into a task. Task counts until
+ * its result comes, its client is gone or it misses deadline.
+ */
+void task_feed_start(struct task_feed *feed) {
+    atomic_fetch_add(&feed->in_flight, 1);
+}
+
+/*
+ * Server is done when task source is exhausted and no task is left, neither
+ * in flight nor waiting to be sent again.
+ */
+void task_feed_done(struct task_feed *feed, int count) {
+    if (atomic_fetch_sub(&feed->in_flight, count) == count && atomic_load(&feed->source->exhausted)
+        && retry_queue_empty(feed->retry)) {
+        static _Atomic int finished = 0;
+        if (atomic_exchange(&finished, 1) == 0) {
+            printf("All tasks done.\n");
+            exit(0);
+        }
+    }
+}
+
+/*
+ * Task is kept in table of its client with its deadline until result comes,
+ * first number is its key. Task which does not fit in the table must not
+ * be sent, its numbers go back to retry queue and -1 is returned.
+ */
+int task_feed_track(struct task_feed *feed, struct inflight_table *table, const uint64_t *numbers, int count) {
+    if (inflight_add_numbers(table, stats_now(), timer_wheel_now() + feed->options->task_deadline, numbers,
+                             count) != 0) {
+        retry_queue_push_numbers(feed->retry, numbers, count);
+        return -1;
+    }
+    stats_dispatched(*feed->stats, table->slot);
+    return 0;
+}
+
+/*
+ * Range task is kept the same way, lo is its key.
+ */
+int task_feed_track_range(struct task_feed *feed, struct inflight_table *table, uint64_t lo, uint64_t hi) {
+    if (inflight_add_range(table, stats_now(), timer_wheel_now() + feed->options->task_deadline, lo, hi) != 0) {
+        retry_queue_push(feed->retry, lo, hi);
+        return -1;
+    }
+    stats_dispatched(*feed->stats, table->slot);
+    return 0;
+}
+
+/*
+ * Takes task of result from table and marks its numbers done. Returns -1 if
+ * result is late - its task was sent again, so it is not counted.
+ */
+int task_feed_result(struct task_feed *feed, struct inflight_table *table, uint64_t key, struct inflight_task *task) {
+    if (inflight_take(table, key, task) != 0)
+        return -1;
+    checkpoint_done_task(feed->checkpoint, table, task);
+    stats_result(*feed->stats, table->slot, stats_now() - task->sent_at);
+    return 0;
+}
+
+/*
+ * Tracked task which could not be sent goes back to retry queue, server
+ * handles it as if task_feed_track failed.
+ */
+void task_feed_untrack(struct task_feed *feed, struct inflight_table *table, uint64_t key) {
+    struct inflight_task task;
+    if (inflight_take(table, key, &task) != 0)
+        return;
+    if (task.hi != 0)
+        retry_queue_push(feed->retry, task.lo, task.hi);
+    else
+        retry_queue_push_numbers(feed->retry, inflight_task_numbers(table, &task), task.count);
+    stats_requeued(*feed->stats, table->slot, 1);
+}
+
+/*
+ * Puts task at index to retry queue if it is still in table and missed
+ * deadline. Returns 1 if it did, it is counted by task_feed_expire.
+ */
+int task_feed_requeue_expired(struct task_feed *feed, struct inflight_table *table, int index, uint64_t now) {
+    int expired = inflight_requeue_expired(table, index, now, feed->retry);
+    stats_requeued(*feed->stats, table->slot, expired);
+    return expired;
+}
+
+/*
+ * Tasks of client which is gone are sent to other clients.
+ */
+void task_feed_requeue_all(struct task_feed *feed, struct inflight_table *table) {
+    int count = inflight_requeue_all(table, feed->retry);
+    stats_requeued(*feed->stats, table->slot, count);
+    task_feed_done(feed, count);
+}
+
+/*
+ * Tables are guarded by server, so requeue is called with owner of every
+ * expired timer - it locks table of the owner and calls
+ * task_feed_requeue_expired.
+ */
+void task_feed_expire(struct task_feed *feed, struct timer_wheel *wheel, int (*requeue)(int owner, uint64_t now)) {
+    int owners[INFLIGHT_MAX];
+    uint64_t now = timer_wheel_now();
+    int expired = 0;
+    int count;
+    while ((count = timer_wheel_expire(wheel, now, owners, INFLIGHT_MAX)) > 0)
+        for (int i = 0; i < count; i++)
+            expired += requeue(owners[i], now);
+    if (expired > 0) {
+        printf("%d tasks missed deadline, sending them to other clients.\n", expired);
+        task_feed_done(feed, expired);
+    }
+}
+
+/*
+ * Retried tasks go to clients with free credits - those are idle when task
+ * source is exhausted. send is called for slots until retry queue is empty,
+ * it skips slot without client or credits and returns -1 if sending failed.
+ */
+void task_feed_send_retried(struct task_feed *feed, int slot_count, int (*send)(int slot)) {
+    for (int i = 0; i < slot_count && !retry_queue_empty(feed->retry); i++)
+        if (send(i) == -1)
+            printf("Error while sending a new task to the client.\n");
+}
+
+/*
+ * Checkpoint is saved first, so it does not count results ignored by closed
+ * sink.
+ */
+void task_feed_close(struct task_feed *feed) {
+    checkpoint_close(feed->checkpoint, feed->source, feed->results);
+    result_sink_close(feed->results);
+}
@@ -0,0 +1,44 @@
+#ifndef COMMON_TASK_FEED_H
+#define COMMON_TASK_FEED_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "options.h"
+#include "task_source.h"
+#include "retry_queue.h"
+#include "verdict_cache.h"
+#include "result_sink.h"
+#include "checkpoint.h"
+#include "inflight.h"
+#include "stats.h"
+
+/*
+ * Numbers given out by server and where their results go. Parts are owned
+ * by server, feed only ties them together, so it can be set up statically.
+ * Feed also counts tasks in flight, server is done when there is none left.
+ */
+struct task_feed {
+    struct task_source *source;
+    struct retry_queue *retry;
+    struct verdict_cache *verdicts;
+    struct result_sink *results;
+    struct checkpoint *checkpoint;
+    struct server_options *options;
+    struct stats_segment **stats; // where server keeps them, NULL - not published
+    _Atomic int in_flight; // built tasks without result
+};
+
+int task_feed_next(struct task_feed *feed, uint64_t *number);
+void task_feed_start(struct task_feed *feed);
+void task_feed_done(struct task_feed *feed, int count);
+int task_feed_track(struct task_feed *feed, struct inflight_table *table, const uint64_t *numbers, int count);
+int task_feed_track_range(struct task_feed *feed, struct inflight_table *table, uint64_t lo, uint64_t hi);
+int task_feed_result(struct task_feed *feed, struct inflight_table *table, uint64_t key, struct inflight_task *task);
+void task_feed_untrack(struct task_feed *feed, struct inflight_table *table, uint64_t key);
+int task_feed_requeue_expired(struct task_feed *feed, struct inflight_table *table, int index, uint64_t now);
+void task_feed_requeue_all(struct task_feed *feed, struct inflight_table *table);
+void task_feed_expire(struct task_feed *feed, struct timer_wheel *wheel, int (*requeue)(int owner, uint64_t now));
+void task_feed_send_retried(struct task_feed *feed, int slot_count, int (*send)(int slot));
+void task_feed_close(struct task_feed *feed);
+
+#endif //COMMON_TASK_FEED_H
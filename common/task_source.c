@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "task_source.h"
+
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+int parse_bounds(const char *text, uint64_t *lo, uint64_t *hi);
+uint64_t next_random();
+uint64_t permute(struct task_source *source, uint64_t index);
+int next_from_file(struct task_source *source, uint64_t *number);
+void advise_window(struct task_source *source, uint64_t from, uint64_t to);
+
+/*
+ * Accepted forms: random, scan:lo:hi, unique:lo:hi, file:path.
+ */
+int task_source_parse(const char *text, struct task_source_spec *spec) {
+    spec->lo = 0;
+    spec->hi = UINT64_MAX;
+    spec->path = NULL;
+    if (strcmp(text, "random") == 0) {
+        spec->kind = TASK_SOURCE_RANDOM;
+        return 0;
+    }
+    if (strncmp(text, "scan:", 5) == 0) {
+        spec->kind = TASK_SOURCE_SCAN;
+        return parse_bounds(text + 5, &spec->lo, &spec->hi);
+    }
+    if (strncmp(text, "unique:", 7) == 0) {
+        spec->kind = TASK_SOURCE_UNIQUE;
+        return parse_bounds(text + 7, &spec->lo, &spec->hi);
+    }
+    if (strncmp(text, "file:", 5) == 0 && text[5] != '\0') {
+        spec->kind = TASK_SOURCE_FILE;
+        spec->path = (char *) text + 5;
+        return 0;
+    }
+    return -1;
+}
+
+int parse_bounds(const char *text, uint64_t *lo, uint64_t *hi) {
+    char *end;
+    if (!IS_DIGIT(text[0]))
+        return -1;
+    *lo = strtoull(text, &end, 10);
+    if (*end != ':' || !IS_DIGIT(end[1]))
+        return -1;
+    *hi = strtoull(end + 1, &end, 10);
+    if (*end != '\0' || *hi <= *lo)
+        return -1;
+    return 0;
+}
+
+int task_source_open(struct task_source *source, const struct task_source_spec *spec) {
+    source->spec = *spec;
+    atomic_init(&source->cursor, 0);
+    atomic_init(&source->exhausted, 0);
+    source->data = NULL;
+    source->size = 0;
+    if (spec->kind == TASK_SOURCE_UNIQUE) {
+        int bits = 2;
+        while (bits < 64 && (spec->hi - spec->lo - 1) >> bits != 0)
+            bits += 2;
+        source->half_bits = bits / 2;
+        uint64_t seed = (uint64_t) time(NULL) << 32 ^ (uint64_t) getpid();
+        for (int i = 0; i < 4; i++) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            source->keys[i] = seed;
+        }
+    }
+    if (spec->kind != TASK_SOURCE_FILE)
+        return 0;
+
+    int fd = open(spec->path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return -1;
+    }
+    source->size = file_stat.st_size;
+    if (source->size > 0) {
+        void *data = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        source->data = data;
+        madvise(data, source->size, MADV_SEQUENTIAL);
+        madvise(data, 2 * TASK_SOURCE_FILE_WINDOW, MADV_WILLNEED);
+    }
+    close(fd);
+    return 0;
+}
+
+void task_source_close(struct task_source *source) {
+    if (source->data != NULL)
+        munmap((void *) source->data, source->size);
+    source->data = NULL;
+    source->size = 0;
+}
+
+/*
+ * Returns -1 when source is exhausted.
+ */
+int task_source_next(struct task_source *source, uint64_t *number) {
+    if (source->spec.kind == TASK_SOURCE_RANDOM) {
+        *number = next_random();
+        return 0;
+    }
+    if (source->spec.kind == TASK_SOURCE_FILE)
+        return next_from_file(source, number);
+    uint64_t count = source->spec.hi - source->spec.lo;
+    uint64_t index = atomic_fetch_add(&source->cursor, 1);
+    if (index >= count) {
+        atomic_store(&source->exhausted, 1);
+        return -1;
+    }
+    if (source->spec.kind == TASK_SOURCE_UNIQUE)
+        index = permute(source, index);
+    *number = source->spec.lo + index;
+    return 0;
+}
+
+/*
+ * Takes next range of at most size numbers. Ranges follow each other from
+ * lo of the source, random source gives ranges from 0.
+ */
+int task_source_next_range(struct task_source *source, uint64_t size, uint64_t *lo, uint64_t *hi) {
+    uint64_t count = source->spec.hi - source->spec.lo;
+    uint64_t index = atomic_load(&source->cursor);
+    uint64_t next;
+    do {
+        if (index >= count) {
+            atomic_store(&source->exhausted, 1);
+            return -1;
+        }
+        next = count - index < size ? count : index + size;
+    } while (!atomic_compare_exchange_weak(&source->cursor, &index, next));
+    *lo = source->spec.lo + index;
+    *hi = source->spec.lo + next;
+    return 0;
+}
+
+/*
+ * Every thread has its own random state, so threads do not contend on it.
+ */
+uint64_t next_random() {
+    static _Thread_local unsigned int seed = 0;
+    if (seed == 0)
+        seed = ((unsigned int) time(NULL) ^ (unsigned int) pthread_self()) | 1;
+    return rand_r(&seed) % TASK_SOURCE_RANDOM_LIMIT;
+}
+
+/*
+ * Feistel network is a bijection on numbers of 2 * half_bits bits. Results
+ * outside of [0, count) are permuted again (cycle walking), so index maps to
+ * unique number of the source.
+ */
+uint64_t permute(struct task_source *source, uint64_t index) {
+    uint64_t count = source->spec.hi - source->spec.lo;
+    int half = source->half_bits;
+    uint64_t mask = half == 32 ? UINT32_MAX : (1ULL << half) - 1;
+    do {
+        uint64_t left = index >> half;
+        uint64_t right = index & mask;
+        for (int i = 0; i < 4; i++) {
+            uint64_t round = (right ^ source->keys[i]) * 0x9e3779b97f4a7c15ULL;
+            round ^= round >> 29;
+            round *= 0xbf58476d1ce4e5b9ULL;
+            round ^= round >> 32;
+            uint64_t next = left ^ (round & mask);
+            left = right;
+            right = next;
+        }
+        index = left << half | right;
+    } while (index >= count);
+    return index;
+}
+
+/*
+ * Numbers are decimal and separated by any non-digit characters.
+ */
+int next_from_file(struct task_source *source, uint64_t *number) {
+    uint64_t offset = atomic_load(&source->cursor);
+    while (1) {
+        size_t start = offset;
+        while (start < source->size && !IS_DIGIT(source->data[start]))
+            start++;
+        if (start == source->size) {
+            atomic_store(&source->exhausted, 1);
+            return -1;
+        }
+        size_t end = start;
+        uint64_t value = 0;
+        while (end < source->size && IS_DIGIT(source->data[end]))
+            value = value * 10 + (source->data[end++] - '0');
+        if (atomic_compare_exchange_weak(&source->cursor, &offset, end)) {
+            advise_window(source, offset, end);
+            *number = value;
+            return 0;
+        }
+    }
+}
+
+/*
+ * When cursor enters new window, next one is read ahead and the previous
+ * one is dropped from the mapping.
+ */
+void advise_window(struct task_source *source, uint64_t from, uint64_t to) {
+    uint64_t window = to / TASK_SOURCE_FILE_WINDOW;
+    if (from / TASK_SOURCE_FILE_WINDOW == window)
+        return;
+    uint64_t ahead = (window + 1) * TASK_SOURCE_FILE_WINDOW;
+    if (ahead < source->size)
+        madvise((void *) (source->data + ahead), TASK_SOURCE_FILE_WINDOW, MADV_WILLNEED);
+    madvise((void *) (source->data + (window - 1) * TASK_SOURCE_FILE_WINDOW), TASK_SOURCE_FILE_WINDOW,
+            MADV_DONTNEED);
+}
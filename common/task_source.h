@@ -0,0 +1,47 @@
+#ifndef COMMON_TASK_SOURCE_H
+#define COMMON_TASK_SOURCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define TASK_SOURCE_RANDOM 0
+#define TASK_SOURCE_SCAN 1
+#define TASK_SOURCE_UNIQUE 2
+#define TASK_SOURCE_FILE 3
+
+// numbers drawn by random source are below that
+#define TASK_SOURCE_RANDOM_LIMIT 1000
+// file is read ahead and released behind in windows of that size
+#define TASK_SOURCE_FILE_WINDOW (16 << 20)
+
+struct task_source_spec {
+    int kind;
+    uint64_t lo; // numbers from [lo, hi) for scan and unique sources
+    uint64_t hi;
+    char *path; // file with numbers for file source
+};
+
+/*
+ * Sources may be used by many threads at once. Scan and unique sources
+ * take next index with atomic cursor, file source parses number after
+ * cursor and moves it with compare-and-swap. File is mapped, not read, so
+ * only pages around cursor are in memory.
+ */
+struct task_source {
+    struct task_source_spec spec;
+    _Atomic uint64_t cursor; // next index or file offset
+    _Atomic int exhausted;
+    uint64_t keys[4]; // Feistel round keys of unique source
+    int half_bits;
+    const char *data;
+    size_t size;
+};
+
+int task_source_parse(const char *text, struct task_source_spec *spec);
+int task_source_open(struct task_source *source, const struct task_source_spec *spec);
+void task_source_close(struct task_source *source);
+int task_source_next(struct task_source *source, uint64_t *number);
+int task_source_next_range(struct task_source *source, uint64_t size, uint64_t *lo, uint64_t *hi);
+
+#endif //COMMON_TASK_SOURCE_H
@@ -0,0 +1,94 @@
+#include <time.h>
+#include "timer_wheel.h"
+
+void unlink_node(struct timer_node *node);
+
+void timer_wheel_init(struct timer_wheel *wheel) {
+    pthread_mutex_init(&wheel->lock, NULL);
+    wheel->current = timer_wheel_now();
+    for (int i = 0; i < TIMER_WHEEL_SIZE; i++) {
+        wheel->buckets[i].next = &wheel->buckets[i];
+        wheel->buckets[i].prev = &wheel->buckets[i];
+    }
+}
+
+/*
+ * Node which deadline has already passed goes to bucket expired next.
+ */
+void timer_wheel_add(struct timer_wheel *wheel, struct timer_node *node, uint64_t deadline, int owner) {
+    pthread_mutex_lock(&wheel->lock);
+    if (node->next != NULL)
+        unlink_node(node);
+    node->deadline = deadline;
+    node->owner = owner;
+    struct timer_node *head = &wheel->buckets[(deadline < wheel->current ? wheel->current : deadline)
+                                              % TIMER_WHEEL_SIZE];
+    node->next = head->next;
+    node->prev = head;
+    head->next->prev = node;
+    head->next = node;
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+/*
+ * Does nothing if node has already expired.
+ */
+void timer_wheel_remove(struct timer_wheel *wheel, struct timer_node *node) {
+    pthread_mutex_lock(&wheel->lock);
+    if (node->next != NULL)
+        unlink_node(node);
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+/*
+ * Returns 1 if node is linked - it has not expired and was not removed.
+ */
+int timer_wheel_pending(struct timer_wheel *wheel, struct timer_node *node) {
+    pthread_mutex_lock(&wheel->lock);
+    int pending = node->next != NULL;
+    pthread_mutex_unlock(&wheel->lock);
+    return pending;
+}
+
+/*
+ * Unlinks nodes with deadline up to now and stores their owners. When there
+ * are more than max of them, the rest is left for next call.
+ */
+int timer_wheel_expire(struct timer_wheel *wheel, uint64_t now, int *owners, int max) {
+    int count = 0;
+    pthread_mutex_lock(&wheel->lock);
+    if (now >= wheel->current + TIMER_WHEEL_SIZE) // every bucket is walked once anyway
+        wheel->current = now - TIMER_WHEEL_SIZE + 1;
+    while (wheel->current <= now) {
+        struct timer_node *head = &wheel->buckets[wheel->current % TIMER_WHEEL_SIZE];
+        struct timer_node *node = head->next;
+        while (node != head) {
+            struct timer_node *next = node->next;
+            if (node->deadline <= now) {
+                if (count == max) {
+                    pthread_mutex_unlock(&wheel->lock);
+                    return count;
+                }
+                owners[count++] = node->owner;
+                unlink_node(node);
+            }
+            node = next;
+        }
+        wheel->current++;
+    }
+    pthread_mutex_unlock(&wheel->lock);
+    return count;
+}
+
+uint64_t timer_wheel_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+void unlink_node(struct timer_node *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = NULL;
+    node->prev = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef COMMON_TIMER_WHEEL_H
+#define COMMON_TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// one bucket for every second, later deadlines wait for next turn of wheel
+#define TIMER_WHEEL_SIZE 64
+
+/*
+ * Node is embedded in timed object, owner tells which object it is.
+ * Unlinked node has next == NULL. Links of linked node are changed when its
+ * neighbours are unlinked, so they are read only with lock of the wheel.
+ */
+struct timer_node {
+    struct timer_node *next;
+    struct timer_node *prev;
+    uint64_t deadline; // seconds, CLOCK_MONOTONIC
+    int owner;
+};
+
+/*
+ * Hashed timing wheel - adding and removing a node is O(1) and expiring
+ * walks only buckets of seconds that passed. Thread-safe.
+ */
+struct timer_wheel {
+    pthread_mutex_t lock;
+    uint64_t current; // next second to expire
+    struct timer_node buckets[TIMER_WHEEL_SIZE]; // list heads
+};
+
+void timer_wheel_init(struct timer_wheel *wheel);
+void timer_wheel_add(struct timer_wheel *wheel, struct timer_node *node, uint64_t deadline, int owner);
+void timer_wheel_remove(struct timer_wheel *wheel, struct timer_node *node);
+int timer_wheel_pending(struct timer_wheel *wheel, struct timer_node *node);
+int timer_wheel_expire(struct timer_wheel *wheel, uint64_t now, int *owners, int max);
+uint64_t timer_wheel_now();
+
+#endif //COMMON_TIMER_WHEEL_H
@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include "verdict_cache.h"
+
+#define DENSE_WORDS (VERDICT_DENSE_LIMIT / 64)
+
+uint64_t bucket_index(uint64_t number);
+
+int verdict_cache_init(struct verdict_cache *cache) {
+    cache->known = calloc(DENSE_WORDS, sizeof(uint64_t));
+    cache->prime = calloc(DENSE_WORDS, sizeof(uint64_t));
+    cache->buckets = calloc(VERDICT_CACHE_BUCKETS * 2, sizeof(uint64_t));
+    atomic_init(&cache->hits, 0);
+    if (cache->known == NULL || cache->prime == NULL || cache->buckets == NULL) {
+        verdict_cache_destroy(cache);
+        return -1;
+    }
+    return 0;
+}
+
+void verdict_cache_destroy(struct verdict_cache *cache) {
+    free(cache->known);
+    free(cache->prime);
+    free(cache->buckets);
+    cache->known = NULL;
+    cache->prime = NULL;
+    cache->buckets = NULL;
+}
+
+void verdict_cache_put(struct verdict_cache *cache, uint64_t number, int is_prime) {
+    is_prime = is_prime != 0;
+    if (number < VERDICT_DENSE_LIMIT) {
+        uint64_t bit = 1ULL << (number % 64);
+        if (is_prime)
+            atomic_fetch_or_explicit(&cache->prime[number / 64], bit, memory_order_relaxed);
+        atomic_fetch_or_explicit(&cache->known[number / 64], bit, memory_order_release);
+        return;
+    }
+    if (number == UINT64_MAX) // number + 1 would be empty entry
+        return;
+    _Atomic uint64_t *bucket = &cache->buckets[bucket_index(number) * 2];
+    atomic_store_explicit(&bucket[is_prime], number + 1, memory_order_relaxed);
+    // number could be stored with other verdict only by broken client, drop it
+    uint64_t stale = number + 1;
+    atomic_compare_exchange_strong_explicit(&bucket[!is_prime], &stale, 0,
+                                            memory_order_relaxed, memory_order_relaxed);
+}
+
+/*
+ * Returns 1 for prime, 0 for composite and -1 if number is not cached.
+ */
+int verdict_cache_get(struct verdict_cache *cache, uint64_t number) {
+    int verdict = -1;
+    if (number < VERDICT_DENSE_LIMIT) {
+        uint64_t bit = 1ULL << (number % 64);
+        if (atomic_load_explicit(&cache->known[number / 64], memory_order_acquire) & bit)
+            verdict = (atomic_load_explicit(&cache->prime[number / 64], memory_order_relaxed) & bit) != 0;
+    } else if (number != UINT64_MAX) {
+        _Atomic uint64_t *bucket = &cache->buckets[bucket_index(number) * 2];
+        if (atomic_load_explicit(&bucket[1], memory_order_relaxed) == number + 1)
+            verdict = 1;
+        else if (atomic_load_explicit(&bucket[0], memory_order_relaxed) == number + 1)
+            verdict = 0;
+    }
+    if (verdict != -1)
+        atomic_fetch_add_explicit(&cache->hits, 1, memory_order_relaxed);
+    return verdict;
+}
+
+/*
+ * Fibonacci hashing, consecutive numbers land in distant buckets.
+ */
+uint64_t bucket_index(uint64_t number) {
+    return (number * 11400714819323198485ULL) >> 48 & (VERDICT_CACHE_BUCKETS - 1);
+}
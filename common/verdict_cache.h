@@ -0,0 +1,35 @@
+#ifndef COMMON_VERDICT_CACHE_H
+#define COMMON_VERDICT_CACHE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// numbers below that are kept in bitsets, so they are never forgotten
+#define VERDICT_DENSE_LIMIT (1 << 20)
+// buckets for bigger numbers, every bucket keeps one number
+#define VERDICT_CACHE_BUCKETS (1 << 16)
+// cached numbers answered in a row before number is dispatched anyway
+#define VERDICT_CACHE_MAX_HITS 16
+// client id reported with results answered from cache
+#define VERDICT_CACHE_CLIENT_ID -1
+
+/*
+ * Verdicts of tested numbers. Small numbers have known and prime bits,
+ * bigger ones go to direct-mapped buckets where newer number replaces
+ * older one. Bucket has entry for composite and for prime number, entry
+ * holds number + 1 (0 - empty), so verdict is given by entry which holds
+ * the number. All operations are lock-free.
+ */
+struct verdict_cache {
+    _Atomic uint64_t *known;
+    _Atomic uint64_t *prime;
+    _Atomic uint64_t *buckets;
+    _Atomic uint64_t hits;
+};
+
+int verdict_cache_init(struct verdict_cache *cache);
+void verdict_cache_destroy(struct verdict_cache *cache);
+void verdict_cache_put(struct verdict_cache *cache, uint64_t number, int is_prime);
+int verdict_cache_get(struct verdict_cache *cache, uint64_t number);
+
+#endif //COMMON_VERDICT_CACHE_H
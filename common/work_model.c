@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "work_model.h"
+
+uint64_t work_model_now();
+
+/*
+ * Accepted forms: none, sleep:ms, spin:ms.
+ */
+int work_model_parse(const char *text, struct work_model *model) {
+    model->ns = 0;
+    const char *value;
+    if (strcmp(text, "none") == 0) {
+        model->kind = WORK_MODEL_NONE;
+        return 0;
+    }
+    if (strncmp(text, "sleep:", 6) == 0) {
+        model->kind = WORK_MODEL_SLEEP;
+        value = text + 6;
+    } else if (strncmp(text, "spin:", 5) == 0) {
+        model->kind = WORK_MODEL_SPIN;
+        value = text + 5;
+    } else {
+        return -1;
+    }
+    char *end;
+    if (*value < '0' || *value > '9')
+        return -1;
+    uint64_t ms = strtoull(value, &end, 10);
+    if (*end != '\0')
+        return -1;
+    model->ns = ms * 1000000;
+    return 0;
+}
+
+void work_model_run(const struct work_model *model) {
+    if (model->kind == WORK_MODEL_SLEEP) {
+        struct timespec left;
+        left.tv_sec = model->ns / 1000000000;
+        left.tv_nsec = model->ns % 1000000000;
+        while (nanosleep(&left, &left) != 0 && errno == EINTR);
+    } else if (model->kind == WORK_MODEL_SPIN) {
+        uint64_t end = work_model_now() + model->ns;
+        while (work_model_now() < end);
+    }
+}
+
+uint64_t work_model_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -0,0 +1,26 @@
+#ifndef COMMON_WORK_MODEL_H
+#define COMMON_WORK_MODEL_H
+
+#include <stdint.h>
+
+#define WORK_MODEL_NONE 0
+#define WORK_MODEL_SLEEP 1
+#define WORK_MODEL_SPIN 2
+
+// delay clients always had after every task
+#define WORK_MODEL_DEFAULT "sleep:2000"
+
+/*
+ * Simulated work added to every dispatch after the real test, so slower
+ * nodes can be modelled and transport costs measured without it. Sleep
+ * leaves CPU idle, spin keeps the worker thread busy.
+ */
+struct work_model {
+    int kind;
+    uint64_t ns; // per dispatch
+};
+
+int work_model_parse(const char *text, struct work_model *model);
+void work_model_run(const struct work_model *model);
+
+#endif //COMMON_WORK_MODEL_H
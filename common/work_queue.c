@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <string.h>
+#include "work_queue.h"
+
+int work_queue_init(struct work_queue *queue, int capacity, size_t item_size) {
+    if (capacity <= 0)
+        return -1;
+    queue->items = malloc(capacity * item_size);
+    if (queue->items == NULL)
+        return -1;
+    queue->item_size = item_size;
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return 0;
+}
+
+void work_queue_destroy(struct work_queue *queue) {
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    free(queue->items);
+    queue->items = NULL;
+    queue->capacity = 0;
+    queue->count = 0;
+}
+
+/*
+ * Blocks while queue is full.
+ */
+void work_queue_push(struct work_queue *queue, const void *item) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->capacity)
+        pthread_cond_wait(&queue->not_full, &queue->mutex);
+    int tail = (queue->head + queue->count) % queue->capacity;
+    memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/*
+ * Blocks while queue is empty.
+ */
+void work_queue_pop(struct work_queue *queue, void *item) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0)
+        pthread_cond_wait(&queue->not_empty, &queue->mutex);
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex);
+}
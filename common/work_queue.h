@@ -0,0 +1,27 @@
+#ifndef COMMON_WORK_QUEUE_H
+#define COMMON_WORK_QUEUE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Bounded blocking FIFO of fixed-size items, used by client receive thread
+ * to feed its worker threads. Items are copied in and out.
+ */
+struct work_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    size_t item_size;
+    int capacity;
+    int head;
+    int count;
+    char *items;
+};
+
+int work_queue_init(struct work_queue *queue, int capacity, size_t item_size);
+void work_queue_destroy(struct work_queue *queue);
+void work_queue_push(struct work_queue *queue, const void *item);
+void work_queue_pop(struct work_queue *queue, void *item);
+
+#endif //COMMON_WORK_QUEUE_H
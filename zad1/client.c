@@ -5,25 +5,52 @@
 #include <sys/stat.h>
 #include <sys/msg.h>
 #include <signal.h>
+#include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "messages.h"
+#include "prime.h"
+#include "sieve.h"
+#include "work_queue.h"
+#include "work_model.h"
 
-int read_args(int argc, char *argv[], char **pathname, int *proj_id);
+#define MAX_THREAD_COUNT 256
+#define TASK_MSG_SIZE (sizeof(long) + MAX_MSG_SIZE)
+
+int read_args(int argc, char *argv[], char **pathname, int *proj_id, int *batch_size, int *thread_count, int *window,
+              struct work_model *work);
+int start_workers();
+void *worker(void *arg);
 void remove_queue();
-void send_ready_msg();
-int is_prime(int num);
+void process_task(uint64_t number);
+void process_task_batch(struct task_batch *batch);
+void process_range_task(struct range_task *task);
+void process_factor_task(uint64_t number);
+void send_result(void *message, size_t size);
 void sigint_handler(int signum);
 
 int queue_id = -1;
 int server_queue_id = -1;
 int client_id = -1;
+int batch_size = 1;
+int thread_count = 0;
+int window = 0;
+int task_queue_id = -1; // shared queue of server, -1 - tasks come to client queue
+int result_priority = 0; // lane of results in server queue
+_Atomic unsigned int results_sent = 0;
+struct work_queue tasks;
+struct work_model work;
 
 /*
- * Types of messages:
+ * Types of messages, intro goes in control lane and the other ones in lane
+ * granted by server:
  * 1 - sending client queue id
- * 2 - sending "client ready"
  * 3 - sending task results
- * 4 - sending "client closed"
+ * 4 - sending factors of number
+ * 5 - sending batch task results
+ * 6 - sending range task results
+ * 7 - sending "client closed"
  */
 int main(int argc, char *argv[]) {
     atexit(remove_queue);
@@ -32,13 +59,24 @@ int main(int argc, char *argv[]) {
     sigaction(SIGINT, &act, NULL);
     sigaction(SIGTSTP, &act, NULL);
 
-    char *args_help = "Enter pathname and id number.\n";
+    char *args_help = "Enter pathname, id number and optional batch size (1 - %d)"
+            " (options: -t number of worker threads, default - number of cores,"
+            " -w number of tasks in flight, default - 2 * number of threads,"
+            " -l simulated work after every task: none, sleep:ms or spin:ms, default - " WORK_MODEL_DEFAULT ").\n";
     char *pathname;
     int proj_id;
-    if (read_args(argc, argv, &pathname, &proj_id) != 0) {
-        printf(args_help);
+    thread_count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count <= 0)
+        thread_count = 1;
+    if (thread_count > MAX_THREAD_COUNT)
+        thread_count = MAX_THREAD_COUNT;
+    work_model_parse(WORK_MODEL_DEFAULT, &work);
+    if (read_args(argc, argv, &pathname, &proj_id, &batch_size, &thread_count, &window, &work) != 0) {
+        printf(args_help, MAX_BATCH_SIZE);
         return 1;
     }
+    if (window == 0)
+        window = 2 * thread_count < MAX_WINDOW ? 2 * thread_count : MAX_WINDOW;
 
     key_t server_queue_key = ftok(pathname, proj_id);
     if (server_queue_key == -1) {
@@ -57,43 +95,49 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    struct int_msg client_intro;
-    client_intro.mtype = 1;
-    client_intro.mtext.number = queue_id;
-    if(msgsnd(server_queue_id, (void*)&client_intro, sizeof(struct int_msg_mtext), 0) != 0) {
+    struct client_intro_msg client_intro;
+    client_intro.mtype = LANE_TYPE(1, CONTROL_PRIORITY);
+    client_intro.mtext.queue_id = queue_id;
+    client_intro.mtext.batch_size = batch_size;
+    client_intro.mtext.window = window;
+    client_intro.mtext.pid = getpid();
+    if(msgsnd(server_queue_id, (void*)&client_intro, sizeof(struct client_intro), 0) != 0) {
         printf("Error while sending registration data to server.\n");
         return 1;
     }
 
-    void * message = malloc(MAX_MSG_SIZE + sizeof(long));
-    if (message == NULL) {
+    void * message = malloc(TASK_MSG_SIZE);
+    if (message == NULL || work_queue_init(&tasks, window, TASK_MSG_SIZE) != 0) {
         printf("Error while allocating memory occurred.\n");
         return 1;
     }
 
-    struct client_result_msg cr;
-    cr.mtype = 3;
+    // receive thread only passes tasks to workers, server keeps window tasks in flight
     while (1) {
         msgrcv(queue_id, message, MAX_MSG_SIZE, 0, 0);
         switch (((struct default_msg *)message)->mtype) {
-            case 1: // server respond with client_id
-                client_id = ((struct int_msg *)message)->mtext.number;
+            case 1: // server respond with client_id and granted batch size
+                client_id = ((struct client_accept_msg *)message)->mtext.client_id;
                 if (client_id == -1) {
                     printf("Server refused client.\n");
                     server_queue_id = -1;
                     return 1;
                 }
-                cr.mtext.client_id = client_id;
-                send_ready_msg();
+                batch_size = ((struct client_accept_msg *)message)->mtext.batch_size;
+                window = ((struct client_accept_msg *)message)->mtext.window;
+                task_queue_id = ((struct client_accept_msg *)message)->mtext.task_queue_id;
+                result_priority = ((struct client_accept_msg *)message)->mtext.result_priority;
+                // workers start when they know where tasks come from
+                if (start_workers() != 0) {
+                    printf("Error while starting worker threads occurred.\n");
+                    return 1;
+                }
                 break;
             case 2: // new server task
-                cr.mtext.number = ((struct int_msg *)message)->mtext.number;
-                cr.mtext.is_prime = is_prime(cr.mtext.number);
-                sleep(2);
-                if(msgsnd(server_queue_id, (void*)&cr, sizeof(struct client_result), 0) != 0) {
-                    printf("Error while sending client result to server.\n");
-                }
-                send_ready_msg();
+            case 4: // new batch of server tasks
+            case 5: // new server range task
+            case 6: // new number to factorize
+                work_queue_push(&tasks, message);
                 break;
             case 3: // server closed
                 server_queue_id = -1;
@@ -103,49 +147,184 @@ int main(int argc, char *argv[]) {
     }
 }
 
-int read_args(int argc, char *argv[], char **pathname, int *proj_id) {
-    if (argc != 3) {
+int read_args(int argc, char *argv[], char **pathname, int *proj_id, int *batch_size, int *thread_count, int *window,
+              struct work_model *work) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:w:l:")) != -1) {
+        switch (opt) {
+            case 't':
+                *thread_count = atoi(optarg);
+                if (*thread_count <= 0 || *thread_count > MAX_THREAD_COUNT) {
+                    printf("Incorrect number of threads. It should be between 1 and %d.\n", MAX_THREAD_COUNT);
+                    return 1;
+                }
+                break;
+            case 'w':
+                *window = atoi(optarg);
+                if (*window <= 0 || *window > MAX_WINDOW) {
+                    printf("Incorrect window. It should be between 1 and %d.\n", MAX_WINDOW);
+                    return 1;
+                }
+                break;
+            case 'l':
+                if (work_model_parse(optarg, work) != 0) {
+                    printf("Incorrect work model. It should be none, sleep:ms or spin:ms.\n");
+                    return 1;
+                }
+                break;
+            default:
+                return 1;
+        }
+    }
+    if (argc - optind != 2 && argc - optind != 3) {
         printf("Incorrect number of arguments.\n");
         return 1;
     }
-    *pathname = argv[1];
-    int n = atoi(argv[2]);
+    *pathname = argv[optind];
+    int n = atoi(argv[optind + 1]);
     if (n <= 0) {
         printf("Incorrect id number. It should be > 0.\n");
         return 1;
     }
     *proj_id = n;
+    if (argc - optind == 3) {
+        n = atoi(argv[optind + 2]);
+        if (n <= 0 || n > MAX_BATCH_SIZE) {
+            printf("Incorrect batch size.\n");
+            return 1;
+        }
+        *batch_size = n;
+    }
 
     return 0;
 }
 
+int start_workers() {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&thread, &attr, worker, NULL) != 0) {
+            pthread_attr_destroy(&attr);
+            return -1;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return 0;
+}
+
+/*
+ * Result sent by worker returns credit to server, which answers with next task.
+ * With shared task queue workers take tasks from it themselves.
+ */
+void *worker(void *arg) {
+    void *message = malloc(TASK_MSG_SIZE);
+    if (message == NULL) {
+        printf("Error while allocating memory occurred.\n");
+        return NULL;
+    }
+    while (1) {
+        if (task_queue_id == -1) {
+            work_queue_pop(&tasks, message);
+        } else if (msgrcv(task_queue_id, message, MAX_MSG_SIZE, 0, 0) == -1) {
+            if (errno == EINTR)
+                continue;
+            return NULL; // queue removed with server
+        }
+        switch (((struct default_msg *)message)->mtype) {
+            case 2: // single task
+                process_task(((struct task_msg *)message)->mtext.number);
+                break;
+            case 4: // batch of tasks
+                process_task_batch(&((struct task_batch_msg *)message)->mtext);
+                break;
+            case 5: // range task
+                process_range_task(&((struct range_task_msg *)message)->mtext);
+                break;
+            case 6: // number to factorize
+                process_factor_task(((struct task_msg *)message)->mtext.number);
+                break;
+        }
+    }
+}
+
 void remove_queue() {
     if (server_queue_id != -1) {
-        struct int_msg new_int_msg;
-        new_int_msg.mtype = 4;
-        new_int_msg.mtext.number = client_id;
-        msgsnd(server_queue_id, (void *) &new_int_msg, sizeof(struct int_msg_mtext), 0);
+        struct client_closed_msg closed_msg;
+        closed_msg.mtype = LANE_TYPE(CLIENT_CLOSED_TYPE, result_priority);
+        closed_msg.mtext.client_id = client_id;
+        closed_msg.mtext.results = atomic_load(&results_sent);
+        msgsnd(server_queue_id, (void *) &closed_msg, sizeof(struct client_closed), 0);
     }
     if (queue_id != -1)
         msgctl(queue_id, IPC_RMID, NULL);
 }
 
-void send_ready_msg() {
-    struct int_msg new_int_msg;
-    new_int_msg.mtype = 2;
-    new_int_msg.mtext.number = client_id;
-    if(msgsnd(server_queue_id, (void*)&new_int_msg, sizeof(struct int_msg_mtext), 0) != 0) {
-        printf("Error while sending 'client ready' state to server.\n");
+void process_task(uint64_t number) {
+    struct client_result_msg cr;
+    cr.mtype = LANE_TYPE(3, result_priority);
+    cr.mtext.client_id = client_id;
+    cr.mtext.number = number;
+    cr.mtext.is_prime = is_prime(number);
+    work_model_run(&work);
+    send_result(&cr, sizeof(struct client_result));
+}
+
+void process_task_batch(struct task_batch *batch) {
+    struct batch_result_msg br;
+    br.mtype = LANE_TYPE(5, result_priority);
+    br.mtext.client_id = client_id;
+    br.mtext.count = batch->count;
+    if (br.mtext.count > MAX_BATCH_SIZE)
+        br.mtext.count = MAX_BATCH_SIZE;
+    for (int i = 0; i < br.mtext.count; i++)
+        br.mtext.numbers[i] = batch->numbers[i];
+    is_prime_batch(br.mtext.numbers, br.mtext.count, br.mtext.is_prime);
+    work_model_run(&work);
+    send_result(&br, BATCH_RESULT_SIZE(br.mtext.count));
+}
+
+void process_range_task(struct range_task *task) {
+    struct range_result_msg rr;
+    rr.mtype = LANE_TYPE(6, result_priority);
+    rr.mtext.client_id = client_id;
+    rr.mtext.with_bitmap = task->with_bitmap;
+    rr.mtext.lo = task->lo;
+    rr.mtext.hi = task->hi;
+    uint64_t max_size = task->with_bitmap ? MAX_BITMAP_RANGE_SIZE : MAX_RANGE_SIZE;
+    if (rr.mtext.hi < rr.mtext.lo || rr.mtext.hi - rr.mtext.lo > max_size)
+        rr.mtext.hi = rr.mtext.lo + max_size;
+    // credit of task comes back only with its result, so task waits for memory
+    while (sieve_range(rr.mtext.lo, rr.mtext.hi, task->with_bitmap ? rr.mtext.bitmap : NULL, &rr.mtext.count) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        sleep(1);
     }
+    work_model_run(&work);
+    size_t size = RANGE_RESULT_SIZE(task->with_bitmap ? rr.mtext.hi - rr.mtext.lo : 0);
+    send_result(&rr, size);
+}
+
+void process_factor_task(uint64_t number) {
+    struct factor_result_msg fr;
+    fr.mtype = LANE_TYPE(4, result_priority);
+    fr.mtext.client_id = client_id;
+    fr.mtext.number = number;
+    fr.mtext.count = factorize(number, fr.mtext.factors);
+    work_model_run(&work);
+    send_result(&fr, FACTOR_RESULT_SIZE(fr.mtext.count));
 }
 
-int is_prime(int num) {
-    if (num <= 1) return 0;
-    if (num % 2 == 0) return 0;
-    for(int i = 3; i < num / 2; i+= 2)
-        if (num % i == 0)
-            return 0;
-    return 1;
+/*
+ * Result is counted before it is sent, so "client closed" never tells server
+ * about less results than it gets.
+ */
+void send_result(void *message, size_t size) {
+    atomic_fetch_add(&results_sent, 1);
+    if (msgsnd(server_queue_id, message, size, 0) != 0) {
+        atomic_fetch_sub(&results_sent, 1);
+        printf("Error while sending client result to server.\n");
+    }
 }
 
 void sigint_handler(int signum) {
@@ -1,6 +1,30 @@
 #ifndef ZAD1_MESSAGES_H
 #define ZAD1_MESSAGES_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+// biggest multiple of 8 for which batch_result fits in default msgmax (8192)
+#define MAX_BATCH_SIZE 1000
+// same for range_result with bitmap
+#define MAX_RANGE_BITMAP_BYTES 8000
+#define MAX_BITMAP_RANGE_SIZE (MAX_RANGE_BITMAP_BYTES * 8)
+#define MAX_RANGE_SIZE (1ULL << 32)
+// max number of tasks sent to one client and not answered yet
+#define MAX_WINDOW 64
+// prime factors of 64-bit number, counted with repetition
+#define MAX_FACTORS 64
+// client messages have lower types than this one, server takes the lowest
+// type first, so it comes after all results of its client
+#define CLIENT_CLOSED_TYPE 7
+// client messages of one lane have types 1 - CLIENT_CLOSED_TYPE, lanes are
+// LANE_TYPES apart and lane of higher priority has lower types, so it is
+// taken first; intro messages go in lane CONTROL_PRIORITY
+#define LANE_TYPES 8
+#define MAX_LANE_PRIORITY 2
+#define CONTROL_PRIORITY 1
+#define LANE_TYPE(type, priority) ((type) + LANE_TYPES * (long) (MAX_LANE_PRIORITY - (priority)))
+
 struct default_msg {
     long mtype;
     char mtext[1];
@@ -15,10 +39,58 @@ struct int_msg {
     struct int_msg_mtext mtext;
 };
 
+struct task_mtext {
+    uint64_t number;
+};
+
+struct task_msg {
+    long mtype;
+    struct task_mtext mtext;
+};
+
+struct client_intro {
+    int queue_id;
+    int batch_size; // requested number of tasks per dispatch
+    int window;     // requested number of dispatches in flight
+    int pid;        // lets server notice killed client
+};
+
+struct client_intro_msg {
+    long mtype;
+    struct client_intro mtext;
+};
+
+struct client_accept {
+    int client_id;
+    int batch_size; // batch size granted by server
+    int window;     // window granted by server
+    int task_queue_id; // shared queue clients take tasks from, -1 - tasks come to client queue
+    int result_priority; // lane of results and "client closed"
+};
+
+struct client_accept_msg {
+    long mtype;
+    struct client_accept mtext;
+};
+
+/*
+ * Server releases client after it handles that many results, those can
+ * still be handled by other threads when "client closed" comes.
+ */
+struct client_closed {
+    int client_id;
+    unsigned int results; // number of results sent by client
+};
+
+struct client_closed_msg {
+    long mtype;
+    struct client_closed mtext;
+};
+
 struct client_result {
     int client_id;
-    int number;
     int is_prime;
+    uint64_t number;
 };
 
 struct client_result_msg {
@@ -26,6 +98,93 @@ struct client_result_msg {
     struct client_result mtext;
 };
 
-#define MAX_MSG_SIZE sizeof(struct client_result)
+/*
+ * Only first count numbers are sent - use TASK_BATCH_SIZE(count)
+ * as message size.
+ */
+struct task_batch {
+    int count;
+    uint64_t numbers[MAX_BATCH_SIZE];
+};
+
+struct task_batch_msg {
+    long mtype;
+    struct task_batch mtext;
+};
+
+/*
+ * is_prime is a bitmap (bit i set - numbers[i] is prime). It is placed
+ * before numbers, so only first count numbers have to be sent
+ * - use BATCH_RESULT_SIZE(count) as message size.
+ */
+struct batch_result {
+    int client_id;
+    int count;
+    unsigned char is_prime[MAX_BATCH_SIZE / 8];
+    uint64_t numbers[MAX_BATCH_SIZE];
+};
+
+struct batch_result_msg {
+    long mtype;
+    struct batch_result mtext;
+};
+
+struct range_task {
+    uint64_t lo;
+    uint64_t hi; // range is [lo, hi)
+    int with_bitmap;
+};
+
+struct range_task_msg {
+    long mtype;
+    struct range_task mtext;
+};
+
+/*
+ * bitmap (bit i set - lo + i is prime) is filled only if task asked for it
+ * - use RANGE_RESULT_SIZE(with_bitmap ? hi - lo : 0) as message size.
+ */
+struct range_result {
+    int client_id;
+    int with_bitmap;
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t count;
+    unsigned char bitmap[MAX_RANGE_BITMAP_BYTES];
+};
+
+struct range_result_msg {
+    long mtype;
+    struct range_result mtext;
+};
+
+/*
+ * Prime factors of number in ascending order, only first count are sent
+ * - use FACTOR_RESULT_SIZE(count) as message size.
+ */
+struct factor_result {
+    int client_id;
+    int count;
+    uint64_t number;
+    uint64_t factors[MAX_FACTORS];
+};
+
+struct factor_result_msg {
+    long mtype;
+    struct factor_result mtext;
+};
+
+union max_mtext {
+    struct batch_result batch_result;
+    struct range_result range_result;
+};
+
+#define TASK_BATCH_SIZE(count) (offsetof(struct task_batch, numbers) + (count) * sizeof(uint64_t))
+#define BATCH_RESULT_SIZE(count) (offsetof(struct batch_result, numbers) + (count) * sizeof(uint64_t))
+
+#define RANGE_RESULT_SIZE(range_size) (offsetof(struct range_result, bitmap) + ((range_size) + 7) / 8)
+#define FACTOR_RESULT_SIZE(count) (offsetof(struct factor_result, factors) + (count) * sizeof(uint64_t))
+
+#define MAX_MSG_SIZE sizeof(union max_mtext)
 
 #endif //ZAD1_MESSAGES_H
@@ -7,41 +7,180 @@
 #include <time.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "messages.h"
+#include "client_table.h"
+#include "options.h"
+#include "result_sink.h"
+#include "verdict_cache.h"
+#include "task_source.h"
+#include "inflight.h"
+#include "stats.h"
+#include "timer_wheel.h"
+#include "retry_queue.h"
+#include "batch_sizer.h"
+#include "checkpoint.h"
+#include "task_feed.h"
 
-#define CLIENT_MAX 3
+// how often sending to clients with full queue is retried
+#define FLUSH_INTERVAL_MS 10
+// client which queue stays full that long is evicted
+#define CLIENT_STUCK_TIMEOUT 10
+
+union task_out_msg {
+    struct task_msg task;
+    struct task_batch_msg batch;
+    struct range_task_msg range;
+};
+
+/*
+ * Tasks owed to client which queue was full. Task which did not fit is kept
+ * in held and sent before any new one. Backlog and other state of client
+ * slot are changed only with lock held, held_size is also read without it.
+ */
+struct client_backlog {
+    pthread_mutex_t lock;
+    int credits;
+    _Atomic size_t held_size; // message size of held task, 0 - no held task
+    union task_out_msg *held;
+    time_t stuck_since;
+    struct inflight_table inflight;
+    struct batch_sizer sizer;
+    unsigned int results; // results of client handled so far
+    int closing; // client closed before all its results were handled
+    unsigned int results_sent; // results client sent before it closed
+};
 
 int read_args(int argc, char *argv[], char **pathname, int *proj_id);
-int get_next_client_id();
-int get_new_task();
+int start_receivers();
+int start_watchdog();
+int open_pool();
+void *watch_tasks(void *arg);
+void *receive_messages(void *arg);
+void handle_message(void *message, size_t size);
+void accept_client(struct client_intro *intro);
+void close_client(struct client_closed *closed);
+void result_handled(int client_id);
+size_t build_task(int slot, union task_out_msg *msg);
+size_t build_task_batch(int slot, struct task_batch_msg *batch_msg);
+size_t build_range_task(int slot, struct range_task_msg *range_msg);
+int track_task(int slot, union task_out_msg *msg);
+void return_credit(int client_id, uint64_t key);
+int flush_backlog(int slot);
+int hold_task(int slot, union task_out_msg *msg, size_t size);
+void flush_stalled();
+void set_flush_timer(int enabled);
+void evict_client(int slot);
+void release_client(int slot);
+void reset_backlog(int slot);
+int requeue_expired(int owner, uint64_t now);
+void reclaim_clients();
+int client_vanished(int slot);
+int send_retried(int slot);
+void store_range_result(struct range_result *rres);
+void close_results();
 void remove_queue();
+void remove_stats();
+void sample_queues(struct stats_segment *stats);
 void sigint_handler(int signum);
+void alarm_handler(int signum);
 
-int clients[CLIENT_MAX];
-int available_client_slots = CLIENT_MAX;
+struct server_options options;
+struct client_table client_table;
+int *clients = NULL; // client queue id by slot
+int *client_batch_sizes = NULL;
+int *client_windows = NULL;
+int *client_pids = NULL;
+int slot_count = 0; // clients and shared task queue
+int pool_slot = -1; // slot of shared task queue, -1 - tasks are sent to clients
+struct client_backlog *backlogs = NULL;
+_Atomic int stalled_count = 0; // clients with held task, changed with stalled_lock
+pthread_mutex_t stalled_lock = PTHREAD_MUTEX_INITIALIZER;
+struct result_sink results;
+struct verdict_cache verdicts;
+volatile sig_atomic_t flush_due = 0;
+volatile sig_atomic_t close_due = 0;
 int queue_id = -1;
+struct task_source source;
+struct stats_segment *stats = NULL;
+struct timer_wheel deadlines;
+struct retry_queue retried; // tasks of vanished clients and those which missed deadline
+struct checkpoint checkpoint; // progress of scan source, kept when -o is given
+struct task_feed feed = {&source, &retried, &verdicts, &results, &checkpoint, &options, &stats};
 
 /*
  * Types of messages:
  * 1 - sending new client_id
  * 2 - sending new task
  * 3 - sending "server closed"
+ * 4 - sending new batch of tasks
+ * 5 - sending new range task
+ * 6 - sending new number to factorize
  */
 int main(int argc, char *argv[]) {
     atexit(remove_queue);
     struct sigaction act;
+    memset(&act, 0, sizeof(act));
     act.sa_handler = sigint_handler;
     sigaction(SIGINT, &act, NULL);
     sigaction(SIGTSTP, &act, NULL);
+    struct sigaction alarm_act;
+    memset(&alarm_act, 0, sizeof(alarm_act));
+    alarm_act.sa_handler = alarm_handler;
+    sigemptyset(&alarm_act.sa_mask);
+    sigaction(SIGALRM, &alarm_act, NULL);
 
-    char *args_help = "Enter pathname and id number.\n";
+    char *args_help = "Enter pathname and id number.\n" SERVER_OPTIONS_HELP;
     char *pathname;
     int proj_id;
     if (read_args(argc, argv, &pathname, &proj_id) != 0) {
         printf(args_help);
         return 1;
     }
-    srand(time(NULL));
+    int client_max = options.client_max;
+    if (verdict_cache_init(&verdicts) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    if (task_source_open(&source, &options.task_source) != 0) {
+        printf("Error while opening task source occurred.\n");
+        return 1;
+    }
+    timer_wheel_init(&deadlines);
+    if (retry_queue_init(&retried) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    int resumed = 0;
+    if (options.checkpoint_path != NULL) {
+        resumed = checkpoint_open(&checkpoint, options.checkpoint_path, &source, &retried,
+                                  options.range_size);
+        if (resumed == -1) {
+            printf("Error while opening checkpoint occurred.\n");
+            return 1;
+        }
+        if (checkpoint_finished(&checkpoint)) {
+            printf("All tasks done.\n");
+            return 0;
+        }
+        if (resumed)
+            printf("Resuming scan from checkpoint.\n");
+    }
+    // resumed server adds its results to those of the previous one
+    if (result_sink_open(&results, options.result_sink, options.result_path, resumed) != 0) {
+        printf("Error while opening result sink occurred.\n");
+        return 1;
+    }
+    atexit(close_results);
+    if (checkpoint_start_syncer(&checkpoint, &source, &results) != 0) {
+        printf("Error while starting checkpoint thread occurred.\n");
+        return 1;
+    }
 
     key_t queue_key = ftok(pathname, proj_id);
     if (queue_key == -1) {
@@ -53,119 +192,669 @@ int main(int argc, char *argv[]) {
         printf("Error while creating server queue occurred.\n");
         return 1;
     }
-    for (int i = 0; i < CLIENT_MAX; i++)
+    slot_count = options.pool_tasks > 0 ? client_max + 1 : client_max;
+    clients = malloc(slot_count * sizeof(int));
+    client_batch_sizes = malloc(slot_count * sizeof(int));
+    client_windows = malloc(slot_count * sizeof(int));
+    client_pids = malloc(slot_count * sizeof(int));
+    backlogs = calloc(slot_count, sizeof(struct client_backlog));
+    if (clients == NULL || client_batch_sizes == NULL || client_windows == NULL || client_pids == NULL
+        || backlogs == NULL || client_table_init(&client_table, client_max) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    for (int i = 0; i < slot_count; i++) {
         clients[i] = -1;
+        pthread_mutex_init(&backlogs[i].lock, NULL);
+        inflight_init(&backlogs[i].inflight, &deadlines, i);
+    }
+    if (options.stats_name != NULL) {
+        stats = stats_create(options.stats_name, slot_count);
+        if (stats == NULL) {
+            printf("Error while creating statistics segment occurred.\n");
+            return 1;
+        }
+        atexit(remove_stats);
+        if (stats_start_sampler(stats, sample_queues) != 0) {
+            printf("Error while starting statistics sampler occurred.\n");
+            return 1;
+        }
+    }
+
+    if (options.pool_tasks > 0 && open_pool() != 0) {
+        printf("Error while creating shared task queue occurred.\n");
+        return 1;
+    }
+    if (start_receivers() != 0) {
+        printf("Error while starting receiver threads occurred.\n");
+        return 1;
+    }
+    if (start_watchdog() != 0) {
+        printf("Error while starting watchdog thread occurred.\n");
+        return 1;
+    }
+    receive_messages(NULL);
+    pthread_exit(NULL);
+}
+
+/*
+ * Main thread is one of receivers, so only threads - 1 are started.
+ */
+int start_receivers() {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    for (int i = 1; i < options.threads; i++) {
+        if (pthread_create(&thread, &attr, receive_messages, NULL) != 0) {
+            pthread_attr_destroy(&attr);
+            return -1;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return 0;
+}
+
+/*
+ * Shared task queue is served as one more client slot, its window is the
+ * high-water mark. Every result returns one credit of it, whoever sent the
+ * result, so the queue is refilled as clients take tasks.
+ */
+int open_pool() {
+    pool_slot = client_table.size;
+    clients[pool_slot] = msgget(IPC_PRIVATE, S_IRUSR | S_IWUSR);
+    if (clients[pool_slot] == -1)
+        return -1;
+    client_batch_sizes[pool_slot] = 1;
+    client_windows[pool_slot] = options.pool_tasks;
+    client_pids[pool_slot] = getpid();
+    if (inflight_reserve(&backlogs[pool_slot].inflight, options.pool_tasks, options.range_size > 0 ? 0 : 1) != 0)
+        return -1;
+    stats_client_start(stats, pool_slot, STATS_POOL_CLIENT_ID);
+    batch_sizer_init(&backlogs[pool_slot].sizer, server_dispatch_limit(&options, client_batch_sizes[pool_slot]));
+    pthread_mutex_lock(&backlogs[pool_slot].lock);
+    backlogs[pool_slot].credits = options.pool_tasks;
+    int error = flush_backlog(pool_slot);
+    pthread_mutex_unlock(&backlogs[pool_slot].lock);
+    return error;
+}
+
+/*
+ * Watchdog leaves signals to receivers.
+ */
+int start_watchdog() {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    int error = pthread_create(&thread, &attr, watch_tasks, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    return error == 0 ? 0 : -1;
+}
+
+/*
+ * Once a second tasks which missed deadline and tasks of vanished clients
+ * are put to retry queue and sent to clients with free credits.
+ */
+void *watch_tasks(void *arg) {
+    while (1) {
+        sleep(1);
+        task_feed_expire(&feed, &deadlines, requeue_expired);
+        reclaim_clients();
+        task_feed_send_retried(&feed, slot_count, send_retried);
+    }
+}
 
+/*
+ * With negative type the lowest type is taken first, so lane of higher
+ * priority is emptied before the other one. Every client sends results of
+ * one type, so they keep their order and its "client closed" still comes
+ * last (other receivers can be handling them yet, see close_client).
+ * Results in control lane are taken in order of sending.
+ */
+void *receive_messages(void *arg) {
+    long receive_type = options.result_priority != CONTROL_LANE_PRIORITY ? -LANE_TYPE(CLIENT_CLOSED_TYPE, 0) : 0;
     void * message = malloc(MAX_MSG_SIZE + sizeof(long));
     if (message == NULL) {
         printf("Error while allocating memory occurred.\n");
-        return 1;
+        exit(1);
     }
-    struct int_msg new_int_msg;
-    struct client_result *cres;
-    int client_id;
     while (1) {
-        msgrcv(queue_id, message, MAX_MSG_SIZE, 0, 0);
-        switch (((struct default_msg *)message)->mtype) {
-            case 1: // client intro - queue id in message
-                client_id = get_next_client_id();
-                if (client_id == -1) {
-                    printf("Cannot accept next client.\n");
-                    new_int_msg.mtype = 1;
-                    new_int_msg.mtext.number = -1;
-                    msgsnd(((struct int_msg *)message)->mtext.number,
-                           (void*)&new_int_msg, sizeof(struct int_msg_mtext), 0);
-                    break;
-                }
-                clients[client_id] = ((struct int_msg *)message)->mtext.number;
-                new_int_msg.mtype = 1;
-                new_int_msg.mtext.number = client_id;
-                if(msgsnd(clients[client_id], (void*)&new_int_msg, sizeof(struct int_msg_mtext), 0) != 0) {
-                    printf("Error while accepting new client occurred.\n");
-                    clients[client_id] = -1;
-                    break;
-                }
-                available_client_slots--;
-                printf("Client %d connected.\n", client_id);
+        if (close_due) {
+            printf("Server closed.\n");
+            exit(0);
+        }
+        if (flush_due) {
+            flush_due = 0;
+            flush_stalled();
+        }
+        ssize_t size = msgrcv(queue_id, message, MAX_MSG_SIZE, receive_type, 0);
+        if (size == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EIDRM) // queue removed while server is closing
+                return NULL;
+            printf("Error while receiving message occurred.\n");
+            exit(1);
+        }
+        handle_message(message, size);
+    }
+}
+
+/*
+ * Types of client messages in every lane:
+ * 1 - client intro (queue id, requested batch size and window)
+ * 3 - client task result, returns one credit
+ * 4 - client factors of number, returns one credit
+ * 5 - client batch results, returns one credit
+ * 6 - client range results, returns one credit
+ * 7 - client closed
+ * Size of message is its size without mtype.
+ */
+void handle_message(void *message, size_t size) {
+    struct client_result *cres;
+    struct batch_result *bres;
+    struct range_result *rres;
+    struct factor_result *fres;
+    switch (((struct default_msg *)message)->mtype % LANE_TYPES) {
+        case 1: // client intro - queue id, requested batch size and window in message
+            if (size != sizeof(struct client_intro)) {
+                printf("Incorrect message. Ignoring.\n");
                 break;
-            case 2: // client is ready
-                client_id = ((struct int_msg *)message)->mtext.number;
-                if (client_id < 0 || client_id >= CLIENT_MAX || clients[client_id] == -1) {
-                    printf("Incorrect client_id in message. Ignoring.\n");
-                    break;
-                }
-                new_int_msg.mtype = 2;
-                new_int_msg.mtext.number = get_new_task();
-                if(msgsnd(clients[client_id], (void*)&new_int_msg, sizeof(struct int_msg_mtext), 0) != 0) {
-                    printf("Error while sending a new task to the client.\n");
-                    break;
-                }
+            }
+            accept_client(&((struct client_intro_msg *)message)->mtext);
+            break;
+        case 3: // client task results
+            cres = &((struct client_result_msg *)message)->mtext;
+            if (size != sizeof(struct client_result)) {
+                printf("Incorrect message. Ignoring.\n");
                 break;
-            case 3: // client task results
-                cres = &((struct client_result_msg *)message)->mtext;
-                char * result_msg = "Composite number";
-                if (cres->is_prime)
-                    result_msg = "Prime number";
-                printf("%s: %d (client: %d)\n", result_msg, cres->number, cres->client_id);
+            }
+            result_sink_put_number(&results, cres->number, cres->is_prime, cres->client_id);
+            verdict_cache_put(&verdicts, cres->number, cres->is_prime);
+            return_credit(cres->client_id, cres->number);
+            result_handled(cres->client_id);
+            break;
+        case 4: // client factors of number
+            fres = &((struct factor_result_msg *)message)->mtext;
+            if (size < FACTOR_RESULT_SIZE(0) || fres->count < 0 || fres->count > MAX_FACTORS
+                || size != FACTOR_RESULT_SIZE(fres->count)) {
+                printf("Incorrect message. Ignoring.\n");
+                break;
+            }
+            result_sink_put_factors(&results, fres->number, fres->factors, fres->count, fres->client_id);
+            return_credit(fres->client_id, fres->number);
+            result_handled(fres->client_id);
+            break;
+        case 5: // client batch results
+            bres = &((struct batch_result_msg *)message)->mtext;
+            if (size < BATCH_RESULT_SIZE(0) || bres->count <= 0 || bres->count > MAX_BATCH_SIZE
+                || size != BATCH_RESULT_SIZE(bres->count)) {
+                printf("Incorrect message. Ignoring.\n");
                 break;
-            case 4: // client closed
-                client_id = ((struct int_msg *)message)->mtext.number;
-                if (client_id < 0 || client_id >= CLIENT_MAX || clients[client_id] == -1) {
-                    printf("Incorrect client_id in message. Ignoring.\n");
-                    break;
-                }
-                clients[client_id] = -1;
-                available_client_slots++;
-                printf("Client %d exited.\n", client_id);
+            }
+            for (int i = 0; i < bres->count; i++) {
+                int is_prime = bres->is_prime[i / 8] & (1 << (i % 8));
+                result_sink_put_number(&results, bres->numbers[i], is_prime, bres->client_id);
+                verdict_cache_put(&verdicts, bres->numbers[i], is_prime);
+            }
+            return_credit(bres->client_id, bres->numbers[0]);
+            result_handled(bres->client_id);
+            break;
+        case 6: // client range results
+            rres = &((struct range_result_msg *)message)->mtext;
+            if (size < RANGE_RESULT_SIZE(0) || (rres->with_bitmap
+                && (rres->hi - rres->lo > MAX_BITMAP_RANGE_SIZE || size < RANGE_RESULT_SIZE(rres->hi - rres->lo)))) {
+                printf("Incorrect message. Ignoring.\n");
                 break;
+            }
+            store_range_result(rres);
+            return_credit(rres->client_id, rres->lo);
+            result_handled(rres->client_id);
+            break;
+        case CLIENT_CLOSED_TYPE: // client closed - number of its results in message
+            if (size != sizeof(struct client_closed)) {
+                printf("Incorrect message. Ignoring.\n");
+                break;
+            }
+            close_client(&((struct client_closed_msg *)message)->mtext);
+            break;
+    }
+}
+
+void accept_client(struct client_intro *intro) {
+    struct client_accept_msg accept_msg;
+    accept_msg.mtype = 1;
+    int client_id = client_table_alloc(&client_table);
+    if (client_id == -1) {
+        printf("Cannot accept next client.\n");
+        accept_msg.mtext.client_id = -1;
+        accept_msg.mtext.batch_size = 0;
+        accept_msg.mtext.window = 0;
+        accept_msg.mtext.task_queue_id = -1;
+        accept_msg.mtext.result_priority = 0;
+        msgsnd(intro->queue_id, (void*)&accept_msg, sizeof(struct client_accept), IPC_NOWAIT);
+        return;
+    }
+    int slot = client_table_slot(&client_table, client_id);
+    pthread_mutex_lock(&backlogs[slot].lock);
+    clients[slot] = intro->queue_id;
+    client_batch_sizes[slot] = intro->batch_size;
+    if (client_batch_sizes[slot] < 1)
+        client_batch_sizes[slot] = 1;
+    if (client_batch_sizes[slot] > MAX_BATCH_SIZE)
+        client_batch_sizes[slot] = MAX_BATCH_SIZE;
+    client_windows[slot] = intro->window;
+    if (client_windows[slot] < 1)
+        client_windows[slot] = 1;
+    if (client_windows[slot] > MAX_WINDOW)
+        client_windows[slot] = MAX_WINDOW;
+    client_pids[slot] = intro->pid;
+    if (inflight_reserve(&backlogs[slot].inflight, client_windows[slot],
+                         options.range_size > 0 ? 0 : client_batch_sizes[slot]) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        accept_msg.mtext.client_id = -1;
+        accept_msg.mtext.batch_size = 0;
+        accept_msg.mtext.window = 0;
+        accept_msg.mtext.task_queue_id = -1;
+        accept_msg.mtext.result_priority = 0;
+        msgsnd(intro->queue_id, (void*)&accept_msg, sizeof(struct client_accept), IPC_NOWAIT);
+        clients[slot] = -1;
+        client_table_release(&client_table, client_id);
+        pthread_mutex_unlock(&backlogs[slot].lock);
+        return;
+    }
+    accept_msg.mtext.client_id = client_id;
+    accept_msg.mtext.batch_size = client_batch_sizes[slot];
+    accept_msg.mtext.window = client_windows[slot];
+    accept_msg.mtext.task_queue_id = pool_slot != -1 ? clients[pool_slot] : -1;
+    // lanes of server queue are numbered like priorities of options
+    accept_msg.mtext.result_priority = options.result_priority - CONTROL_LANE_PRIORITY + CONTROL_PRIORITY;
+    if(msgsnd(clients[slot], (void*)&accept_msg, sizeof(struct client_accept), IPC_NOWAIT) != 0) {
+        printf("Error while accepting new client occurred.\n");
+        clients[slot] = -1;
+        client_table_release(&client_table, client_id);
+        pthread_mutex_unlock(&backlogs[slot].lock);
+        return;
+    }
+    printf("Client %d connected.\n", client_id);
+    stats_client_start(stats, slot, client_id);
+    batch_sizer_init(&backlogs[slot].sizer, server_dispatch_limit(&options, client_batch_sizes[slot]));
+    // whole window is filled at once, then every result brings one credit back,
+    // client which takes tasks from shared queue gets nothing
+    backlogs[slot].credits = pool_slot != -1 ? 0 : client_windows[slot];
+    if (flush_backlog(slot) != 0)
+        printf("Error while sending a new task to the client.\n");
+    pthread_mutex_unlock(&backlogs[slot].lock);
+}
+
+/*
+ * With more receivers results of client can still be handled by other
+ * threads when "client closed" comes. Its slot is released with the last
+ * of them, so tasks with result are not sent again. If some result never
+ * comes, slot is reclaimed like the one of vanished client.
+ */
+void close_client(struct client_closed *closed) {
+    int slot = client_table_slot(&client_table, closed->client_id);
+    if (slot != -1) {
+        pthread_mutex_lock(&backlogs[slot].lock);
+        // client could exit since its slot was found
+        if (client_table_slot(&client_table, closed->client_id) != slot) {
+            pthread_mutex_unlock(&backlogs[slot].lock);
+            slot = -1;
         }
     }
+    if (slot == -1) {
+        printf("Incorrect client_id in message. Ignoring.\n");
+        return;
+    }
+    if (backlogs[slot].results >= closed->results) {
+        release_client(slot);
+        printf("Client %d exited.\n", closed->client_id);
+    } else {
+        backlogs[slot].closing = 1;
+        backlogs[slot].results_sent = closed->results;
+    }
+    pthread_mutex_unlock(&backlogs[slot].lock);
+}
+
+void result_handled(int client_id) {
+    int slot = client_table_slot(&client_table, client_id);
+    if (slot == -1)
+        return;
+    pthread_mutex_lock(&backlogs[slot].lock);
+    if (client_table_slot(&client_table, client_id) == slot) {
+        backlogs[slot].results++;
+        if (backlogs[slot].closing && backlogs[slot].results >= backlogs[slot].results_sent) {
+            release_client(slot);
+            printf("Client %d exited.\n", client_id);
+        }
+    }
+    pthread_mutex_unlock(&backlogs[slot].lock);
 }
 
 int read_args(int argc, char *argv[], char **pathname, int *proj_id) {
-    if (argc != 3) {
+    if (parse_server_options(argc, argv, &options, MAX_RANGE_SIZE, MAX_BITMAP_RANGE_SIZE, MAX_SERVER_THREADS) != 0)
+        return 1;
+    if (argc - optind != 2) {
         printf("Incorrect number of arguments.\n");
         return 1;
     }
-    *pathname = argv[1];
-    int n = atoi(argv[2]);
+    *pathname = argv[optind];
+    int n = atoi(argv[optind + 1]);
     if (n <= 0) {
         printf("Incorrect id number. It should be > 0.\n");
         return 1;
     }
     *proj_id = n;
+    if (options.pool_tasks > INFLIGHT_MAX) {
+        printf("Shared task queue can hold at most %d tasks.\n", INFLIGHT_MAX);
+        return 1;
+    }
 
     return 0;
 }
 
-int get_next_client_id() {
-    if (available_client_slots == 0)
-        return -1;
-    else
-        for (int i = 0; i < CLIENT_MAX; i++)
-            if (clients[i] == -1)
-                return i;
-    return -1;
+size_t build_task(int slot, union task_out_msg *msg) {
+    if (options.range_size > 0)
+        return build_range_task(slot, &msg->range);
+    if (client_batch_sizes[slot] > 1 && !options.factorize)
+        return build_task_batch(slot, &msg->batch);
+    msg->task.mtype = options.factorize ? 6 : 2;
+    if (task_feed_next(&feed, &msg->task.mtext.number) != 0)
+        return 0;
+    return sizeof(struct task_mtext);
 }
 
-int get_new_task() {
-    return rand() % 1000;
+size_t build_task_batch(int slot, struct task_batch_msg *batch_msg) {
+    batch_msg->mtype = 4;
+    int count = 0;
+    int size = (int) server_dispatch_size(&options, &backlogs[slot].sizer, client_batch_sizes[slot]);
+    while (count < size && task_feed_next(&feed, &batch_msg->mtext.numbers[count]) == 0)
+        count++;
+    if (count == 0)
+        return 0;
+    batch_msg->mtext.count = count;
+    return TASK_BATCH_SIZE(count);
+}
+
+size_t build_range_task(int slot, struct range_task_msg *range_msg) {
+    range_msg->mtype = 5;
+    uint64_t size = server_dispatch_size(&options, &backlogs[slot].sizer, client_batch_sizes[slot]);
+    if (retry_queue_pop(&retried, &range_msg->mtext.lo, &range_msg->mtext.hi) != 0
+        && task_source_next_range(&source, size, &range_msg->mtext.lo, &range_msg->mtext.hi) != 0)
+        return 0;
+    range_msg->mtext.with_bitmap = options.range_bitmap;
+    return sizeof(struct range_task);
+}
+
+/*
+ * Results carry the same key as their tasks, so they can be matched.
+ */
+int track_task(int slot, union task_out_msg *msg) {
+    struct inflight_table *inflight = &backlogs[slot].inflight;
+    switch (msg->task.mtype) {
+        case 4: // batch of tasks
+            return task_feed_track(&feed, inflight, msg->batch.mtext.numbers, msg->batch.mtext.count);
+        case 5: // range task
+            return task_feed_track_range(&feed, inflight, msg->range.mtext.lo, msg->range.mtext.hi);
+        default: // single task
+            return task_feed_track(&feed, inflight, &msg->task.mtext.number, 1);
+    }
+}
+
+/*
+ * Every result returns one credit of client, so next task is sent right away.
+ * Results of clients that already exited are only printed. Key identifies
+ * task of the result in inflight table - late result of task which was sent
+ * again only returns credit.
+ */
+void return_credit(int client_id, uint64_t key) {
+    // task from shared queue could be taken by any client
+    int slot = pool_slot != -1 ? pool_slot : client_table_slot(&client_table, client_id);
+    if (slot == -1) {
+        printf("Incorrect client_id in message. Ignoring.\n");
+        return;
+    }
+    pthread_mutex_lock(&backlogs[slot].lock);
+    // client could exit since its slot was found
+    if (slot == pool_slot || client_table_slot(&client_table, client_id) == slot) {
+        struct inflight_task task;
+        int tracked = task_feed_result(&feed, &backlogs[slot].inflight, key, &task) == 0;
+        // repeated result does not make window bigger than the table
+        if (backlogs[slot].credits + backlogs[slot].inflight.count < backlogs[slot].inflight.capacity)
+            backlogs[slot].credits++;
+        if (tracked && options.target_ms > 0)
+            batch_sizer_update(&backlogs[slot].sizer, inflight_task_size(&task), stats_now() - task.sent_at,
+                               options.target_ms * 1000000ULL,
+                               server_dispatch_limit(&options, client_batch_sizes[slot]));
+        if (flush_backlog(slot) != 0)
+            printf("Error while sending a new task to the client.\n");
+        if (tracked)
+            task_feed_done(&feed, 1);
+    }
+    pthread_mutex_unlock(&backlogs[slot].lock);
+}
+
+/*
+ * Sends task for every credit of client without blocking. When client queue
+ * is full, the task is held and sending is retried by flush_stalled().
+ * Lock of the slot has to be held.
+ */
+int flush_backlog(int slot) {
+    static _Thread_local union task_out_msg msg;
+    struct client_backlog *backlog = &backlogs[slot];
+    if (backlog->closing) // client queue is gone
+        return 0;
+    if (backlog->held_size > 0) {
+        if (msgsnd(clients[slot], (void*)backlog->held, backlog->held_size, IPC_NOWAIT) != 0)
+            return errno == EAGAIN ? 0 : -1;
+        backlog->held_size = 0;
+        pthread_mutex_lock(&stalled_lock);
+        if (--stalled_count == 0)
+            set_flush_timer(0);
+        pthread_mutex_unlock(&stalled_lock);
+    }
+    while (backlog->credits > 0) {
+        task_feed_start(&feed);
+        size_t size = build_task(slot, &msg);
+        if (size == 0) { // task source exhausted
+            task_feed_done(&feed, 1);
+            break;
+        }
+        backlog->credits--;
+        if (track_task(slot, &msg) != 0) {
+            task_feed_done(&feed, 1);
+            return -1;
+        }
+        if (msgsnd(clients[slot], (void*)&msg, size, IPC_NOWAIT) != 0)
+            return errno == EAGAIN ? hold_task(slot, &msg, size) : -1;
+    }
+    return 0;
+}
+
+int hold_task(int slot, union task_out_msg *msg, size_t size) {
+    struct client_backlog *backlog = &backlogs[slot];
+    if (backlog->held == NULL) {
+        backlog->held = malloc(sizeof(union task_out_msg));
+        if (backlog->held == NULL)
+            return -1;
+    }
+    memcpy(backlog->held, msg, sizeof(long) + size);
+    backlog->held_size = size;
+    backlog->stuck_since = time(NULL);
+    pthread_mutex_lock(&stalled_lock);
+    if (stalled_count++ == 0)
+        set_flush_timer(1);
+    pthread_mutex_unlock(&stalled_lock);
+    return 0;
+}
+
+/*
+ * Retries sending to clients with full queue and evicts those which did not
+ * receive anything for CLIENT_STUCK_TIMEOUT seconds. Full shared task queue
+ * only waits for clients.
+ */
+void flush_stalled() {
+    time_t now = time(NULL);
+    for (int i = 0; i < slot_count && stalled_count > 0; i++) {
+        if (backlogs[i].held_size == 0)
+            continue;
+        pthread_mutex_lock(&backlogs[i].lock);
+        if (flush_backlog(i) != 0)
+            printf("Error while sending a new task to the client.\n");
+        if (backlogs[i].held_size > 0 && now - backlogs[i].stuck_since >= CLIENT_STUCK_TIMEOUT && i != pool_slot)
+            evict_client(i);
+        pthread_mutex_unlock(&backlogs[i].lock);
+    }
+}
+
+void set_flush_timer(int enabled) {
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = enabled ? FLUSH_INTERVAL_MS * 1000 : 0;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+void evict_client(int slot) {
+    int client_id = client_table_id(&client_table, slot);
+    release_client(slot);
+    printf("Client %d evicted, its queue was full for %d s.\n", client_id, CLIENT_STUCK_TIMEOUT);
+}
+
+/*
+ * Lock of the slot has to be held.
+ */
+void release_client(int slot) {
+    client_table_release(&client_table, client_table_id(&client_table, slot));
+    clients[slot] = -1;
+    reset_backlog(slot);
+}
+
+void reset_backlog(int slot) {
+    struct client_backlog *backlog = &backlogs[slot];
+    if (backlog->held_size > 0) {
+        pthread_mutex_lock(&stalled_lock);
+        if (--stalled_count == 0)
+            set_flush_timer(0);
+        pthread_mutex_unlock(&stalled_lock);
+    }
+    // tasks sent to client and held one are sent to other clients
+    task_feed_requeue_all(&feed, &backlog->inflight);
+    stats_client_end(stats, slot);
+    free(backlog->held);
+    backlog->held = NULL;
+    backlog->held_size = 0;
+    backlog->credits = 0;
+    backlog->results = 0;
+    backlog->closing = 0;
+}
+
+int requeue_expired(int owner, uint64_t now) {
+    int slot = INFLIGHT_OWNER_SLOT(owner);
+    pthread_mutex_lock(&backlogs[slot].lock);
+    int expired = task_feed_requeue_expired(&feed, &backlogs[slot].inflight, INFLIGHT_OWNER_INDEX(owner), now);
+    pthread_mutex_unlock(&backlogs[slot].lock);
+    return expired;
+}
+
+/*
+ * Client killed by a signal never says it closed, its slot is freed when
+ * its process or queue is gone.
+ */
+void reclaim_clients() {
+    for (int i = 0; i < client_table.size; i++) {
+        pthread_mutex_lock(&backlogs[i].lock);
+        if (clients[i] != -1 && client_vanished(i)) {
+            int client_id = client_table_id(&client_table, i);
+            release_client(i);
+            printf("Client %d vanished, its tasks are sent to other clients.\n", client_id);
+        }
+        pthread_mutex_unlock(&backlogs[i].lock);
+    }
+}
+
+int client_vanished(int slot) {
+    if (kill(client_pids[slot], 0) != 0 && errno == ESRCH)
+        return 1;
+    struct msqid_ds queue_stat;
+    return msgctl(clients[slot], IPC_STAT, &queue_stat) != 0 && (errno == EINVAL || errno == EIDRM);
+}
+
+int send_retried(int slot) {
+    pthread_mutex_lock(&backlogs[slot].lock);
+    int error = clients[slot] != -1 && backlogs[slot].credits > 0 ? flush_backlog(slot) : 0;
+    pthread_mutex_unlock(&backlogs[slot].lock);
+    return error;
+}
+
+void store_range_result(struct range_result *rres) {
+    if (!rres->with_bitmap) {
+        result_sink_put(&results, rres->lo, rres->hi, rres->count, rres->client_id);
+        return;
+    }
+    uint64_t size = rres->hi - rres->lo;
+    if (size > MAX_BITMAP_RANGE_SIZE)
+        size = MAX_BITMAP_RANGE_SIZE;
+    for (uint64_t i = 0; i < size; i++)
+        if (rres->bitmap[i / 8] & (1 << (i % 8)))
+            result_sink_put_number(&results, rres->lo + i, 1, rres->client_id);
+}
+
+void remove_stats() {
+    stats_remove(options.stats_name, stats);
+}
+
+/*
+ * Called by sampler thread, slot is locked only to read its queue - queue of
+ * client which has just left is reported at most once more.
+ */
+void sample_queues(struct stats_segment *stats) {
+    struct msqid_ds queue_stat;
+    if (msgctl(queue_id, IPC_STAT, &queue_stat) == 0)
+        atomic_store(&stats->queue_depth, queue_stat.msg_qnum);
+    for (int i = 0; i < slot_count; i++) {
+        pthread_mutex_lock(&backlogs[i].lock);
+        int client_queue_id = clients[i];
+        pthread_mutex_unlock(&backlogs[i].lock);
+        if (client_queue_id != -1 && msgctl(client_queue_id, IPC_STAT, &queue_stat) == 0)
+            atomic_store(&stats->clients[i].queue_depth, queue_stat.msg_qnum);
+    }
+    atomic_store(&stats->cache_hits, atomic_load(&verdicts.hits));
 }
 
 void remove_queue() {
-    if (queue_id != -1) { // send "server closed" to all clients
+    if (queue_id != -1 && clients != NULL) { // send "server closed" to all clients
         msgctl(queue_id, IPC_RMID, NULL);
         struct default_msg end_msg;
         end_msg.mtype = 3;
-        for (int i = 0; i < CLIENT_MAX; i++) {
+        for (int i = 0; i < client_table.size; i++) {
             if (clients[i] != -1) {
-                msgsnd(clients[i], (void *) &end_msg, sizeof(char), 0);
+                msgsnd(clients[i], (void *) &end_msg, sizeof(char), IPC_NOWAIT);
             }
         }
+        if (pool_slot != -1)
+            msgctl(clients[pool_slot], IPC_RMID, NULL);
     }
 }
 
+/*
+ * Server is closed by receiver thread, so no thread is stopped in the
+ * middle of putting result.
+ */
 void sigint_handler(int signum) {
-    printf("Server closed.\n");
-    exit(0);
+    close_due = 1;
+}
+
+void close_results() {
+    task_feed_close(&feed);
+}
+
+void alarm_handler(int signum) {
+    flush_due = 1;
 }
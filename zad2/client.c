@@ -8,25 +8,50 @@
 #include <unistd.h>
 #include <mqueue.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "messages.h"
+#include "prime.h"
+#include "sieve.h"
+#include "work_queue.h"
+#include "work_model.h"
 
-int read_args(int argc, char *argv[], char **queue_name);
+#define MAX_THREAD_COUNT 256
+
+int read_args(int argc, char *argv[], char **queue_name, int *batch_size, int *thread_count, int *window,
+              struct work_model *work);
+int start_workers();
+void *worker(void *arg);
 void remove_queue();
-void send_ready_msg();
-int is_prime(int num);
+void process_task(uint64_t number);
+void process_task_batch(struct task_batch *batch);
+void process_range_task(struct range_task *task);
+void process_factor_task(uint64_t number);
+void send_result(struct message *message, int type, size_t length);
+int send_message(mqd_t queue, struct message *message, int type, size_t length);
+int receive_message(mqd_t queue, struct message *message);
 void sigint_handler(int signum);
 
 mqd_t queue_id = -1;
 char queue_name[MAX_QUEUE_NAME_SIZE + 1] = "/client";
 mqd_t server_queue_id = -1;
 int client_id = -1;
+int batch_size = 1;
+int thread_count = 0;
+int window = 0;
+unsigned int result_priority = 0;
+_Atomic unsigned int results_sent = 0;
+struct work_queue tasks;
+struct work_model work;
 
 /*
  * Types of messages:
  * 1 - sending client queue id
- * 2 - sending "client ready"
  * 3 - sending task results
  * 4 - sending "client closed"
+ * 5 - sending batch task results
+ * 6 - sending range task results
+ * 7 - sending factors of number
  */
 int main(int argc, char *argv[]) {
     atexit(remove_queue);
@@ -36,18 +61,35 @@ int main(int argc, char *argv[]) {
     sigaction(SIGTSTP, &act, NULL);
 
     char *server_queue_name;
-    char *args_help = "Enter queue name (with preceding /).\n";
-    if (read_args(argc, argv, &server_queue_name) != 0) {
-        printf(args_help);
+    char *args_help = "Enter queue name (with preceding /) and optional batch size (1 - %d)"
+            " (options: -t number of worker threads, default - number of cores,"
+            " -w number of tasks in flight, default - 2 * number of threads,"
+            " -l simulated work after every task: none, sleep:ms or spin:ms, default - " WORK_MODEL_DEFAULT ").\n";
+    thread_count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count <= 0)
+        thread_count = 1;
+    if (thread_count > MAX_THREAD_COUNT)
+        thread_count = MAX_THREAD_COUNT;
+    work_model_parse(WORK_MODEL_DEFAULT, &work);
+    if (read_args(argc, argv, &server_queue_name, &batch_size, &thread_count, &window, &work) != 0) {
+        printf(args_help, MAX_BATCH_SIZE);
         return 1;
     }
+    if (window == 0)
+        window = 2 * thread_count < MAX_WINDOW ? 2 * thread_count : MAX_WINDOW;
 
     sprintf(queue_name + strlen(queue_name), "%d", getpid());
 
     struct mq_attr attr;
     attr.mq_flags = 0;
     attr.mq_maxmsg = MAX_MSG_NUM;
-    attr.mq_msgsize = MAX_MSG_SIZE;
+    // client queue only has to hold biggest message for granted batch size, which keeps
+    // it small enough for many clients to fit in RLIMIT_MSGQUEUE of one user
+    attr.mq_msgsize = sizeof(struct msg_header) + TASK_BATCH_SIZE(batch_size);
+    if (attr.mq_msgsize < sizeof(struct msg_header) + sizeof(struct client_accept))
+        attr.mq_msgsize = sizeof(struct msg_header) + sizeof(struct client_accept);
+    if (attr.mq_msgsize < sizeof(struct msg_header) + sizeof(struct range_task))
+        attr.mq_msgsize = sizeof(struct msg_header) + sizeof(struct range_task);
 
     queue_id = mq_open(queue_name, O_CREAT | O_RDONLY, S_IRUSR | S_IWUSR, &attr);
     if (queue_id == -1) {
@@ -66,24 +108,40 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    char message[MAX_MSG_SIZE];
-    message[0] = 1;
-    strcpy(message + 1, queue_name);
-    if(mq_send(server_queue_id, message, MAX_MSG_SIZE, 0) != 0) {
+    if (work_queue_init(&tasks, window, sizeof(struct message)) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    if (start_workers() != 0) {
+        printf("Error while starting worker threads occurred.\n");
+        return 1;
+    }
+
+    struct message message;
+    message.payload.intro.batch_size = batch_size;
+    message.payload.intro.window = window;
+    message.payload.intro.pid = getpid();
+    strcpy(message.payload.intro.queue_name, queue_name);
+    if(send_message(server_queue_id, &message, 1, CLIENT_INTRO_SIZE(strlen(queue_name))) != 0) {
         printf("Error while sending registration data to server.\n");
         return 1;
     }
 
-    int task_number;
+    // receive thread only passes tasks to workers, server keeps window tasks in flight
     while (1) {
-        if (mq_receive(queue_id, message, MAX_MSG_SIZE, NULL) == -1) {
-            printf("Error while receiving message occurred.\n");
-            sleep(1);
-            continue;
+        switch (receive_message(queue_id, &message)) {
+            case -1:
+                printf("Error while receiving message occurred.\n");
+                sleep(1);
+                continue;
+            case 1:
+                printf("Incorrect message. Ignoring.\n");
+                continue;
         }
-        switch ((int)message[0]) {
-            case 1: // server respond with client_id
-                sscanf(message + 1, "%d", &client_id);
+        switch (message.header.type) {
+            case 1: // server respond with client_id and granted batch size
+                client_id = message.payload.accept.client_id;
+                batch_size = message.payload.accept.batch_size;
                 if (client_id == -1) {
                     printf("Server refused client.\n");
                     mq_close(server_queue_id);
@@ -91,17 +149,14 @@ int main(int argc, char *argv[]) {
                     return 1;
                 }
                 printf("Client accepted.\n");
-                send_ready_msg();
+                window = message.payload.accept.window;
+                result_priority = message.payload.accept.result_priority;
                 break;
             case 2: // new server task
-                sscanf(message + 1, "%d", &task_number);
-                message[0] = 3;
-                sprintf(message + 1, "%d %d %d", client_id, task_number, is_prime(task_number));
-                sleep(2);
-                if(mq_send(server_queue_id, message, MAX_MSG_SIZE, 0) != 0) {
-                    printf("Error while sending client result to server.\n");
-                }
-                send_ready_msg();
+            case 4: // new batch of server tasks
+            case 5: // new server range task
+            case 6: // new number to factorize
+                work_queue_push(&tasks, &message);
                 break;
             case 3: // server closed
                 mq_close(server_queue_id);
@@ -112,58 +167,212 @@ int main(int argc, char *argv[]) {
     }
 }
 
-int read_args(int argc, char *argv[], char **queue_name) {
-    if (argc != 2) {
+int read_args(int argc, char *argv[], char **queue_name, int *batch_size, int *thread_count, int *window,
+              struct work_model *work) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:w:l:")) != -1) {
+        switch (opt) {
+            case 't':
+                *thread_count = atoi(optarg);
+                if (*thread_count <= 0 || *thread_count > MAX_THREAD_COUNT) {
+                    printf("Incorrect number of threads. It should be between 1 and %d.\n", MAX_THREAD_COUNT);
+                    return 1;
+                }
+                break;
+            case 'w':
+                *window = atoi(optarg);
+                if (*window <= 0 || *window > MAX_WINDOW) {
+                    printf("Incorrect window. It should be between 1 and %d.\n", MAX_WINDOW);
+                    return 1;
+                }
+                break;
+            case 'l':
+                if (work_model_parse(optarg, work) != 0) {
+                    printf("Incorrect work model. It should be none, sleep:ms or spin:ms.\n");
+                    return 1;
+                }
+                break;
+            default:
+                return 1;
+        }
+    }
+    if (argc - optind != 1 && argc - optind != 2) {
         printf("Incorrect number of arguments.\n");
         return 1;
     }
-    if (argv[1][0] != '/') {
+    char *name = argv[optind];
+    if (name[0] != '/') {
         printf("Queue name must start with / character.\n");
         return 1;
     }
-    if (strlen(argv[1]) == 1 || strlen(argv[1]) > MAX_QUEUE_NAME_SIZE) {
+    if (strlen(name) == 1 || strlen(name) > MAX_QUEUE_NAME_SIZE) {
         printf("Queue name must be longer than 1 and shorter than %d.\n", MAX_QUEUE_NAME_SIZE);
         return 1;
     }
-    for (int i = 1; argv[1][i] != '\0'; i++) {
-        if (argv[1][i] == '/') {
+    for (int i = 1; name[i] != '\0'; i++) {
+        if (name[i] == '/') {
             printf("Queue name must not contain / character (except / as a first char).\n");
             return 1;
         }
     }
-    *queue_name = argv[1];
+    *queue_name = name;
+    if (argc - optind == 2) {
+        int n = atoi(argv[optind + 1]);
+        if (n <= 0 || n > MAX_BATCH_SIZE) {
+            printf("Incorrect batch size.\n");
+            return 1;
+        }
+        *batch_size = n;
+    }
 
     return 0;
 }
 
+int start_workers() {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&thread, &attr, worker, NULL) != 0) {
+            pthread_attr_destroy(&attr);
+            return -1;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return 0;
+}
+
+/*
+ * Result sent by worker returns credit to server, which answers with next task.
+ */
+void *worker(void *arg) {
+    struct message *message = malloc(sizeof(struct message));
+    if (message == NULL) {
+        printf("Error while allocating memory occurred.\n");
+        return NULL;
+    }
+    while (1) {
+        work_queue_pop(&tasks, message);
+        switch (message->header.type) {
+            case 2: // single task
+                process_task(message->payload.task.number);
+                break;
+            case 4: // batch of tasks
+                process_task_batch(&message->payload.batch);
+                break;
+            case 5: // range task
+                process_range_task(&message->payload.range);
+                break;
+            case 6: // number to factorize
+                process_factor_task(message->payload.task.number);
+                break;
+        }
+    }
+}
+
 void remove_queue() {
     if (server_queue_id != -1) {
-        char message[MAX_MSG_SIZE];
-        message[0] = 4;
-        sprintf(message + 1, "%d", client_id);
-        mq_send(server_queue_id, message, MAX_MSG_SIZE, 0);
+        struct message message;
+        message.payload.closed.client_id = client_id;
+        message.payload.closed.results = atomic_load(&results_sent);
+        send_message(server_queue_id, &message, 4, sizeof(struct client_closed));
     }
     if (queue_id != -1)
         mq_close(queue_id);
     mq_unlink(queue_name);
 }
 
-void send_ready_msg() {
-    char message[MAX_MSG_SIZE];
-    message[0] = 2;
-    sprintf(message + 1, "%d", client_id);
-    if(mq_send(server_queue_id, message, MAX_MSG_SIZE, 0) != 0) {
-        printf("Error while sending 'client ready' state to server.\n");
+void process_task(uint64_t number) {
+    struct message result;
+    result.payload.result.client_id = client_id;
+    result.payload.result.number = number;
+    result.payload.result.is_prime = is_prime(number);
+    work_model_run(&work);
+    send_result(&result, 3, sizeof(struct client_result));
+}
+
+void process_task_batch(struct task_batch *batch) {
+    struct message result;
+    struct batch_result *bres = &result.payload.batch_result;
+    bres->client_id = client_id;
+    bres->count = batch->count;
+    if (bres->count > MAX_BATCH_SIZE)
+        bres->count = MAX_BATCH_SIZE;
+    for (int i = 0; i < bres->count; i++)
+        bres->numbers[i] = batch->numbers[i];
+    is_prime_batch(bres->numbers, bres->count, bres->is_prime);
+    work_model_run(&work);
+    send_result(&result, 5, BATCH_RESULT_SIZE(bres->count));
+}
+
+void process_range_task(struct range_task *task) {
+    struct message result;
+    struct range_result *rres = &result.payload.range_result;
+    rres->client_id = client_id;
+    rres->with_bitmap = task->with_bitmap;
+    rres->lo = task->lo;
+    rres->hi = task->hi;
+    uint64_t max_size = task->with_bitmap ? MAX_BITMAP_RANGE_SIZE : MAX_RANGE_SIZE;
+    if (rres->hi < rres->lo || rres->hi - rres->lo > max_size)
+        rres->hi = rres->lo + max_size;
+    // credit of task comes back only with its result, so task waits for memory
+    while (sieve_range(rres->lo, rres->hi, task->with_bitmap ? rres->bitmap : NULL, &rres->count) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        sleep(1);
     }
+    work_model_run(&work);
+    size_t length = RANGE_RESULT_SIZE(task->with_bitmap ? rres->hi - rres->lo : 0);
+    send_result(&result, 6, length);
 }
 
-int is_prime(int num) {
-    if (num <= 1) return 0;
-    if (num % 2 == 0) return 0;
-    for(int i = 3; i < num / 2; i+= 2)
-        if (num % i == 0)
-            return 0;
-    return 1;
+void process_factor_task(uint64_t number) {
+    struct message result;
+    struct factor_result *fres = &result.payload.factor_result;
+    fres->client_id = client_id;
+    fres->number = number;
+    fres->count = factorize(number, fres->factors);
+    work_model_run(&work);
+    send_result(&result, 7, FACTOR_RESULT_SIZE(fres->count));
+}
+
+/*
+ * Result is counted before it is sent, so "client closed" never tells server
+ * about less results than it gets.
+ */
+void send_result(struct message *message, int type, size_t length) {
+    atomic_fetch_add(&results_sent, 1);
+    if (send_message(server_queue_id, message, type, length) != 0) {
+        atomic_fetch_sub(&results_sent, 1);
+        printf("Error while sending client result to server.\n");
+    }
+}
+
+/*
+ * Intro messages go in control lane of server queue, results and
+ * "client closed" in lane granted by server.
+ */
+int send_message(mqd_t queue, struct message *message, int type, size_t length) {
+    message->header.version = PROTOCOL_VERSION;
+    message->header.type = type;
+    message->header.length = length;
+    message->header.reserved = 0;
+    unsigned int priority = type == 1 || type == 2 ? CONTROL_PRIORITY : result_priority;
+    return mq_send(queue, (char *) message, sizeof(struct msg_header) + length, priority);
+}
+
+/*
+ * Returns -1 if receiving failed and 1 if received message is malformed
+ * (wrong protocol version or length not matching the header).
+ */
+int receive_message(mqd_t queue, struct message *message) {
+    ssize_t size = mq_receive(queue, (char *) message, MAX_MSG_SIZE, NULL);
+    if (size == -1)
+        return -1;
+    if (size < sizeof(struct msg_header) || message->header.version != PROTOCOL_VERSION
+        || message->header.length != size - sizeof(struct msg_header))
+        return 1;
+    return 0;
 }
 
 void sigint_handler(int signum) {
@@ -1,8 +1,154 @@
 #ifndef ZAD2_MESSAGES_H
 #define ZAD2_MESSAGES_H
 
-#define MAX_MSG_SIZE 100
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROTOCOL_VERSION 6
+
 #define MAX_MSG_NUM 10
+// queue priority of intro messages, results and "client closed"
+// use priority granted by server (lower, the same or higher), so they keep
+// their order
+#define CONTROL_PRIORITY 1
 #define MAX_QUEUE_NAME_SIZE 100
+// biggest multiple of 8 for which batch_result fits in default msgsize_max (8192)
+#define MAX_BATCH_SIZE 1000
+// same for range_result with bitmap
+#define MAX_RANGE_BITMAP_BYTES 8000
+#define MAX_BITMAP_RANGE_SIZE (MAX_RANGE_BITMAP_BYTES * 8)
+#define MAX_RANGE_SIZE (1ULL << 32)
+// max number of tasks sent to one client and not answered yet
+#define MAX_WINDOW 64
+// prime factors of 64-bit number, counted with repetition
+#define MAX_FACTORS 64
+
+/*
+ * Every message starts with a fixed header followed by length bytes of
+ * payload. Only header and used part of payload are sent.
+ */
+struct msg_header {
+    uint8_t version;
+    uint8_t type;
+    uint16_t length;
+    uint32_t reserved; // keeps 64-bit payload fields aligned
+};
+
+struct int_payload {
+    int32_t number;
+};
+
+struct task_payload {
+    uint64_t number;
+};
+
+/*
+ * Only queue name with terminating '\0' is sent
+ * - use CLIENT_INTRO_SIZE(strlen(queue_name)) as payload length.
+ */
+struct client_intro {
+    int32_t batch_size; // requested number of tasks per dispatch
+    int32_t window;     // requested number of dispatches in flight
+    int32_t pid;        // lets server notice killed client
+    char queue_name[MAX_QUEUE_NAME_SIZE + 1];
+};
+
+struct client_accept {
+    int32_t client_id;
+    int32_t batch_size; // batch size granted by server
+    int32_t window;     // window granted by server
+    int32_t result_priority; // queue priority of results and "client closed"
+};
+
+/*
+ * Server releases client after it handles that many results, those can
+ * still be handled by other threads when "client closed" comes.
+ */
+struct client_closed {
+    int32_t client_id;
+    uint32_t results; // number of results sent by client
+};
+
+struct client_result {
+    int32_t client_id;
+    int32_t is_prime;
+    uint64_t number;
+};
+
+/*
+ * Only first count numbers are sent - use TASK_BATCH_SIZE(count)
+ * as payload length.
+ */
+struct task_batch {
+    int32_t count;
+    uint64_t numbers[MAX_BATCH_SIZE];
+};
+
+/*
+ * is_prime is a bitmap (bit i set - numbers[i] is prime). It is placed
+ * before numbers, so only first count numbers have to be sent
+ * - use BATCH_RESULT_SIZE(count) as payload length.
+ */
+struct batch_result {
+    int32_t client_id;
+    int32_t count;
+    uint8_t is_prime[MAX_BATCH_SIZE / 8];
+    uint64_t numbers[MAX_BATCH_SIZE];
+};
+
+struct range_task {
+    uint64_t lo;
+    uint64_t hi; // range is [lo, hi)
+    int32_t with_bitmap;
+};
+
+/*
+ * bitmap (bit i set - lo + i is prime) is filled only if task asked for it
+ * - use RANGE_RESULT_SIZE(with_bitmap ? hi - lo : 0) as payload length.
+ */
+struct range_result {
+    int32_t client_id;
+    int32_t with_bitmap;
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t count;
+    uint8_t bitmap[MAX_RANGE_BITMAP_BYTES];
+};
+
+/*
+ * Prime factors of number in ascending order, only first count are sent
+ * - use FACTOR_RESULT_SIZE(count) as payload length.
+ */
+struct factor_result {
+    int32_t client_id;
+    int32_t count;
+    uint64_t number;
+    uint64_t factors[MAX_FACTORS];
+};
+
+struct message {
+    struct msg_header header;
+    union {
+        struct int_payload int_msg;
+        struct task_payload task;
+        struct client_intro intro;
+        struct client_accept accept;
+        struct client_closed closed;
+        struct client_result result;
+        struct task_batch batch;
+        struct batch_result batch_result;
+        struct range_task range;
+        struct range_result range_result;
+        struct factor_result factor_result;
+    } payload;
+};
+
+#define CLIENT_INTRO_SIZE(name_length) (offsetof(struct client_intro, queue_name) + (name_length) + 1)
+#define TASK_BATCH_SIZE(count) (offsetof(struct task_batch, numbers) + (count) * sizeof(uint64_t))
+#define BATCH_RESULT_SIZE(count) (offsetof(struct batch_result, numbers) + (count) * sizeof(uint64_t))
+#define RANGE_RESULT_SIZE(range_size) (offsetof(struct range_result, bitmap) + ((range_size) + 7) / 8)
+#define FACTOR_RESULT_SIZE(count) (offsetof(struct factor_result, factors) + (count) * sizeof(uint64_t))
+
+#define MAX_MSG_SIZE sizeof(struct message)
 
 #endif //ZAD2_MESSAGES_H
@@ -7,174 +7,887 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "messages.h"
+#include "client_table.h"
+#include "options.h"
+#include "result_sink.h"
+#include "verdict_cache.h"
+#include "task_source.h"
+#include "inflight.h"
+#include "stats.h"
+#include "timer_wheel.h"
+#include "retry_queue.h"
+#include "batch_sizer.h"
+#include "checkpoint.h"
+#include "task_feed.h"
 
-#define CLIENT_MAX 3
+#define MAX_EVENTS 8
+// messages handled per wakeup, so signals and timer are not starved by busy queue
+#define MAX_BURST 64
+#define TIMER_INTERVAL_MS 1000
+// client which queue stays full that long is evicted
+#define CLIENT_STUCK_TIMEOUT 10
+// epoll data of client queue waiting for free space, other descriptors use fd
+#define CLIENT_EVENT (1ULL << 32)
+
+/*
+ * Tasks owed to client which queue was full. Task which did not fit is kept
+ * in held and sent before any new one. Backlog and other state of client
+ * slot are changed only with lock held, held_size is also read without it.
+ */
+struct client_backlog {
+    pthread_mutex_t lock;
+    int credits;
+    _Atomic size_t held_size; // message size of held task, 0 - no held task
+    struct message *held;
+    time_t stuck_since;
+    struct inflight_table inflight;
+    struct batch_sizer sizer;
+    unsigned int results; // results of client handled so far
+    int closing; // client closed before all its results were handled
+    unsigned int results_sent; // results client sent before it closed
+};
 
 int read_args(int argc, char *argv[], char **queue_name);
-int get_next_client_id();
-int get_new_task();
+int open_signal_fd();
+int open_timer_fd(int interval_ms);
+int watch_fd(int fd);
+int start_event_threads();
+void *run_event_loop(void *arg);
+void drain_queue();
+void handle_message(struct message *message);
+void accept_client(struct message *message);
+void close_client(struct client_closed *closed);
+void result_handled(int client_id);
+void on_timer();
+void raise_descriptor_limit(int client_max);
+void store_batch_result(struct batch_result *bres);
+size_t build_task(int slot, struct message *message);
+size_t build_task_batch(int slot, struct message *message);
+size_t build_range_task(int slot, struct message *message);
+int track_task(int slot, struct message *message);
+void return_credit(int client_id, uint64_t key);
+int flush_backlog(int slot);
+int hold_task(int slot, struct message *message, size_t size);
+void evict_stuck_clients();
+void evict_client(int slot);
+void release_client(int slot);
+void reset_backlog(int slot);
+int requeue_expired(int owner, uint64_t now);
+void reclaim_clients();
+int client_vanished(int slot);
+int send_retried(int slot);
+void store_range_result(struct range_result *rres);
+void close_results();
+size_t fill_header(struct message *message, int type, size_t length);
+int send_message(mqd_t queue, struct message *message, int type, size_t length);
+int receive_message(mqd_t queue, struct message *message);
 void remove_queue();
-void sigint_handler(int signum);
+void remove_stats();
+void sample_queues(struct stats_segment *stats);
 
-mqd_t clients[CLIENT_MAX];
-int available_client_slots = CLIENT_MAX;
+struct server_options options;
+struct result_sink results;
+struct verdict_cache verdicts;
+struct client_table client_table;
+mqd_t *clients = NULL; // client queue by slot
+int *client_batch_sizes = NULL;
+int *client_windows = NULL;
+int *client_pids = NULL;
+struct client_backlog *backlogs = NULL;
+_Atomic int stalled_count = 0; // clients with held task
 char * queue_name = NULL;
 mqd_t queue_id = -1;
+int epoll_fd = -1;
+int signal_fd = -1;
+int timer_fd = -1;
+struct task_source source;
+struct stats_segment *stats = NULL;
+struct timer_wheel deadlines;
+struct retry_queue retried; // tasks of vanished clients and those which missed deadline
+struct checkpoint checkpoint; // progress of scan source, kept when -o is given
+struct task_feed feed = {&source, &retried, &verdicts, &results, &checkpoint, &options, &stats};
 
 /*
  * Types of messages:
  * 1 - sending new client_id
  * 2 - sending new task
  * 3 - sending "server closed"
+ * 4 - sending new batch of tasks
+ * 5 - sending new range task
+ * 6 - sending new number to factorize
  */
 int main(int argc, char *argv[]) {
     atexit(remove_queue);
-    struct sigaction act;
-    act.sa_handler = sigint_handler;
-    sigaction(SIGINT, &act, NULL);
-    sigaction(SIGTSTP, &act, NULL);
 
-    char *args_help = "Enter queue name (with preceding /).\n";
+    char *args_help = "Enter queue name (with preceding /).\n" SERVER_OPTIONS_HELP;
     if (read_args(argc, argv, &queue_name) != 0) {
         printf(args_help);
         return 1;
     }
-    srand(time(NULL));
+    int client_max = options.client_max;
+    raise_descriptor_limit(client_max);
+    if (verdict_cache_init(&verdicts) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    if (task_source_open(&source, &options.task_source) != 0) {
+        printf("Error while opening task source occurred.\n");
+        return 1;
+    }
+    timer_wheel_init(&deadlines);
+    if (retry_queue_init(&retried) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    int resumed = 0;
+    if (options.checkpoint_path != NULL) {
+        resumed = checkpoint_open(&checkpoint, options.checkpoint_path, &source, &retried,
+                                  options.range_size);
+        if (resumed == -1) {
+            printf("Error while opening checkpoint occurred.\n");
+            return 1;
+        }
+        if (checkpoint_finished(&checkpoint)) {
+            printf("All tasks done.\n");
+            return 0;
+        }
+        if (resumed)
+            printf("Resuming scan from checkpoint.\n");
+    }
+    // resumed server adds its results to those of the previous one
+    if (result_sink_open(&results, options.result_sink, options.result_path, resumed) != 0) {
+        printf("Error while opening result sink occurred.\n");
+        return 1;
+    }
+    atexit(close_results);
+    if (checkpoint_start_syncer(&checkpoint, &source, &results) != 0) {
+        printf("Error while starting checkpoint thread occurred.\n");
+        return 1;
+    }
 
     struct mq_attr attr;
     attr.mq_flags = 0;
     attr.mq_maxmsg = MAX_MSG_NUM;
     attr.mq_msgsize = MAX_MSG_SIZE;
 
-    queue_id = mq_open(queue_name, O_CREAT | O_RDONLY, S_IRUSR | S_IWUSR, &attr);
+    queue_id = mq_open(queue_name, O_CREAT | O_RDONLY | O_NONBLOCK, S_IRUSR | S_IWUSR, &attr);
 
     if (queue_id == -1) {
         printf("Error while creating server queue occurred.\n");
         return 1;
     }
-    for (int i = 0; i < CLIENT_MAX; i++)
+    clients = malloc(client_max * sizeof(mqd_t));
+    client_batch_sizes = malloc(client_max * sizeof(int));
+    client_windows = malloc(client_max * sizeof(int));
+    client_pids = malloc(client_max * sizeof(int));
+    backlogs = calloc(client_max, sizeof(struct client_backlog));
+    if (clients == NULL || client_batch_sizes == NULL || client_windows == NULL || client_pids == NULL
+        || backlogs == NULL || client_table_init(&client_table, client_max) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    for (int i = 0; i < client_max; i++) {
         clients[i] = -1;
+        pthread_mutex_init(&backlogs[i].lock, NULL);
+        inflight_init(&backlogs[i].inflight, &deadlines, i);
+    }
+    if (options.stats_name != NULL) {
+        stats = stats_create(options.stats_name, client_max);
+        if (stats == NULL) {
+            printf("Error while creating statistics segment occurred.\n");
+            return 1;
+        }
+        atexit(remove_stats);
+        if (stats_start_sampler(stats, sample_queues) != 0) {
+            printf("Error while starting statistics sampler occurred.\n");
+            return 1;
+        }
+    }
+
+    epoll_fd = epoll_create1(0);
+    signal_fd = open_signal_fd();
+    timer_fd = open_timer_fd(TIMER_INTERVAL_MS);
+    if (epoll_fd == -1 || signal_fd == -1 || timer_fd == -1 || watch_fd(queue_id) != 0
+        || watch_fd(signal_fd) != 0 || watch_fd(timer_fd) != 0) {
+        printf("Error while setting up event loop occurred.\n");
+        return 1;
+    }
+    if (start_event_threads() != 0) {
+        printf("Error while starting event loop threads occurred.\n");
+        return 1;
+    }
+    run_event_loop(NULL);
+    return 1;
+}
 
-    char message[MAX_MSG_SIZE];
-    int client_id;
-    mqd_t client_queue_id;
-    int client_task_number;
-    int client_task_is_prime;
+/*
+ * All threads wait on the same epoll descriptor. Main thread is one of
+ * them, so only threads - 1 are started.
+ */
+int start_event_threads() {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    for (int i = 1; i < options.threads; i++) {
+        if (pthread_create(&thread, &attr, run_event_loop, NULL) != 0) {
+            pthread_attr_destroy(&attr);
+            return -1;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return 0;
+}
+
+void *run_event_loop(void *arg) {
+    struct epoll_event events[MAX_EVENTS];
     while (1) {
-        if (mq_receive(queue_id, message, MAX_MSG_SIZE, NULL) == -1) {
-            printf("Error while receiving message occurred.\n");
-            sleep(1);
-            continue;
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            printf("Error while waiting for events occurred.\n");
+            exit(1);
         }
-        switch ((int)message[0]) {
-            case 1: // client intro - queue name in message
-                client_id = get_next_client_id();
-                client_queue_id = mq_open(message + 1, O_WRONLY, 0, &attr);
-                if (client_queue_id == -1) {
-                    printf("Cannot open clients' queue.\n");
-                    break;
-                }
-                message[0] = 1;
-                if (client_id == -1) {
-                    printf("Cannot accept next client.\n");
-                    sprintf(message + 1, "%d", -1);
-                    mq_send(client_queue_id, message, MAX_MSG_SIZE, 0);
-                    mq_close(client_queue_id);
-                    break;
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.u64 & CLIENT_EVENT) {
+                int slot = (int) (events[i].data.u64 & ~CLIENT_EVENT);
+                pthread_mutex_lock(&backlogs[slot].lock);
+                if (flush_backlog(slot) != 0)
+                    printf("Error while sending a new task to the client.\n");
+                pthread_mutex_unlock(&backlogs[slot].lock);
+            } else if (events[i].data.u64 == queue_id) {
+                drain_queue();
+            } else if (events[i].data.u64 == signal_fd) {
+                struct signalfd_siginfo info;
+                if (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                    printf("Server closed.\n");
+                    exit(0);
                 }
+            } else if (events[i].data.u64 == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                    on_timer();
+            }
+        }
+    }
+}
 
-                sprintf(message + 1, "%d", client_id);
-                if(mq_send(client_queue_id, message, MAX_MSG_SIZE, 0) != 0) {
-                    printf("Error while accepting new client occurred.\n");
-                    mq_close(client_queue_id);
-                    break;
-                }
-                clients[client_id] = client_queue_id;
-                available_client_slots--;
-                printf("Client %d connected.\n", client_id);
+/*
+ * Types of client messages:
+ * 1 - client intro (queue name, pid, requested batch size and window)
+ * 3 - client task result, returns one credit
+ * 4 - client closed
+ * 5 - client batch results, returns one credit
+ * 6 - client range results, returns one credit
+ * 7 - client factors of number, returns one credit
+ */
+void handle_message(struct message *message) {
+    struct client_result *cres;
+    struct batch_result *bres;
+    struct range_result *rres;
+    struct factor_result *fres;
+    switch (message->header.type) {
+        case 1: // client intro - queue name, pid, requested batch size and window in message
+            accept_client(message);
+            break;
+        case 3: // client task results
+            cres = &message->payload.result;
+            if (message->header.length != sizeof(struct client_result)) {
+                printf("Incorrect message. Ignoring.\n");
                 break;
-            case 2: // client is ready
-                sscanf(message + 1, "%d", &client_id);
-                if (client_id < 0 || client_id >= CLIENT_MAX || clients[client_id] == -1) {
-                    printf("Incorrect client_id in message. Ignoring.\n");
-                    break;
-                }
-                message[0] = 2;
-                sprintf(message + 1, "%d", get_new_task());
-                if(mq_send(clients[client_id], message, MAX_MSG_SIZE, 0) != 0) {
-                    printf("Error while sending a new task to the client.\n");
-                    break;
-                }
+            }
+            result_sink_put_number(&results, cres->number, cres->is_prime, cres->client_id);
+            verdict_cache_put(&verdicts, cres->number, cres->is_prime);
+            return_credit(cres->client_id, cres->number);
+            result_handled(cres->client_id);
+            break;
+        case 4: // client closed - number of its results in message
+            if (message->header.length != sizeof(struct client_closed)) {
+                printf("Incorrect message. Ignoring.\n");
+                break;
+            }
+            close_client(&message->payload.closed);
+            break;
+        case 5: // client batch results
+            bres = &message->payload.batch_result;
+            if (message->header.length < BATCH_RESULT_SIZE(0) || bres->count <= 0 || bres->count > MAX_BATCH_SIZE
+                || message->header.length != BATCH_RESULT_SIZE(bres->count)) {
+                printf("Incorrect message. Ignoring.\n");
                 break;
-            case 3: // client task results
-                sscanf(message + 1, "%d %d %d", &client_id, &client_task_number, &client_task_is_prime);
-                char * result_msg = "Composite number";
-                if (client_task_is_prime)
-                    result_msg = "Prime number";
-                printf("%s: %d (client: %d)\n", result_msg, client_task_number, client_id);
+            }
+            store_batch_result(bres);
+            return_credit(bres->client_id, bres->numbers[0]);
+            result_handled(bres->client_id);
+            break;
+        case 6: // client range results
+            rres = &message->payload.range_result;
+            if (message->header.length < RANGE_RESULT_SIZE(0) || (rres->with_bitmap
+                && (rres->hi - rres->lo > MAX_BITMAP_RANGE_SIZE
+                    || message->header.length < RANGE_RESULT_SIZE(rres->hi - rres->lo)))) {
+                printf("Incorrect message. Ignoring.\n");
                 break;
-            case 4: // client closed
-                sscanf(message + 1, "%d", &client_id);
-                if (client_id < 0 || client_id >= CLIENT_MAX || clients[client_id] == -1) {
-                    printf("Incorrect client_id in message. Ignoring.\n");
-                    break;
-                }
-                mq_close(clients[client_id]);
-                clients[client_id] = -1;
-                available_client_slots++;
-                printf("Client %d exited.\n", client_id);
+            }
+            store_range_result(rres);
+            return_credit(rres->client_id, rres->lo);
+            result_handled(rres->client_id);
+            break;
+        case 7: // client factors of number
+            fres = &message->payload.factor_result;
+            if (message->header.length < FACTOR_RESULT_SIZE(0) || fres->count < 0 || fres->count > MAX_FACTORS
+                || message->header.length != FACTOR_RESULT_SIZE(fres->count)) {
+                printf("Incorrect message. Ignoring.\n");
                 break;
+            }
+            result_sink_put_factors(&results, fres->number, fres->factors, fres->count, fres->client_id);
+            return_credit(fres->client_id, fres->number);
+            result_handled(fres->client_id);
+            break;
+    }
+}
+
+void accept_client(struct message *message) {
+    struct client_intro *intro = &message->payload.intro;
+    if (message->header.length <= CLIENT_INTRO_SIZE(0)
+        || message->header.length > sizeof(struct client_intro)) {
+        printf("Incorrect client queue name. Ignoring.\n");
+        return;
+    }
+    intro->queue_name[message->header.length - CLIENT_INTRO_SIZE(0)] = '\0';
+    int client_batch_size = intro->batch_size;
+    if (client_batch_size < 1)
+        client_batch_size = 1;
+    if (client_batch_size > MAX_BATCH_SIZE)
+        client_batch_size = MAX_BATCH_SIZE;
+    int client_window = intro->window;
+    if (client_window < 1)
+        client_window = 1;
+    if (client_window > MAX_WINDOW)
+        client_window = MAX_WINDOW;
+    mqd_t client_queue_id = mq_open(intro->queue_name, O_WRONLY | O_NONBLOCK);
+    if (client_queue_id == -1) {
+        printf("Cannot open clients' queue.\n");
+        return;
+    }
+    int client_id = client_table_alloc(&client_table);
+    if (client_id == -1) {
+        printf("Cannot accept next client.\n");
+        message->payload.accept.client_id = -1;
+        message->payload.accept.batch_size = 0;
+        message->payload.accept.window = 0;
+        message->payload.accept.result_priority = 0;
+        send_message(client_queue_id, message, 1, sizeof(struct client_accept));
+        mq_close(client_queue_id);
+        return;
+    }
+
+    int slot = client_table_slot(&client_table, client_id);
+    pthread_mutex_lock(&backlogs[slot].lock);
+    if (inflight_reserve(&backlogs[slot].inflight, client_window,
+                         options.range_size > 0 ? 0 : client_batch_size) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        message->payload.accept.client_id = -1;
+        message->payload.accept.batch_size = 0;
+        message->payload.accept.window = 0;
+        message->payload.accept.result_priority = 0;
+        send_message(client_queue_id, message, 1, sizeof(struct client_accept));
+        mq_close(client_queue_id);
+        client_table_release(&client_table, client_id);
+        pthread_mutex_unlock(&backlogs[slot].lock);
+        return;
+    }
+    int client_pid = intro->pid;
+    message->payload.accept.client_id = client_id;
+    message->payload.accept.batch_size = client_batch_size;
+    message->payload.accept.window = client_window;
+    // queue priorities are numbered like priorities of options
+    message->payload.accept.result_priority = options.result_priority - CONTROL_LANE_PRIORITY + CONTROL_PRIORITY;
+    if(send_message(client_queue_id, message, 1, sizeof(struct client_accept)) != 0) {
+        printf("Error while accepting new client occurred.\n");
+        mq_close(client_queue_id);
+        client_table_release(&client_table, client_id);
+        pthread_mutex_unlock(&backlogs[slot].lock);
+        return;
+    }
+    clients[slot] = client_queue_id;
+    client_batch_sizes[slot] = client_batch_size;
+    client_windows[slot] = client_window;
+    client_pids[slot] = client_pid;
+    printf("Client %d connected.\n", client_id);
+    stats_client_start(stats, slot, client_id);
+    batch_sizer_init(&backlogs[slot].sizer, server_dispatch_limit(&options, client_batch_sizes[slot]));
+    // whole window is filled at once, then every result brings one credit back
+    backlogs[slot].credits = client_window;
+    if (flush_backlog(slot) != 0)
+        printf("Error while sending a new task to the client.\n");
+    pthread_mutex_unlock(&backlogs[slot].lock);
+}
+
+/*
+ * With more event threads results of client can still be handled by other
+ * threads when "client closed" comes. Its slot is released with the last
+ * of them, so tasks with result are not sent again. If some result never
+ * comes, slot is reclaimed like the one of vanished client.
+ */
+void close_client(struct client_closed *closed) {
+    int slot = client_table_slot(&client_table, closed->client_id);
+    if (slot != -1) {
+        pthread_mutex_lock(&backlogs[slot].lock);
+        // client could exit since its slot was found
+        if (client_table_slot(&client_table, closed->client_id) != slot) {
+            pthread_mutex_unlock(&backlogs[slot].lock);
+            slot = -1;
         }
     }
+    if (slot == -1) {
+        printf("Incorrect client_id in message. Ignoring.\n");
+        return;
+    }
+    if (backlogs[slot].results >= closed->results) {
+        release_client(slot);
+        printf("Client %d exited.\n", closed->client_id);
+    } else {
+        backlogs[slot].closing = 1;
+        backlogs[slot].results_sent = closed->results;
+    }
+    pthread_mutex_unlock(&backlogs[slot].lock);
+}
+
+void result_handled(int client_id) {
+    int slot = client_table_slot(&client_table, client_id);
+    if (slot == -1)
+        return;
+    pthread_mutex_lock(&backlogs[slot].lock);
+    if (client_table_slot(&client_table, client_id) == slot) {
+        backlogs[slot].results++;
+        if (backlogs[slot].closing && backlogs[slot].results >= backlogs[slot].results_sent) {
+            release_client(slot);
+            printf("Client %d exited.\n", client_id);
+        }
+    }
+    pthread_mutex_unlock(&backlogs[slot].lock);
 }
 
 int read_args(int argc, char *argv[], char **queue_name) {
-    if (argc != 2) {
+    if (parse_server_options(argc, argv, &options, MAX_RANGE_SIZE, MAX_BITMAP_RANGE_SIZE, MAX_SERVER_THREADS) != 0)
+        return 1;
+    if (argc - optind != 1) {
         printf("Incorrect number of arguments.\n");
         return 1;
     }
-    if (argv[1][0] != '/') {
+    if (options.pool_tasks > 0) {
+        printf("Shared task queue is supported only by SysV server.\n");
+        return 1;
+    }
+    char *name = argv[optind];
+    if (name[0] != '/') {
         printf("Queue name must start with / character.\n");
         return 1;
     }
-    if (strlen(argv[1]) == 1 || strlen(argv[1]) > MAX_QUEUE_NAME_SIZE) {
+    if (strlen(name) == 1 || strlen(name) > MAX_QUEUE_NAME_SIZE) {
         printf("Queue name must be longer than 1 and shorter than %d.\n", MAX_QUEUE_NAME_SIZE);
         return 1;
     }
-    for (int i = 1; argv[1][i] != '\0'; i++) {
-        if (argv[1][i] == '/') {
+    for (int i = 1; name[i] != '\0'; i++) {
+        if (name[i] == '/') {
             printf("Queue name must not contain / character (except / as a first char).\n");
             return 1;
         }
     }
-    *queue_name = argv[1];
+    *queue_name = name;
 
     return 0;
 }
 
-int get_next_client_id() {
-    if (available_client_slots == 0)
+/*
+ * SIGINT and SIGTSTP are blocked and read from descriptor in event loop.
+ */
+int open_signal_fd() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTSTP);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0)
         return -1;
-    else
-        for (int i = 0; i < CLIENT_MAX; i++)
-            if (clients[i] == -1)
-                return i;
-    return -1;
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
 }
 
-int get_new_task() {
-    return rand() % 1000;
+int open_timer_fd(int interval_ms) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = interval_ms / 1000;
+    spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(fd, 0, &spec, NULL) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int watch_fd(int fd) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/*
+ * Handles at most MAX_BURST messages. Queue is level-triggered, so epoll
+ * reports it again if anything is left.
+ */
+void drain_queue() {
+    static _Thread_local struct message message;
+    for (int i = 0; i < MAX_BURST; i++) {
+        switch (receive_message(queue_id, &message)) {
+            case -1:
+                if (errno != EAGAIN)
+                    printf("Error while receiving message occurred.\n");
+                return;
+            case 1:
+                printf("Incorrect message. Ignoring.\n");
+                continue;
+        }
+        handle_message(&message);
+    }
+}
+
+/*
+ * Periodic work, output is flushed, so it is not delayed by buffering when
+ * redirected to file. Tasks which missed deadline and tasks of vanished
+ * clients are sent to clients with free credits.
+ */
+void on_timer() {
+    if (stalled_count > 0)
+        evict_stuck_clients();
+    task_feed_expire(&feed, &deadlines, requeue_expired);
+    reclaim_clients();
+    task_feed_send_retried(&feed, client_table.size, send_retried);
+    fflush(stdout);
+}
+
+/*
+ * Every connected client keeps one open queue descriptor in server.
+ */
+void raise_descriptor_limit(int client_max) {
+    struct rlimit limit;
+    rlim_t needed = client_max + 16;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= needed)
+        return;
+    limit.rlim_cur = needed;
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < needed)
+        limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur < needed)
+        printf("Descriptor limit is too low for %d clients.\n", client_max);
+}
+
+void store_batch_result(struct batch_result *bres) {
+    for (int i = 0; i < bres->count && i < MAX_BATCH_SIZE; i++) {
+        int is_prime = bres->is_prime[i / 8] & (1 << (i % 8));
+        result_sink_put_number(&results, bres->numbers[i], is_prime, bres->client_id);
+        verdict_cache_put(&verdicts, bres->numbers[i], is_prime);
+    }
+}
+
+size_t build_task(int slot, struct message *message) {
+    if (options.range_size > 0)
+        return build_range_task(slot, message);
+    if (client_batch_sizes[slot] > 1 && !options.factorize)
+        return build_task_batch(slot, message);
+    if (task_feed_next(&feed, &message->payload.task.number) != 0)
+        return 0;
+    return fill_header(message, options.factorize ? 6 : 2, sizeof(struct task_payload));
+}
+
+size_t build_task_batch(int slot, struct message *message) {
+    struct task_batch *batch = &message->payload.batch;
+    int count = 0;
+    int size = (int) server_dispatch_size(&options, &backlogs[slot].sizer, client_batch_sizes[slot]);
+    while (count < size && task_feed_next(&feed, &batch->numbers[count]) == 0)
+        count++;
+    if (count == 0)
+        return 0;
+    batch->count = count;
+    return fill_header(message, 4, TASK_BATCH_SIZE(count));
+}
+
+size_t build_range_task(int slot, struct message *message) {
+    struct range_task *range = &message->payload.range;
+    uint64_t size = server_dispatch_size(&options, &backlogs[slot].sizer, client_batch_sizes[slot]);
+    if (retry_queue_pop(&retried, &range->lo, &range->hi) != 0
+        && task_source_next_range(&source, size, &range->lo, &range->hi) != 0)
+        return 0;
+    range->with_bitmap = options.range_bitmap;
+    return fill_header(message, 5, sizeof(struct range_task));
+}
+
+/*
+ * Results carry the same key as their tasks, so they can be matched.
+ */
+int track_task(int slot, struct message *message) {
+    struct inflight_table *inflight = &backlogs[slot].inflight;
+    switch (message->header.type) {
+        case 4: // batch of tasks
+            return task_feed_track(&feed, inflight, message->payload.batch.numbers, message->payload.batch.count);
+        case 5: // range task
+            return task_feed_track_range(&feed, inflight, message->payload.range.lo, message->payload.range.hi);
+        default: // single task
+            return task_feed_track(&feed, inflight, &message->payload.task.number, 1);
+    }
+}
+
+/*
+ * Every result returns one credit of client, so next task is sent right away.
+ * Results of clients that already exited are only printed. Key identifies
+ * task of the result in inflight table - late result of task which was sent
+ * again only returns credit.
+ */
+void return_credit(int client_id, uint64_t key) {
+    int slot = client_table_slot(&client_table, client_id);
+    if (slot == -1) {
+        printf("Incorrect client_id in message. Ignoring.\n");
+        return;
+    }
+    pthread_mutex_lock(&backlogs[slot].lock);
+    // client could exit since its slot was found
+    if (client_table_slot(&client_table, client_id) == slot) {
+        struct inflight_task task;
+        int tracked = task_feed_result(&feed, &backlogs[slot].inflight, key, &task) == 0;
+        // repeated result does not make window bigger than the table
+        if (backlogs[slot].credits + backlogs[slot].inflight.count < backlogs[slot].inflight.capacity)
+            backlogs[slot].credits++;
+        if (tracked && options.target_ms > 0)
+            batch_sizer_update(&backlogs[slot].sizer, inflight_task_size(&task), stats_now() - task.sent_at,
+                               options.target_ms * 1000000ULL,
+                               server_dispatch_limit(&options, client_batch_sizes[slot]));
+        if (flush_backlog(slot) != 0)
+            printf("Error while sending a new task to the client.\n");
+        if (tracked)
+            task_feed_done(&feed, 1);
+    }
+    pthread_mutex_unlock(&backlogs[slot].lock);
+}
+
+/*
+ * Sends task for every credit of client without blocking. When client queue
+ * is full, the task is held and client queue is watched by epoll until it
+ * has free space. Lock of the slot has to be held.
+ */
+int flush_backlog(int slot) {
+    static _Thread_local struct message message;
+    struct client_backlog *backlog = &backlogs[slot];
+    if (backlog->closing) // client queue is gone
+        return 0;
+    if (backlog->held_size > 0) {
+        if (mq_send(clients[slot], (char *) backlog->held, backlog->held_size, 0) != 0)
+            return errno == EAGAIN ? 0 : -1;
+        backlog->held_size = 0;
+        stalled_count--;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, clients[slot], NULL);
+    }
+    while (backlog->credits > 0) {
+        task_feed_start(&feed);
+        size_t size = build_task(slot, &message);
+        if (size == 0) { // task source exhausted
+            task_feed_done(&feed, 1);
+            break;
+        }
+        backlog->credits--;
+        if (track_task(slot, &message) != 0) {
+            task_feed_done(&feed, 1);
+            return -1;
+        }
+        if (mq_send(clients[slot], (char *) &message, size, 0) != 0)
+            return errno == EAGAIN ? hold_task(slot, &message, size) : -1;
+    }
+    return 0;
+}
+
+int hold_task(int slot, struct message *message, size_t size) {
+    struct client_backlog *backlog = &backlogs[slot];
+    if (backlog->held == NULL) {
+        backlog->held = malloc(sizeof(struct message));
+        if (backlog->held == NULL)
+            return -1;
+    }
+    memcpy(backlog->held, message, size);
+    backlog->held_size = size;
+    backlog->stuck_since = time(NULL);
+    stalled_count++;
+    struct epoll_event event;
+    event.events = EPOLLOUT;
+    event.data.u64 = CLIENT_EVENT | slot;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, clients[slot], &event);
+}
+
+/*
+ * Evicts clients which did not receive anything for CLIENT_STUCK_TIMEOUT seconds.
+ */
+void evict_stuck_clients() {
+    time_t now = time(NULL);
+    for (int i = 0; i < client_table.size; i++) {
+        if (backlogs[i].held_size == 0)
+            continue;
+        pthread_mutex_lock(&backlogs[i].lock);
+        if (backlogs[i].held_size > 0 && now - backlogs[i].stuck_since >= CLIENT_STUCK_TIMEOUT)
+            evict_client(i);
+        pthread_mutex_unlock(&backlogs[i].lock);
+    }
+}
+
+void evict_client(int slot) {
+    int client_id = client_table_id(&client_table, slot);
+    release_client(slot);
+    printf("Client %d evicted, its queue was full for %d s.\n", client_id, CLIENT_STUCK_TIMEOUT);
+}
+
+/*
+ * Lock of the slot has to be held.
+ */
+void release_client(int slot) {
+    client_table_release(&client_table, client_table_id(&client_table, slot));
+    reset_backlog(slot);
+    mq_close(clients[slot]);
+    clients[slot] = -1;
+}
+
+void reset_backlog(int slot) {
+    struct client_backlog *backlog = &backlogs[slot];
+    if (backlog->held_size > 0) {
+        stalled_count--;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, clients[slot], NULL);
+    }
+    // tasks sent to client and held one are sent to other clients
+    task_feed_requeue_all(&feed, &backlog->inflight);
+    stats_client_end(stats, slot);
+    free(backlog->held);
+    backlog->held = NULL;
+    backlog->held_size = 0;
+    backlog->credits = 0;
+    backlog->results = 0;
+    backlog->closing = 0;
+}
+
+int requeue_expired(int owner, uint64_t now) {
+    int slot = INFLIGHT_OWNER_SLOT(owner);
+    pthread_mutex_lock(&backlogs[slot].lock);
+    int expired = task_feed_requeue_expired(&feed, &backlogs[slot].inflight, INFLIGHT_OWNER_INDEX(owner), now);
+    pthread_mutex_unlock(&backlogs[slot].lock);
+    return expired;
+}
+
+/*
+ * Client killed by a signal never says it closed, its slot is freed when
+ * its process is gone.
+ */
+void reclaim_clients() {
+    for (int i = 0; i < client_table.size; i++) {
+        pthread_mutex_lock(&backlogs[i].lock);
+        if (clients[i] != -1 && client_vanished(i)) {
+            int client_id = client_table_id(&client_table, i);
+            release_client(i);
+            printf("Client %d vanished, its tasks are sent to other clients.\n", client_id);
+        }
+        pthread_mutex_unlock(&backlogs[i].lock);
+    }
+}
+
+int client_vanished(int slot) {
+    return kill(client_pids[slot], 0) != 0 && errno == ESRCH;
+}
+
+int send_retried(int slot) {
+    pthread_mutex_lock(&backlogs[slot].lock);
+    int error = clients[slot] != -1 && backlogs[slot].credits > 0 ? flush_backlog(slot) : 0;
+    pthread_mutex_unlock(&backlogs[slot].lock);
+    return error;
+}
+
+void store_range_result(struct range_result *rres) {
+    if (!rres->with_bitmap) {
+        result_sink_put(&results, rres->lo, rres->hi, rres->count, rres->client_id);
+        return;
+    }
+    uint64_t size = rres->hi - rres->lo;
+    if (size > MAX_BITMAP_RANGE_SIZE)
+        size = MAX_BITMAP_RANGE_SIZE;
+    for (uint64_t i = 0; i < size; i++)
+        if (rres->bitmap[i / 8] & (1 << (i % 8)))
+            result_sink_put_number(&results, rres->lo + i, 1, rres->client_id);
+}
+
+/*
+ * Returns size of whole message.
+ */
+size_t fill_header(struct message *message, int type, size_t length) {
+    message->header.version = PROTOCOL_VERSION;
+    message->header.type = type;
+    message->header.length = length;
+    message->header.reserved = 0;
+    return sizeof(struct msg_header) + length;
+}
+
+int send_message(mqd_t queue, struct message *message, int type, size_t length) {
+    return mq_send(queue, (char *) message, fill_header(message, type, length), 0);
+}
+
+/*
+ * Returns -1 if receiving failed and 1 if received message is malformed
+ * (wrong protocol version or length not matching the header).
+ */
+int receive_message(mqd_t queue, struct message *message) {
+    ssize_t size = mq_receive(queue, (char *) message, MAX_MSG_SIZE, NULL);
+    if (size == -1)
+        return -1;
+    if (size < sizeof(struct msg_header) || message->header.version != PROTOCOL_VERSION
+        || message->header.length != size - sizeof(struct msg_header))
+        return 1;
+    return 0;
+}
+
+void close_results() {
+    task_feed_close(&feed);
+}
+
+void remove_stats() {
+    stats_remove(options.stats_name, stats);
+}
+
+/*
+ * Called by sampler thread, slot is locked while its queue is read, so the
+ * queue is not closed meanwhile.
+ */
+void sample_queues(struct stats_segment *stats) {
+    struct mq_attr queue_attr;
+    if (mq_getattr(queue_id, &queue_attr) == 0)
+        atomic_store(&stats->queue_depth, queue_attr.mq_curmsgs);
+    for (int i = 0; i < client_table.size; i++) {
+        pthread_mutex_lock(&backlogs[i].lock);
+        if (clients[i] != -1 && mq_getattr(clients[i], &queue_attr) == 0)
+            atomic_store(&stats->clients[i].queue_depth, queue_attr.mq_curmsgs);
+        pthread_mutex_unlock(&backlogs[i].lock);
+    }
+    atomic_store(&stats->cache_hits, atomic_load(&verdicts.hits));
 }
 
 void remove_queue() {
-    if (queue_id != -1) { // send "server closed" to all clients
+    if (queue_id != -1 && clients != NULL) { // send "server closed" to all clients
         mq_close(queue_id);
-        char message[MAX_MSG_SIZE];
-        message[0] = 3;
-        for (int i = 0; i < CLIENT_MAX; i++) {
+        struct message message;
+        for (int i = 0; i < client_table.size; i++) {
             if (clients[i] != -1) {
-                mq_send(clients[i], message, MAX_MSG_SIZE, 0);
+                send_message(clients[i], &message, 3, 0);
                 mq_close(clients[i]);
             }
         }
@@ -183,8 +896,3 @@ void remove_queue() {
         mq_unlink(queue_name);
     }
 }
-
-void sigint_handler(int signum) {
-    printf("Server closed.\n");
-    exit(0);
-}
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include "messages.h"
+#include "ring.h"
+#include "segment.h"
+#include "prime.h"
+#include "sieve.h"
+#include "work_model.h"
+
+int read_args(int argc, char *argv[], char **shm_name, int *batch_size, int *window, struct work_model *work);
+void leave_server();
+void send_message(int type, uint64_t number, int value);
+void notify_server();
+void process_task_batch();
+void process_range_task(uint64_t lo, uint64_t size, int with_bitmap);
+void process_factor_task(uint64_t number);
+void sigint_handler(int signum);
+
+struct shm_segment *segment = NULL;
+size_t segment_size = 0;
+struct client_slot *slot = NULL;
+int slot_id = -1;
+int client_id = -1;
+int batch_size = 1;
+int window = 2;
+uint64_t tasks[MAX_BATCH_SIZE];
+int task_count = 0;
+struct work_model work;
+
+/*
+ * Types of messages (number, value):
+ * 1 - sending client intro (requested batch size, requested window)
+ * 3 - sending task results (tested number, is_prime | RESULT_LAST_IN_DISPATCH on last result of dispatch)
+ * 4 - sending "client closed" (client_id)
+ * 5 - sending range result (range start, prime count)
+ * 6 - sending part of bitmap of range from last range result (64 bits of bitmap, index of the part)
+ * 7 - sending end of bitmap of range from last range result (range start)
+ * 8 - sending prime factor of number from next end of factors (factor, index of the factor)
+ * 9 - sending end of factors (factorized number, factor count)
+ */
+int main(int argc, char *argv[]) {
+    atexit(leave_server);
+    struct sigaction act;
+    act.sa_handler = sigint_handler;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTSTP, &act, NULL);
+
+    char *shm_name;
+    char *args_help = "Enter shared memory segment name (with preceding /) and optional batch size (1 - %d)"
+            " (options: -w number of batches in flight, default 2,"
+            " -l simulated work after every task: none, sleep:ms or spin:ms, default - " WORK_MODEL_DEFAULT ").\n";
+    work_model_parse(WORK_MODEL_DEFAULT, &work);
+    if (read_args(argc, argv, &shm_name, &batch_size, &window, &work) != 0) {
+        printf(args_help, MAX_BATCH_SIZE);
+        return 1;
+    }
+
+    int fd = shm_open(shm_name, O_RDWR, 0);
+    if (fd == -1) {
+        printf("Error while opening server shared memory segment occurred.\n");
+        return 1;
+    }
+    struct stat shm_stat;
+    if (fstat(fd, &shm_stat) != 0 || shm_stat.st_size < sizeof(struct shm_segment)) {
+        printf("Incorrect server shared memory segment.\n");
+        close(fd);
+        return 1;
+    }
+    segment_size = shm_stat.st_size;
+    segment = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        segment = NULL;
+        printf("Error while mapping server shared memory segment occurred.\n");
+        return 1;
+    }
+    if (segment->magic != SHM_MAGIC || segment->version != SHM_VERSION
+        || segment_size < SEGMENT_SIZE(segment->client_max) || atomic_load(&segment->server_closed)) {
+        printf("Incorrect server shared memory segment.\n");
+        return 1;
+    }
+
+    slot_id = segment_claim_slot(segment);
+    if (slot_id == -1) {
+        printf("Server refused client.\n");
+        return 1;
+    }
+    slot = &segment->slots[slot_id];
+    slot->pid = getpid();
+    send_message(1, batch_size, window);
+    notify_server();
+
+    struct ring_msg msg;
+    while (1) {
+        ring_wait(&slot->tasks);
+        while (ring_pop(&slot->tasks, &msg) == 0) {
+            switch (msg.type) {
+                case 1: // server respond with client_id and granted batch size
+                    client_id = (int) msg.number;
+                    batch_size = msg.value;
+                    printf("Client accepted.\n");
+                    break;
+                case 2: // new server task, value is number of tasks left in batch
+                    if (task_count < MAX_BATCH_SIZE)
+                        tasks[task_count++] = msg.number;
+                    if (msg.value == 0)
+                        process_task_batch();
+                    break;
+                case 3: // server closed
+                    client_id = -1;
+                    printf("Server closed.\n");
+                    return 1;
+                case 4: // new server range task, only prime count is needed
+                case 5: // new server range task with bitmap
+                    process_range_task(msg.number, (uint32_t) msg.value, msg.type == 5);
+                    break;
+                case 6: // new number to factorize
+                    process_factor_task(msg.number);
+                    break;
+            }
+        }
+    }
+}
+
+int read_args(int argc, char *argv[], char **shm_name, int *batch_size, int *window, struct work_model *work) {
+    int opt;
+    while ((opt = getopt(argc, argv, "w:l:")) != -1) {
+        switch (opt) {
+            case 'w':
+                *window = atoi(optarg);
+                if (*window <= 0 || *window > MAX_WINDOW) {
+                    printf("Incorrect window. It should be between 1 and %d.\n", MAX_WINDOW);
+                    return 1;
+                }
+                break;
+            case 'l':
+                if (work_model_parse(optarg, work) != 0) {
+                    printf("Incorrect work model. It should be none, sleep:ms or spin:ms.\n");
+                    return 1;
+                }
+                break;
+            default:
+                return 1;
+        }
+    }
+    if (argc - optind != 1 && argc - optind != 2) {
+        printf("Incorrect number of arguments.\n");
+        return 1;
+    }
+    char *name = argv[optind];
+    if (name[0] != '/') {
+        printf("Segment name must start with / character.\n");
+        return 1;
+    }
+    if (strlen(name) == 1 || strlen(name) > MAX_QUEUE_NAME_SIZE) {
+        printf("Segment name must be longer than 1 and shorter than %d.\n", MAX_QUEUE_NAME_SIZE);
+        return 1;
+    }
+    for (int i = 1; name[i] != '\0'; i++) {
+        if (name[i] == '/') {
+            printf("Segment name must not contain / character (except / as a first char).\n");
+            return 1;
+        }
+    }
+    *shm_name = name;
+    if (argc - optind == 2) {
+        int n = atoi(argv[optind + 1]);
+        if (n <= 0 || n > MAX_BATCH_SIZE) {
+            printf("Incorrect batch size.\n");
+            return 1;
+        }
+        *batch_size = n;
+    }
+
+    return 0;
+}
+
+void leave_server() {
+    if (segment == NULL)
+        return;
+    if (slot_id != -1 && !atomic_load(&segment->server_closed)) {
+        // server releases the slot after handling all earlier messages
+        send_message(4, client_id, 0);
+        notify_server();
+    }
+    munmap(segment, segment_size);
+}
+
+/*
+ * Waits while results ring is full - server drains it in its loop.
+ */
+void send_message(int type, uint64_t number, int value) {
+    struct ring_msg msg;
+    msg.type = type;
+    msg.number = number;
+    msg.value = value;
+    while (ring_push(&slot->results, &msg) != 0) {
+        if (atomic_load(&segment->server_closed))
+            return;
+        notify_server();
+        sched_yield();
+    }
+}
+
+/*
+ * Marks client in pending bitmap and wakes server only if it sleeps.
+ */
+void notify_server() {
+    segment_mark_pending(segment, slot_id);
+    if (atomic_load(&segment->server_sleeping)) {
+        atomic_fetch_add(&segment->server_wake_seq, 1);
+        futex_wake(&segment->server_wake_seq);
+    }
+}
+
+void process_task_batch() {
+    static uint8_t results[MAX_BATCH_SIZE / 8];
+    is_prime_batch(tasks, task_count, results);
+    work_model_run(&work);
+    for (int i = 0; i < task_count; i++) {
+        int prime = results[i / 8] >> (i % 8) & 1;
+        send_message(3, tasks[i], prime | (i == task_count - 1 ? RESULT_LAST_IN_DISPATCH : 0));
+    }
+    task_count = 0;
+    notify_server();
+}
+
+/*
+ * Bitmap parts are sent after range result, so server knows which range
+ * they belong to. End of bitmap returns the credit then.
+ */
+void process_range_task(uint64_t lo, uint64_t size, int with_bitmap) {
+    static uint64_t bitmap[MAX_BITMAP_RANGE_SIZE / 64 + 1];
+    if (with_bitmap && size > MAX_BITMAP_RANGE_SIZE)
+        size = MAX_BITMAP_RANGE_SIZE;
+    if (size > UINT64_MAX - lo)
+        size = UINT64_MAX - lo;
+    uint64_t count;
+    // credit of task comes back only with its result, so task waits for memory
+    while (sieve_range(lo, lo + size, with_bitmap ? (uint8_t *) bitmap : NULL, &count) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        sleep(1);
+    }
+    work_model_run(&work);
+    send_message(5, lo, (int) count);
+    if (with_bitmap) {
+        for (int i = 0; i < (size + 63) / 64; i++)
+            if (bitmap[i] != 0)
+                send_message(6, bitmap[i], i);
+        send_message(7, lo, 0);
+    }
+    notify_server();
+}
+
+/*
+ * Factors go first, so server has all of them when end of factors returns
+ * the credit.
+ */
+void process_factor_task(uint64_t number) {
+    uint64_t factors[MAX_FACTORS];
+    int count = factorize(number, factors);
+    work_model_run(&work);
+    for (int i = 0; i < count; i++)
+        send_message(8, factors[i], i);
+    send_message(9, number, count);
+    notify_server();
+}
+
+void sigint_handler(int signum) {
+    printf("Client closed.\n");
+    exit(0);
+}
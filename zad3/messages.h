@@ -0,0 +1,85 @@
+#ifndef ZAD3_MESSAGES_H
+#define ZAD3_MESSAGES_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "client_table.h"
+
+#define SHM_MAGIC 0x7a616433
+#define SHM_VERSION 4
+#define MAX_QUEUE_NAME_SIZE 100
+#define MAX_BATCH_SIZE 1024
+// range size and prime count have to fit in value of ring_msg
+#define MAX_RANGE_SIZE INT32_MAX
+// bitmap is sent as 64-bit words, so it is not limited by message size
+#define MAX_BITMAP_RANGE_SIZE (1 << 20)
+// max number of dispatches sent to one client and not answered yet
+#define MAX_WINDOW 64
+// prime factors of 64-bit number, counted with repetition
+#define MAX_FACTORS 64
+
+// set in value of last task result of dispatch, returns one credit to server
+#define RESULT_LAST_IN_DISPATCH 2
+
+// power of 2, big enough for whole batch plus control messages
+#define RING_SIZE 2048
+
+#define CACHE_LINE 64
+
+/*
+ * Message passed through a ring. Meaning of number and value depends on type
+ * (see server.c and client.c), client_id is implied by the slot.
+ */
+struct ring_msg {
+    int32_t type;
+    int32_t value;
+    uint64_t number;
+};
+
+/*
+ * Lock-free single producer / single consumer ring. Consumer owns head,
+ * producer owns tail. Consumer sets sleeping before waiting on wake_seq
+ * futex, so producer has to make a syscall only when consumer is idle.
+ */
+struct ring {
+    _Alignas(CACHE_LINE) _Atomic uint32_t head;
+    _Alignas(CACHE_LINE) _Atomic uint32_t tail;
+    _Alignas(CACHE_LINE) _Atomic uint32_t sleeping;
+    _Atomic uint32_t wake_seq;
+    _Alignas(CACHE_LINE) struct ring_msg entries[RING_SIZE];
+};
+
+#define FREE_LIST_END UINT32_MAX
+
+struct client_slot {
+    _Atomic uint32_t next_free; // next slot on free list
+    uint32_t generation;        // changed by server on every release
+    int32_t pid;
+    struct ring tasks;   // server -> client
+    struct ring results; // client -> server
+};
+
+/*
+ * Shared memory segment with client_max slots. Free slots form a lock-free
+ * stack, free_head is ABA tag << 32 | slot.
+ *
+ * Client sets its bit in pending and then bit of that pending word in
+ * pending_summary after pushing to its results ring, and wakes server only
+ * if server_sleeping is set.
+ */
+struct shm_segment {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t client_max;
+    _Atomic uint32_t server_closed;
+    _Alignas(CACHE_LINE) _Atomic uint64_t free_head;
+    _Alignas(CACHE_LINE) _Atomic uint64_t pending_summary[CLIENT_TABLE_MAX / 64 / 64];
+    _Atomic uint64_t pending[CLIENT_TABLE_MAX / 64];
+    _Alignas(CACHE_LINE) _Atomic uint32_t server_sleeping;
+    _Atomic uint32_t server_wake_seq;
+    struct client_slot slots[];
+};
+
+#define SEGMENT_SIZE(client_max) (sizeof(struct shm_segment) + (client_max) * sizeof(struct client_slot))
+
+#endif //ZAD3_MESSAGES_H
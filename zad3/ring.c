@@ -0,0 +1,93 @@
+#include <unistd.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "ring.h"
+
+/*
+ * Returns 0 on success and -1 if ring is full.
+ */
+int ring_push(struct ring *ring, struct ring_msg *msg) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head == RING_SIZE)
+        return -1;
+    ring->entries[tail & (RING_SIZE - 1)] = *msg;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+/*
+ * Returns 0 on success and -1 if ring is empty.
+ */
+int ring_pop(struct ring *ring, struct ring_msg *msg) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail)
+        return -1;
+    *msg = ring->entries[head & (RING_SIZE - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 0;
+}
+
+int ring_empty(struct ring *ring) {
+    return atomic_load(&ring->head) == atomic_load(&ring->tail);
+}
+
+/*
+ * Snapshot for statistics, may be off when producer or consumer is working.
+ */
+uint32_t ring_count(struct ring *ring) {
+    return atomic_load(&ring->tail) - atomic_load(&ring->head);
+}
+
+/*
+ * Only when neither producer nor consumer uses the ring.
+ */
+void ring_reset(struct ring *ring) {
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    atomic_store(&ring->sleeping, 0);
+}
+
+/*
+ * Consumer side - blocks until there is something to pop.
+ */
+void ring_wait(struct ring *ring) {
+    for (int i = 0; i < SPIN_COUNT; i++)
+        if (!ring_empty(ring))
+            return;
+    while (ring_empty(ring)) {
+        uint32_t seq = atomic_load(&ring->wake_seq);
+        atomic_store(&ring->sleeping, 1);
+        if (ring_empty(ring))
+            futex_wait(&ring->wake_seq, seq);
+        atomic_store(&ring->sleeping, 0);
+    }
+}
+
+/*
+ * Producer side - call after pushing, makes a syscall only if consumer sleeps.
+ */
+void ring_wake(struct ring *ring) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&ring->sleeping)) {
+        atomic_fetch_add(&ring->wake_seq, 1);
+        futex_wake(&ring->wake_seq);
+    }
+}
+
+void futex_wait(_Atomic uint32_t *addr, uint32_t value) {
+    syscall(SYS_futex, addr, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+void futex_wait_timeout(_Atomic uint32_t *addr, uint32_t value, int timeout_ms) {
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    syscall(SYS_futex, addr, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+void futex_wake(_Atomic uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
@@ -0,0 +1,20 @@
+#ifndef ZAD3_RING_H
+#define ZAD3_RING_H
+
+#include "messages.h"
+
+// number of checks before consumer goes to sleep on futex
+#define SPIN_COUNT 1000
+
+int ring_push(struct ring *ring, struct ring_msg *msg);
+int ring_pop(struct ring *ring, struct ring_msg *msg);
+int ring_empty(struct ring *ring);
+uint32_t ring_count(struct ring *ring);
+void ring_reset(struct ring *ring);
+void ring_wait(struct ring *ring);
+void ring_wake(struct ring *ring);
+void futex_wait(_Atomic uint32_t *addr, uint32_t value);
+void futex_wait_timeout(_Atomic uint32_t *addr, uint32_t value, int timeout_ms);
+void futex_wake(_Atomic uint32_t *addr);
+
+#endif //ZAD3_RING_H
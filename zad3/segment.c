@@ -0,0 +1,38 @@
+#include "segment.h"
+
+void segment_init_slots(struct shm_segment *segment) {
+    for (uint32_t i = 0; i < segment->client_max; i++)
+        atomic_store(&segment->slots[i].next_free, i + 1 < segment->client_max ? i + 1 : FREE_LIST_END);
+    atomic_store(&segment->free_head, 0);
+}
+
+/*
+ * Pops slot from free list. Returns -1 if there is no free slot.
+ */
+int segment_claim_slot(struct shm_segment *segment) {
+    uint64_t head = atomic_load(&segment->free_head);
+    while (1) {
+        uint32_t slot = (uint32_t) head;
+        if (slot == FREE_LIST_END)
+            return -1;
+        uint32_t next = atomic_load(&segment->slots[slot].next_free);
+        uint64_t new_head = ((head >> 32) + 1) << 32 | next;
+        if (atomic_compare_exchange_weak(&segment->free_head, &head, new_head))
+            return slot;
+    }
+}
+
+void segment_release_slot(struct shm_segment *segment, int slot) {
+    uint64_t head = atomic_load(&segment->free_head);
+    uint64_t new_head;
+    do {
+        atomic_store(&segment->slots[slot].next_free, (uint32_t) head);
+        new_head = ((head >> 32) + 1) << 32 | (uint32_t) slot;
+    } while (!atomic_compare_exchange_weak(&segment->free_head, &head, new_head));
+}
+
+void segment_mark_pending(struct shm_segment *segment, int slot) {
+    int word = slot / 64;
+    atomic_fetch_or(&segment->pending[word], 1ULL << (slot % 64));
+    atomic_fetch_or(&segment->pending_summary[word / 64], 1ULL << (word % 64));
+}
@@ -0,0 +1,11 @@
+#ifndef ZAD3_SEGMENT_H
+#define ZAD3_SEGMENT_H
+
+#include "messages.h"
+
+void segment_init_slots(struct shm_segment *segment);
+int segment_claim_slot(struct shm_segment *segment);
+void segment_release_slot(struct shm_segment *segment, int slot);
+void segment_mark_pending(struct shm_segment *segment, int slot);
+
+#endif //ZAD3_SEGMENT_H
@@ -0,0 +1,646 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <inttypes.h>
+#include "messages.h"
+#include "ring.h"
+#include "segment.h"
+#include "options.h"
+#include "result_sink.h"
+#include "verdict_cache.h"
+#include "task_source.h"
+#include "inflight.h"
+#include "stats.h"
+#include "timer_wheel.h"
+#include "retry_queue.h"
+#include "batch_sizer.h"
+#include "checkpoint.h"
+#include "task_feed.h"
+
+// how long server sleeps without messages before checking task deadlines
+#define WATCH_INTERVAL_MS 1000
+
+int read_args(int argc, char *argv[], char **shm_name);
+int process_pending();
+void handle_message(int slot, struct ring_msg *msg);
+int has_pending();
+void wait_for_clients();
+int send_task(int slot);
+int send_task_batch(int slot);
+int send_range_task(int slot);
+int send_factor_task(int slot);
+int untrack_task(int slot, uint64_t key);
+void task_result(int slot, uint64_t key);
+void store_range_word(int slot, uint64_t word, int index);
+void release_client(int slot);
+void watch_tasks();
+int requeue_expired(int owner, uint64_t now);
+void reclaim_clients();
+int send_retried(int slot);
+void close_results();
+void remove_segment();
+void remove_stats();
+void sample_rings(struct stats_segment *stats);
+void sigint_handler(int signum);
+
+struct server_options options;
+struct result_sink results;
+struct verdict_cache verdicts;
+volatile sig_atomic_t close_due = 0;
+int *clients = NULL; // 1 - slot used by connected client
+int *client_batch_sizes = NULL;
+char * shm_name = NULL;
+struct shm_segment *segment = NULL;
+size_t segment_size = 0;
+uint64_t *client_range_los = NULL; // range which bitmap is being received from client
+uint64_t *client_range_sizes = NULL;
+uint64_t *client_factors = NULL; // MAX_FACTORS by slot, factors being received from client
+int *client_factor_counts = NULL;
+uint64_t *client_batch_keys = NULL; // first number of batch which results are being received from client
+int *client_batch_results = NULL;
+int *client_credits = NULL; // dispatches client can take before next result
+struct task_source source;
+struct inflight_table *inflight = NULL; // by slot
+struct batch_sizer *sizers = NULL; // by slot, used with -a
+struct stats_segment *stats = NULL;
+struct timer_wheel deadlines;
+struct retry_queue retried; // tasks of vanished clients and those which missed deadline
+struct checkpoint checkpoint; // progress of scan source, kept when -o is given
+struct task_feed feed = {&source, &retried, &verdicts, &results, &checkpoint, &options, &stats};
+
+/*
+ * Types of messages (number, value):
+ * 1 - sending new client_id (client_id, granted batch size)
+ * 2 - sending new task (number to test, tasks left in batch)
+ * 3 - sending "server closed"
+ * 4 - sending new range task, prime count is expected (range start, range size)
+ * 5 - sending new range task, prime bitmap is expected (range start, range size)
+ * 6 - sending new number to factorize (number, 0)
+ */
+int main(int argc, char *argv[]) {
+    atexit(remove_segment);
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = sigint_handler;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTSTP, &act, NULL);
+
+    char *args_help = "Enter shared memory segment name (with preceding /).\n" SERVER_OPTIONS_HELP;
+    if (read_args(argc, argv, &shm_name) != 0) {
+        printf(args_help);
+        return 1;
+    }
+    int client_max = options.client_max;
+    if (verdict_cache_init(&verdicts) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    if (task_source_open(&source, &options.task_source) != 0) {
+        printf("Error while opening task source occurred.\n");
+        return 1;
+    }
+    timer_wheel_init(&deadlines);
+    if (retry_queue_init(&retried) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    int resumed = 0;
+    if (options.checkpoint_path != NULL) {
+        resumed = checkpoint_open(&checkpoint, options.checkpoint_path, &source, &retried,
+                                  options.range_size);
+        if (resumed == -1) {
+            printf("Error while opening checkpoint occurred.\n");
+            return 1;
+        }
+        if (checkpoint_finished(&checkpoint)) {
+            printf("All tasks done.\n");
+            return 0;
+        }
+        if (resumed)
+            printf("Resuming scan from checkpoint.\n");
+    }
+    // resumed server adds its results to those of the previous one
+    if (result_sink_open(&results, options.result_sink, options.result_path, resumed) != 0) {
+        printf("Error while opening result sink occurred.\n");
+        return 1;
+    }
+    atexit(close_results);
+    if (checkpoint_start_syncer(&checkpoint, &source, &results) != 0) {
+        printf("Error while starting checkpoint thread occurred.\n");
+        return 1;
+    }
+
+    int fd = shm_open(shm_name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        printf("Error while creating shared memory segment occurred.\n");
+        shm_name = NULL;
+        return 1;
+    }
+    // truncating to 0 first zeroes segment left by previous server, untouched pages stay unallocated
+    segment_size = SEGMENT_SIZE(client_max);
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, segment_size) != 0) {
+        printf("Error while creating shared memory segment occurred.\n");
+        close(fd);
+        return 1;
+    }
+    segment = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        printf("Error while mapping shared memory segment occurred.\n");
+        segment = NULL;
+        return 1;
+    }
+    segment->version = SHM_VERSION;
+    segment->client_max = client_max;
+    segment_init_slots(segment);
+    atomic_thread_fence(memory_order_release);
+    segment->magic = SHM_MAGIC;
+
+    clients = calloc(client_max, sizeof(int));
+    client_batch_sizes = calloc(client_max, sizeof(int));
+    client_range_los = calloc(client_max, sizeof(uint64_t));
+    client_range_sizes = calloc(client_max, sizeof(uint64_t));
+    client_factors = calloc((size_t) client_max * MAX_FACTORS, sizeof(uint64_t));
+    client_factor_counts = calloc(client_max, sizeof(int));
+    client_batch_keys = calloc(client_max, sizeof(uint64_t));
+    client_batch_results = calloc(client_max, sizeof(int));
+    client_credits = calloc(client_max, sizeof(int));
+    inflight = calloc(client_max, sizeof(struct inflight_table));
+    sizers = calloc(client_max, sizeof(struct batch_sizer));
+    if (clients == NULL || client_batch_sizes == NULL || client_range_los == NULL || client_range_sizes == NULL
+        || client_factors == NULL || client_factor_counts == NULL || client_batch_keys == NULL
+        || client_batch_results == NULL || client_credits == NULL || inflight == NULL || sizers == NULL) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    for (int i = 0; i < client_max; i++)
+        inflight_init(&inflight[i], &deadlines, i);
+    if (options.stats_name != NULL) {
+        stats = stats_create(options.stats_name, client_max);
+        if (stats == NULL) {
+            printf("Error while creating statistics segment occurred.\n");
+            return 1;
+        }
+        atexit(remove_stats);
+        if (stats_start_sampler(stats, sample_rings) != 0) {
+            printf("Error while starting statistics sampler occurred.\n");
+            return 1;
+        }
+    }
+
+    uint64_t watched_at = timer_wheel_now();
+    while (!close_due) {
+        if (process_pending() == 0)
+            wait_for_clients();
+        if (timer_wheel_now() != watched_at) {
+            watched_at = timer_wheel_now();
+            watch_tasks();
+        }
+    }
+    printf("Server closed.\n");
+    return 0;
+}
+
+int read_args(int argc, char *argv[], char **shm_name) {
+    if (parse_server_options(argc, argv, &options, MAX_RANGE_SIZE, MAX_BITMAP_RANGE_SIZE, 1) != 0)
+        return 1;
+    if (argc - optind != 1) {
+        printf("Incorrect number of arguments.\n");
+        return 1;
+    }
+    if (options.pool_tasks > 0) {
+        printf("Shared task queue is supported only by SysV server.\n");
+        return 1;
+    }
+    char *name = argv[optind];
+    if (name[0] != '/') {
+        printf("Segment name must start with / character.\n");
+        return 1;
+    }
+    if (strlen(name) == 1 || strlen(name) > MAX_QUEUE_NAME_SIZE) {
+        printf("Segment name must be longer than 1 and shorter than %d.\n", MAX_QUEUE_NAME_SIZE);
+        return 1;
+    }
+    for (int i = 1; name[i] != '\0'; i++) {
+        if (name[i] == '/') {
+            printf("Segment name must not contain / character (except / as a first char).\n");
+            return 1;
+        }
+    }
+    *shm_name = name;
+
+    return 0;
+}
+
+/*
+ * Drains results rings of all clients marked in pending bitmap.
+ * Returns number of handled messages.
+ */
+int process_pending() {
+    int handled = 0;
+    struct ring_msg msg;
+    int words = (segment->client_max + 63) / 64;
+    for (int i = 0; i < (words + 63) / 64; i++) {
+        uint64_t summary = atomic_exchange(&segment->pending_summary[i], 0);
+        while (summary != 0) {
+            int word = i * 64 + __builtin_ctzll(summary);
+            summary &= summary - 1;
+            uint64_t bits = atomic_exchange(&segment->pending[word], 0);
+            while (bits != 0) {
+                int slot = word * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                while (ring_pop(&segment->slots[slot].results, &msg) == 0) {
+                    handle_message(slot, &msg);
+                    handled++;
+                }
+            }
+        }
+    }
+    return handled;
+}
+
+/*
+ * Types of client messages (number, value):
+ * 1 - client intro (requested batch size, requested window)
+ * 3 - client task result (tested number, is_prime | RESULT_LAST_IN_DISPATCH on last result of dispatch)
+ * 4 - client closed (client_id, -1 if client was not accepted yet)
+ * 5 - client range result (range start, prime count), returns one credit if bitmap was not requested
+ * 6 - part of bitmap of range from last range result (64 bits of bitmap, index of the part)
+ * 7 - end of bitmap of range from last range result (range start), returns one credit
+ * 8 - prime factor of number from next end of factors (factor, index of the factor)
+ * 9 - end of factors (factorized number, factor count), returns one credit
+ */
+void handle_message(int slot, struct ring_msg *msg) {
+    struct client_slot *client = &segment->slots[slot];
+    int client_id = client->generation << CLIENT_SLOT_BITS | slot;
+    struct ring_msg reply;
+    int window;
+    switch (msg->type) {
+        case 1: // client intro - requested batch size and window in message
+            client_batch_sizes[slot] = (int) msg->number;
+            if (client_batch_sizes[slot] < 1)
+                client_batch_sizes[slot] = 1;
+            if (client_batch_sizes[slot] > MAX_BATCH_SIZE)
+                client_batch_sizes[slot] = MAX_BATCH_SIZE;
+            // all tasks in flight have to fit in tasks ring with accept and "server closed"
+            window = msg->value;
+            if (window > MAX_WINDOW)
+                window = MAX_WINDOW;
+            if (window > (RING_SIZE - 2) / client_batch_sizes[slot])
+                window = (RING_SIZE - 2) / client_batch_sizes[slot];
+            if (window < 1)
+                window = 1;
+            reply.type = 1;
+            reply.number = client_id;
+            reply.value = client_batch_sizes[slot];
+            if (inflight_reserve(&inflight[slot], window, options.range_size > 0 ? 0 : client_batch_sizes[slot]) != 0
+                || ring_push(&client->tasks, &reply) != 0) {
+                printf("Error while accepting new client occurred.\n");
+                break;
+            }
+            ring_wake(&client->tasks);
+            clients[slot] = 1;
+            stats_client_start(stats, slot, client_id);
+            batch_sizer_init(&sizers[slot], server_dispatch_limit(&options, client_batch_sizes[slot]));
+            printf("Client %d connected.\n", client_id);
+            // whole window is filled at once, then every result brings one credit back
+            client_credits[slot] = window;
+            if (send_task(slot) == -1)
+                printf("Error while sending a new task to the client.\n");
+            break;
+        case 3: // client task results
+            result_sink_put_number(&results, msg->number, msg->value & 1, client_id);
+            verdict_cache_put(&verdicts, msg->number, msg->value & 1);
+            if (!clients[slot])
+                break;
+            // results come in order of batch, the first one carries its key
+            if (client_batch_results[slot]++ == 0)
+                client_batch_keys[slot] = msg->number;
+            if (msg->value & RESULT_LAST_IN_DISPATCH) {
+                client_batch_results[slot] = 0;
+                task_result(slot, client_batch_keys[slot]);
+            }
+            break;
+        case 4: // client closed
+            if (!clients[slot] || ((int) msg->number != client_id && (int) msg->number != -1)) {
+                printf("Incorrect client_id in message. Ignoring.\n");
+                break;
+            }
+            release_client(slot);
+            printf("Client %d exited.\n", client_id);
+            break;
+        case 5: // client range results
+            if (!clients[slot] || options.range_size == 0 || msg->number < source.spec.lo
+                || msg->number - source.spec.lo >= atomic_load(&source.cursor)) {
+                printf("Incorrect range in message. Ignoring.\n");
+                break;
+            }
+            // ranges differ in size, so it is taken from the task - late range has none and is dropped
+            client_range_los[slot] = msg->number;
+            client_range_sizes[slot] = 0;
+            struct inflight_task task;
+            if (inflight_find(&inflight[slot], msg->number, &task) == 0)
+                client_range_sizes[slot] = task.hi - task.lo;
+            if (options.range_bitmap) // bitmap follows
+                break;
+            if (client_range_sizes[slot] > 0)
+                result_sink_put(&results, client_range_los[slot], client_range_los[slot] + client_range_sizes[slot],
+                                msg->value, client_id);
+            task_result(slot, msg->number);
+            break;
+        case 6: // part of client range bitmap
+            if (clients[slot] && client_range_sizes[slot] == 0) // late range
+                break;
+            if (!clients[slot] || msg->value < 0 || (uint64_t) msg->value * 64 >= client_range_sizes[slot]) {
+                printf("Incorrect range in message. Ignoring.\n");
+                break;
+            }
+            store_range_word(slot, msg->number, msg->value);
+            break;
+        case 7: // end of client range bitmap
+            if (!clients[slot] || !options.range_bitmap || msg->number != client_range_los[slot]) {
+                printf("Incorrect range in message. Ignoring.\n");
+                break;
+            }
+            task_result(slot, msg->number);
+            break;
+        case 8: // prime factor of client number
+            if (!clients[slot] || msg->value != client_factor_counts[slot] || msg->value >= MAX_FACTORS) {
+                printf("Incorrect factor in message. Ignoring.\n");
+                break;
+            }
+            client_factors[(size_t) slot * MAX_FACTORS + msg->value] = msg->number;
+            client_factor_counts[slot]++;
+            break;
+        case 9: // end of client factors
+            if (!clients[slot] || msg->value != client_factor_counts[slot]) {
+                printf("Incorrect factor in message. Ignoring.\n");
+                client_factor_counts[slot] = 0;
+                break;
+            }
+            result_sink_put_factors(&results, msg->number, &client_factors[(size_t) slot * MAX_FACTORS], msg->value,
+                                    client_id);
+            client_factor_counts[slot] = 0;
+            task_result(slot, msg->number);
+            break;
+    }
+}
+
+int has_pending() {
+    int words = (segment->client_max + 63) / 64;
+    for (int i = 0; i < (words + 63) / 64; i++)
+        if (atomic_load(&segment->pending_summary[i]) != 0)
+            return 1;
+    return 0;
+}
+
+/*
+ * Spins for a while and then sleeps on futex until some client sets its
+ * pending bit or it is time to check task deadlines.
+ */
+void wait_for_clients() {
+    for (int i = 0; i < SPIN_COUNT; i++)
+        if (has_pending())
+            return;
+    uint32_t seq = atomic_load(&segment->server_wake_seq);
+    atomic_store(&segment->server_sleeping, 1);
+    if (!has_pending() && !close_due)
+        futex_wait_timeout(&segment->server_wake_seq, seq, WATCH_INTERVAL_MS);
+    atomic_store(&segment->server_sleeping, 0);
+}
+
+/*
+ * Sends task for every credit of client. Returns 1 if there is no task,
+ * because task source is exhausted.
+ */
+int send_task(int slot) {
+    while (client_credits[slot] > 0) {
+        task_feed_start(&feed);
+        int sent;
+        if (options.range_size > 0)
+            sent = send_range_task(slot);
+        else if (options.factorize)
+            sent = send_factor_task(slot);
+        else
+            sent = send_task_batch(slot);
+        if (sent != 0) { // source could be exhausted by the last task
+            task_feed_done(&feed, 1);
+            return sent;
+        }
+        client_credits[slot]--;
+    }
+    return 0;
+}
+
+/*
+ * Task is tracked before it is pushed, one which does not fit in the table
+ * or the ring is not sent and its numbers go back to retry queue.
+ */
+int send_task_batch(int slot) {
+    static uint64_t numbers[MAX_BATCH_SIZE];
+    int count = 0;
+    int size = (int) server_dispatch_size(&options, &sizers[slot], client_batch_sizes[slot]);
+    while (count < size && task_feed_next(&feed, &numbers[count]) == 0)
+        count++;
+    if (count == 0)
+        return 1;
+    if (task_feed_track(&feed, &inflight[slot], numbers, count) != 0)
+        return -1;
+    struct ring *tasks = &segment->slots[slot].tasks;
+    struct ring_msg msg;
+    msg.type = 2;
+    for (int i = 0; i < count; i++) {
+        msg.number = numbers[i];
+        msg.value = count - 1 - i;
+        if (ring_push(tasks, &msg) != 0)
+            return untrack_task(slot, numbers[0]);
+    }
+    ring_wake(tasks);
+    return 0;
+}
+
+int send_range_task(int slot) {
+    struct ring *tasks = &segment->slots[slot].tasks;
+    struct ring_msg msg;
+    msg.type = options.range_bitmap ? 5 : 4;
+    uint64_t hi;
+    uint64_t size = server_dispatch_size(&options, &sizers[slot], client_batch_sizes[slot]);
+    if (retry_queue_pop(&retried, &msg.number, &hi) != 0
+        && task_source_next_range(&source, size, &msg.number, &hi) != 0)
+        return 1;
+    msg.value = hi - msg.number;
+    if (task_feed_track_range(&feed, &inflight[slot], msg.number, hi) != 0)
+        return -1;
+    if (ring_push(tasks, &msg) != 0)
+        return untrack_task(slot, msg.number);
+    ring_wake(tasks);
+    return 0;
+}
+
+int send_factor_task(int slot) {
+    struct ring *tasks = &segment->slots[slot].tasks;
+    struct ring_msg msg;
+    msg.type = 6;
+    msg.value = 0;
+    if (task_feed_next(&feed, &msg.number) != 0)
+        return 1;
+    if (task_feed_track(&feed, &inflight[slot], &msg.number, 1) != 0)
+        return -1;
+    if (ring_push(tasks, &msg) != 0)
+        return untrack_task(slot, msg.number);
+    ring_wake(tasks);
+    return 0;
+}
+
+/*
+ * Task which could not be pushed goes back to retry queue. Returns -1 as
+ * sending failed.
+ */
+int untrack_task(int slot, uint64_t key) {
+    task_feed_untrack(&feed, &inflight[slot], key);
+    return -1;
+}
+
+/*
+ * Result of whole dispatch returns one credit, so next task is sent. Late
+ * result of task which was sent again only returns credit.
+ */
+void task_result(int slot, uint64_t key) {
+    struct inflight_task task;
+    int tracked = task_feed_result(&feed, &inflight[slot], key, &task) == 0;
+    if (tracked && options.target_ms > 0)
+        batch_sizer_update(&sizers[slot], inflight_task_size(&task), stats_now() - task.sent_at,
+                           options.target_ms * 1000000ULL, server_dispatch_limit(&options, client_batch_sizes[slot]));
+    // repeated result does not make window bigger than the table
+    if (client_credits[slot] + inflight[slot].count < inflight[slot].capacity)
+        client_credits[slot]++;
+    if (send_task(slot) == -1)
+        printf("Error while sending a new task to the client.\n");
+    if (tracked)
+        task_feed_done(&feed, 1);
+}
+
+/*
+ * Tasks sent to client are sent to other clients.
+ */
+void release_client(int slot) {
+    struct client_slot *client = &segment->slots[slot];
+    clients[slot] = 0;
+    client_credits[slot] = 0;
+    client_factor_counts[slot] = 0;
+    client_batch_results[slot] = 0;
+    stats_client_end(stats, slot);
+    client->generation = (client->generation + 1) & CLIENT_GENERATION_MASK;
+    client->pid = 0;
+    ring_reset(&client->tasks);
+    ring_reset(&client->results);
+    segment_release_slot(segment, slot);
+    task_feed_requeue_all(&feed, &inflight[slot]);
+}
+
+/*
+ * Called about once a second from main loop.
+ */
+void watch_tasks() {
+    task_feed_expire(&feed, &deadlines, requeue_expired);
+    reclaim_clients();
+    task_feed_send_retried(&feed, segment->client_max, send_retried);
+}
+
+int requeue_expired(int owner, uint64_t now) {
+    return task_feed_requeue_expired(&feed, &inflight[INFLIGHT_OWNER_SLOT(owner)], INFLIGHT_OWNER_INDEX(owner), now);
+}
+
+/*
+ * Client killed by a signal never says it closed, its slot is freed when
+ * its process is gone - also when it was killed before its intro.
+ */
+void reclaim_clients() {
+    for (int i = 0; i < segment->client_max; i++) {
+        struct client_slot *client = &segment->slots[i];
+        int pid = client->pid;
+        if (pid == 0 || kill(pid, 0) == 0 || errno != ESRCH)
+            continue;
+        if (!clients[i] && !ring_empty(&client->results)) // intro is handled first
+            continue;
+        int client_id = client->generation << CLIENT_SLOT_BITS | i;
+        int connected = clients[i];
+        release_client(i);
+        if (connected)
+            printf("Client %d vanished, its tasks are sent to other clients.\n", client_id);
+    }
+}
+
+int send_retried(int slot) {
+    return clients[slot] && client_credits[slot] > 0 && send_task(slot) == -1 ? -1 : 0;
+}
+
+/*
+ * Bit i of part index is set if number client_range_los[slot] + index * 64 + i is prime.
+ */
+void store_range_word(int slot, uint64_t word, int index) {
+    int client_id = segment->slots[slot].generation << CLIENT_SLOT_BITS | slot;
+    uint64_t base = client_range_los[slot] + (uint64_t) index * 64;
+    uint64_t end = client_range_los[slot] + client_range_sizes[slot];
+    while (word != 0) {
+        uint64_t number = base + __builtin_ctzll(word);
+        word &= word - 1;
+        if (number < end)
+            result_sink_put_number(&results, number, 1, client_id);
+    }
+}
+
+void remove_segment() {
+    if (segment != NULL) { // send "server closed" to all clients
+        atomic_store(&segment->server_closed, 1);
+        struct ring_msg msg;
+        msg.type = 3;
+        for (int i = 0; i < segment->client_max; i++) {
+            if (clients != NULL && clients[i]) {
+                ring_push(&segment->slots[i].tasks, &msg);
+                ring_wake(&segment->slots[i].tasks);
+            }
+        }
+        munmap(segment, segment_size);
+    }
+    if (shm_name != NULL) {
+        shm_unlink(shm_name);
+    }
+}
+
+void remove_stats() {
+    stats_remove(options.stats_name, stats);
+}
+
+/*
+ * Called by sampler thread. Queue of server is sum of results rings.
+ */
+void sample_rings(struct stats_segment *stats) {
+    int queue_depth = 0;
+    for (int i = 0; i < segment->client_max; i++) {
+        if (!clients[i])
+            continue;
+        queue_depth += ring_count(&segment->slots[i].results);
+        atomic_store(&stats->clients[i].queue_depth, ring_count(&segment->slots[i].tasks));
+    }
+    atomic_store(&stats->queue_depth, queue_depth);
+    atomic_store(&stats->cache_hits, atomic_load(&verdicts.hits));
+}
+
+/*
+ * Wakes main loop from futex wait, which closes server between messages.
+ */
+void sigint_handler(int signum) {
+    close_due = 1;
+}
+
+void close_results() {
+    task_feed_close(&feed);
+}
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "messages.h"
+#include "stream.h"
+#include "prime.h"
+#include "sieve.h"
+#include "work_queue.h"
+#include "work_model.h"
+
+#define MAX_THREAD_COUNT 256
+
+int read_args(int argc, char *argv[], char **address, int *batch_size, int *thread_count, int *window,
+              struct work_model *work);
+int start_workers();
+void *worker(void *arg);
+void close_socket();
+void process_task(uint64_t number);
+void process_task_batch(struct task_batch *batch);
+void process_range_task(struct range_task *task);
+void process_factor_task(uint64_t number);
+int send_message(struct message *message, int type, size_t length);
+void sigint_handler(int signum);
+
+int socket_fd = -1;
+pthread_mutex_t socket_lock = PTHREAD_MUTEX_INITIALIZER; // workers send whole messages one at a time
+int client_id = -1;
+int batch_size = 1;
+int thread_count = 0;
+int window = 0;
+struct work_queue tasks;
+struct work_model work;
+
+/*
+ * Types of messages:
+ * 1 - sending requested batch size and window
+ * 3 - sending task results
+ * 4 - sending "client closed"
+ * 5 - sending batch task results
+ * 6 - sending range task results
+ * 7 - sending factors of number
+ */
+int main(int argc, char *argv[]) {
+    atexit(close_socket);
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = sigint_handler;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTSTP, &act, NULL);
+    // server which closed connection shows up as EPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    char *address;
+    char *args_help = "Enter server address: path of unix socket (with preceding /) or host:port,"
+            " and optional batch size (1 - %d)"
+            " (options: -t number of worker threads, default - number of cores,"
+            " -w number of tasks in flight, default - 2 * number of threads,"
+            " -l simulated work after every task: none, sleep:ms or spin:ms, default - " WORK_MODEL_DEFAULT ").\n";
+    thread_count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count <= 0)
+        thread_count = 1;
+    if (thread_count > MAX_THREAD_COUNT)
+        thread_count = MAX_THREAD_COUNT;
+    work_model_parse(WORK_MODEL_DEFAULT, &work);
+    if (read_args(argc, argv, &address, &batch_size, &thread_count, &window, &work) != 0) {
+        printf(args_help, MAX_BATCH_SIZE);
+        return 1;
+    }
+    if (window == 0)
+        window = 2 * thread_count < MAX_WINDOW ? 2 * thread_count : MAX_WINDOW;
+
+    socket_fd = stream_connect(address);
+    if (socket_fd == -1) {
+        printf("Error while connecting to server occurred.\n");
+        return 1;
+    }
+
+    if (work_queue_init(&tasks, window, sizeof(struct message)) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    if (start_workers() != 0) {
+        printf("Error while starting worker threads occurred.\n");
+        return 1;
+    }
+
+    static struct stream_input input;
+    struct message message;
+    message.payload.intro.batch_size = batch_size;
+    message.payload.intro.window = window;
+    if (send_message(&message, 1, sizeof(struct client_intro)) != 0) {
+        printf("Error while sending registration data to server.\n");
+        return 1;
+    }
+
+    // receive thread only passes tasks to workers, server keeps window tasks in flight
+    while (1) {
+        ssize_t count = stream_read(socket_fd, &input);
+        if (count == -1) {
+            printf("Error while receiving message occurred.\n");
+            return 1;
+        }
+        if (count == 0) {
+            printf("Server closed.\n");
+            return 1;
+        }
+        int taken;
+        while ((taken = stream_next_message(&input, &message)) == 1) {
+            switch (message.header.type) {
+                case 1: // server respond with client_id and granted batch size
+                    client_id = message.payload.accept.client_id;
+                    batch_size = message.payload.accept.batch_size;
+                    if (client_id == -1) {
+                        printf("Server refused client.\n");
+                        return 1;
+                    }
+                    printf("Client accepted.\n");
+                    window = message.payload.accept.window;
+                    break;
+                case 2: // new server task
+                case 4: // new batch of server tasks
+                case 5: // new server range task
+                case 6: // new number to factorize
+                    work_queue_push(&tasks, &message);
+                    break;
+                case 3: // server closed
+                    printf("Server closed.\n");
+                    return 1;
+            }
+        }
+        if (taken == -1) {
+            printf("Incorrect message. Closing connection.\n");
+            return 1;
+        }
+    }
+}
+
+int read_args(int argc, char *argv[], char **address, int *batch_size, int *thread_count, int *window,
+              struct work_model *work) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:w:l:")) != -1) {
+        switch (opt) {
+            case 't':
+                *thread_count = atoi(optarg);
+                if (*thread_count <= 0 || *thread_count > MAX_THREAD_COUNT) {
+                    printf("Incorrect number of threads. It should be between 1 and %d.\n", MAX_THREAD_COUNT);
+                    return 1;
+                }
+                break;
+            case 'w':
+                *window = atoi(optarg);
+                if (*window <= 0 || *window > MAX_WINDOW) {
+                    printf("Incorrect window. It should be between 1 and %d.\n", MAX_WINDOW);
+                    return 1;
+                }
+                break;
+            case 'l':
+                if (work_model_parse(optarg, work) != 0) {
+                    printf("Incorrect work model. It should be none, sleep:ms or spin:ms.\n");
+                    return 1;
+                }
+                break;
+            default:
+                return 1;
+        }
+    }
+    if (argc - optind != 1 && argc - optind != 2) {
+        printf("Incorrect number of arguments.\n");
+        return 1;
+    }
+    char *text = argv[optind];
+    if (strlen(text) > MAX_ADDRESS_SIZE) {
+        printf("Address must be shorter than %d.\n", MAX_ADDRESS_SIZE + 1);
+        return 1;
+    }
+    if (text[0] != '/' && strchr(text, ':') == NULL) {
+        printf("Address must be a path (with preceding /) or host:port.\n");
+        return 1;
+    }
+    *address = text;
+    if (argc - optind == 2) {
+        int n = atoi(argv[optind + 1]);
+        if (n <= 0 || n > MAX_BATCH_SIZE) {
+            printf("Incorrect batch size.\n");
+            return 1;
+        }
+        *batch_size = n;
+    }
+
+    return 0;
+}
+
+int start_workers() {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&thread, &attr, worker, NULL) != 0) {
+            pthread_attr_destroy(&attr);
+            return -1;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return 0;
+}
+
+/*
+ * Result sent by worker returns credit to server, which answers with next task.
+ */
+void *worker(void *arg) {
+    struct message *message = malloc(sizeof(struct message));
+    if (message == NULL) {
+        printf("Error while allocating memory occurred.\n");
+        return NULL;
+    }
+    while (1) {
+        work_queue_pop(&tasks, message);
+        switch (message->header.type) {
+            case 2: // single task
+                process_task(message->payload.task.number);
+                break;
+            case 4: // batch of tasks
+                process_task_batch(&message->payload.batch);
+                break;
+            case 5: // range task
+                process_range_task(&message->payload.range);
+                break;
+            case 6: // number to factorize
+                process_factor_task(message->payload.task.number);
+                break;
+        }
+    }
+}
+
+/*
+ * "Client closed" is only tried, server finds out from closed connection
+ * anyway.
+ */
+void close_socket() {
+    if (socket_fd != -1) {
+        struct message message;
+        message.payload.int_msg.number = client_id;
+        send_message(&message, 4, sizeof(struct int_payload));
+        close(socket_fd);
+    }
+}
+
+void process_task(uint64_t number) {
+    struct message result;
+    result.payload.result.client_id = client_id;
+    result.payload.result.number = number;
+    result.payload.result.is_prime = is_prime(number);
+    work_model_run(&work);
+    if(send_message(&result, 3, sizeof(struct client_result)) != 0) {
+        printf("Error while sending client result to server.\n");
+    }
+}
+
+void process_task_batch(struct task_batch *batch) {
+    struct message result;
+    struct batch_result *bres = &result.payload.batch_result;
+    bres->client_id = client_id;
+    bres->count = batch->count;
+    if (bres->count > MAX_BATCH_SIZE)
+        bres->count = MAX_BATCH_SIZE;
+    for (int i = 0; i < bres->count; i++)
+        bres->numbers[i] = batch->numbers[i];
+    is_prime_batch(bres->numbers, bres->count, bres->is_prime);
+    work_model_run(&work);
+    if(send_message(&result, 5, BATCH_RESULT_SIZE(bres->count)) != 0) {
+        printf("Error while sending client result to server.\n");
+    }
+}
+
+void process_range_task(struct range_task *task) {
+    struct message result;
+    struct range_result *rres = &result.payload.range_result;
+    rres->client_id = client_id;
+    rres->with_bitmap = task->with_bitmap;
+    rres->lo = task->lo;
+    rres->hi = task->hi;
+    uint64_t max_size = task->with_bitmap ? MAX_BITMAP_RANGE_SIZE : MAX_RANGE_SIZE;
+    if (rres->hi < rres->lo || rres->hi - rres->lo > max_size)
+        rres->hi = rres->lo + max_size;
+    // credit of task comes back only with its result, so task waits for memory
+    while (sieve_range(rres->lo, rres->hi, task->with_bitmap ? rres->bitmap : NULL, &rres->count) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        sleep(1);
+    }
+    work_model_run(&work);
+    size_t length = RANGE_RESULT_SIZE(task->with_bitmap ? rres->hi - rres->lo : 0);
+    if(send_message(&result, 6, length) != 0) {
+        printf("Error while sending client result to server.\n");
+    }
+}
+
+void process_factor_task(uint64_t number) {
+    struct message result;
+    struct factor_result *fres = &result.payload.factor_result;
+    fres->client_id = client_id;
+    fres->number = number;
+    fres->count = factorize(number, fres->factors);
+    work_model_run(&work);
+    if(send_message(&result, 7, FACTOR_RESULT_SIZE(fres->count)) != 0) {
+        printf("Error while sending client result to server.\n");
+    }
+}
+
+/*
+ * Socket is blocking, so whole message is written before lock is released.
+ */
+int send_message(struct message *message, int type, size_t length) {
+    message->header.version = PROTOCOL_VERSION;
+    message->header.type = type;
+    message->header.length = length;
+    message->header.reserved = 0;
+    pthread_mutex_lock(&socket_lock);
+    int status = stream_write_all(socket_fd, message, sizeof(struct msg_header) + length);
+    pthread_mutex_unlock(&socket_lock);
+    return status;
+}
+
+void sigint_handler(int signum) {
+    printf("Client closed.\n");
+    exit(0);
+}
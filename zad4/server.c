@@ -0,0 +1,888 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "messages.h"
+#include "stream.h"
+#include "client_table.h"
+#include "options.h"
+#include "result_sink.h"
+#include "verdict_cache.h"
+#include "task_source.h"
+#include "inflight.h"
+#include "stats.h"
+#include "timer_wheel.h"
+#include "retry_queue.h"
+#include "batch_sizer.h"
+#include "checkpoint.h"
+#include "task_feed.h"
+
+#define MAX_EVENTS 8
+#define TIMER_INTERVAL_MS 1000
+// client which socket does not take anything that long is evicted
+#define CLIENT_STUCK_TIMEOUT 10
+// epoll data of client socket waiting for free space, other descriptors use fd
+#define CLIENT_EVENT (1ULL << 32)
+// epoll data of client socket with data to read
+#define INPUT_EVENT (1ULL << 33)
+
+/*
+ * Tasks owed to client and bytes its socket did not take yet. Connection is
+ * watched for input by one thread at a time (EPOLLONESHOT), only that
+ * thread reads and closes it. Backlog and other state of client slot are
+ * changed only with lock held, watching_output is also read without it.
+ */
+struct client_backlog {
+    pthread_mutex_t lock;
+    int credits;
+    struct stream_input input;
+    struct stream_output output;
+    _Atomic int watching_output;
+    int connected; // intro accepted
+    int evicted;
+    time_t stuck_since;
+    struct inflight_table inflight;
+    struct batch_sizer sizer;
+};
+
+int read_args(int argc, char *argv[], char **address);
+int open_signal_fd();
+int open_timer_fd(int interval_ms);
+int watch_fd(int fd);
+int start_event_threads();
+void *run_event_loop(void *arg);
+void accept_connections();
+void read_client(int slot);
+int handle_message(int slot, struct message *message);
+int accept_client(int slot, struct message *message);
+void drop_client(int slot, int exited);
+void on_timer();
+void raise_descriptor_limit(int client_max);
+void store_batch_result(struct batch_result *bres, int client_id);
+size_t build_task(int slot, struct message *message);
+size_t build_task_batch(int slot, struct message *message);
+size_t build_range_task(int slot, struct message *message);
+int track_task(int slot, struct message *message);
+void return_credit(int slot, uint64_t key);
+int flush_backlog(int slot);
+int send_message(int slot, struct message *message, int type, size_t length);
+int watch_output(int slot);
+void evict_stuck_clients();
+void release_client(int slot);
+void reset_backlog(int slot);
+int requeue_expired(int owner, uint64_t now);
+int send_retried(int slot);
+void range_result(int slot, struct range_result *rres, int client_id);
+void store_range_result(struct range_result *rres, int client_id);
+void close_results();
+size_t fill_header(struct message *message, int type, size_t length);
+void remove_socket();
+void remove_stats();
+void sample_queues(struct stats_segment *stats);
+
+struct server_options options;
+struct result_sink results;
+struct verdict_cache verdicts;
+struct client_table client_table;
+int *clients = NULL; // client socket by slot
+int *client_out_fds = NULL; // duplicate of client socket, watched for free space
+int *client_batch_sizes = NULL;
+int *client_windows = NULL;
+struct client_backlog *backlogs = NULL;
+_Atomic int stalled_count = 0; // clients with bytes waiting for socket
+char *address = NULL;
+int listen_fd = -1;
+int epoll_fd = -1;
+int signal_fd = -1;
+int timer_fd = -1;
+struct task_source source;
+struct stats_segment *stats = NULL;
+struct timer_wheel deadlines;
+struct retry_queue retried; // tasks of vanished clients and those which missed deadline
+struct checkpoint checkpoint; // progress of scan source, kept when -o is given
+struct task_feed feed = {&source, &retried, &verdicts, &results, &checkpoint, &options, &stats};
+
+/*
+ * Types of messages:
+ * 1 - sending new client_id
+ * 2 - sending new task
+ * 3 - sending "server closed"
+ * 4 - sending new batch of tasks
+ * 5 - sending new range task
+ * 6 - sending new number to factorize
+ */
+int main(int argc, char *argv[]) {
+    atexit(remove_socket);
+
+    char *args_help = "Enter socket address: path of unix socket (with preceding /) or host:port.\n"
+            SERVER_OPTIONS_HELP;
+    if (read_args(argc, argv, &address) != 0) {
+        printf(args_help);
+        return 1;
+    }
+    int client_max = options.client_max;
+    raise_descriptor_limit(client_max);
+    if (verdict_cache_init(&verdicts) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    if (task_source_open(&source, &options.task_source) != 0) {
+        printf("Error while opening task source occurred.\n");
+        return 1;
+    }
+    timer_wheel_init(&deadlines);
+    if (retry_queue_init(&retried) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    int resumed = 0;
+    if (options.checkpoint_path != NULL) {
+        resumed = checkpoint_open(&checkpoint, options.checkpoint_path, &source, &retried,
+                                  options.range_size);
+        if (resumed == -1) {
+            printf("Error while opening checkpoint occurred.\n");
+            return 1;
+        }
+        if (checkpoint_finished(&checkpoint)) {
+            printf("All tasks done.\n");
+            return 0;
+        }
+        if (resumed)
+            printf("Resuming scan from checkpoint.\n");
+    }
+    // resumed server adds its results to those of the previous one
+    if (result_sink_open(&results, options.result_sink, options.result_path, resumed) != 0) {
+        printf("Error while opening result sink occurred.\n");
+        return 1;
+    }
+    atexit(close_results);
+    if (checkpoint_start_syncer(&checkpoint, &source, &results) != 0) {
+        printf("Error while starting checkpoint thread occurred.\n");
+        return 1;
+    }
+    // peer which closed connection shows up as EPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    listen_fd = stream_listen(address);
+    if (listen_fd == -1) {
+        printf("Error while creating server socket occurred.\n");
+        return 1;
+    }
+    clients = malloc(client_max * sizeof(int));
+    client_out_fds = malloc(client_max * sizeof(int));
+    client_batch_sizes = malloc(client_max * sizeof(int));
+    client_windows = malloc(client_max * sizeof(int));
+    backlogs = calloc(client_max, sizeof(struct client_backlog));
+    if (clients == NULL || client_out_fds == NULL || client_batch_sizes == NULL || client_windows == NULL
+        || backlogs == NULL || client_table_init(&client_table, client_max) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        return 1;
+    }
+    for (int i = 0; i < client_max; i++) {
+        clients[i] = -1;
+        client_out_fds[i] = -1;
+        pthread_mutex_init(&backlogs[i].lock, NULL);
+        inflight_init(&backlogs[i].inflight, &deadlines, i);
+    }
+    if (options.stats_name != NULL) {
+        stats = stats_create(options.stats_name, client_max);
+        if (stats == NULL) {
+            printf("Error while creating statistics segment occurred.\n");
+            return 1;
+        }
+        atexit(remove_stats);
+        if (stats_start_sampler(stats, sample_queues) != 0) {
+            printf("Error while starting statistics sampler occurred.\n");
+            return 1;
+        }
+    }
+
+    epoll_fd = epoll_create1(0);
+    signal_fd = open_signal_fd();
+    timer_fd = open_timer_fd(TIMER_INTERVAL_MS);
+    if (epoll_fd == -1 || signal_fd == -1 || timer_fd == -1 || watch_fd(listen_fd) != 0
+        || watch_fd(signal_fd) != 0 || watch_fd(timer_fd) != 0) {
+        printf("Error while setting up event loop occurred.\n");
+        return 1;
+    }
+    if (start_event_threads() != 0) {
+        printf("Error while starting event loop threads occurred.\n");
+        return 1;
+    }
+    run_event_loop(NULL);
+    return 1;
+}
+
+/*
+ * All threads wait on the same epoll descriptor. Main thread is one of
+ * them, so only threads - 1 are started.
+ */
+int start_event_threads() {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    for (int i = 1; i < options.threads; i++) {
+        if (pthread_create(&thread, &attr, run_event_loop, NULL) != 0) {
+            pthread_attr_destroy(&attr);
+            return -1;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return 0;
+}
+
+void *run_event_loop(void *arg) {
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            printf("Error while waiting for events occurred.\n");
+            exit(1);
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.u64 & INPUT_EVENT) {
+                read_client((int) (events[i].data.u64 & ~INPUT_EVENT));
+            } else if (events[i].data.u64 & CLIENT_EVENT) {
+                int slot = (int) (events[i].data.u64 & ~CLIENT_EVENT);
+                pthread_mutex_lock(&backlogs[slot].lock);
+                if (clients[slot] != -1 && flush_backlog(slot) != 0)
+                    printf("Error while sending a new task to the client.\n");
+                pthread_mutex_unlock(&backlogs[slot].lock);
+            } else if (events[i].data.u64 == listen_fd) {
+                accept_connections();
+            } else if (events[i].data.u64 == signal_fd) {
+                struct signalfd_siginfo info;
+                if (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                    printf("Server closed.\n");
+                    exit(0);
+                }
+            } else if (events[i].data.u64 == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                    on_timer();
+            }
+        }
+    }
+}
+
+/*
+ * Every connection gets its client slot right away, client becomes
+ * connected with its intro.
+ */
+void accept_connections() {
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+                printf("Error while accepting connection occurred.\n");
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        stream_set_nodelay(fd);
+        int client_id = client_table_alloc(&client_table);
+        if (client_id == -1) {
+            printf("Cannot accept next client.\n");
+            struct message message;
+            message.payload.accept.client_id = -1;
+            message.payload.accept.batch_size = 0;
+            message.payload.accept.window = 0;
+            write(fd, &message, fill_header(&message, 1, sizeof(struct client_accept)));
+            close(fd);
+            continue;
+        }
+        int slot = client_table_slot(&client_table, client_id);
+        pthread_mutex_lock(&backlogs[slot].lock);
+        clients[slot] = fd;
+        client_out_fds[slot] = dup(fd);
+        backlogs[slot].input.start = backlogs[slot].input.end = 0;
+        backlogs[slot].evicted = 0;
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.u64 = INPUT_EVENT | slot;
+        if (client_out_fds[slot] == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            printf("Error while accepting connection occurred.\n");
+            release_client(slot);
+        }
+        pthread_mutex_unlock(&backlogs[slot].lock);
+    }
+}
+
+/*
+ * Reads once and handles every whole message read so far. Connection is
+ * watched again afterwards, unless client left - socket is closed then.
+ */
+void read_client(int slot) {
+    static _Thread_local struct message message;
+    int fd = clients[slot];
+    int gone = 0; // 1 - connection lost, 2 - client said it exited
+    ssize_t count = stream_read(fd, &backlogs[slot].input);
+    if (count == 0 || (count == -1 && errno != EAGAIN))
+        gone = 1;
+    while (!gone) {
+        int taken = stream_next_message(&backlogs[slot].input, &message);
+        if (taken == 0)
+            break;
+        if (taken == -1) {
+            printf("Incorrect message. Closing connection.\n");
+            gone = 1;
+            break;
+        }
+        gone = handle_message(slot, &message);
+    }
+    if (gone) {
+        drop_client(slot, gone == 2);
+        return;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.u64 = INPUT_EVENT | slot;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+/*
+ * Types of client messages:
+ * 1 - client intro (requested batch size and window)
+ * 3 - client task result, returns one credit
+ * 4 - client closed
+ * 5 - client batch results, returns one credit
+ * 6 - client range results, returns one credit
+ * 7 - client factors of number, returns one credit
+ * Client is the one of connection, client_id in messages is not trusted.
+ * Returns 1 if connection has to be closed and 2 if client exited.
+ */
+int handle_message(int slot, struct message *message) {
+    struct client_result *cres;
+    struct batch_result *bres;
+    struct range_result *rres;
+    struct factor_result *fres;
+    int client_id = client_table_id(&client_table, slot);
+    if (message->header.type != 1 && message->header.type != 4 && !backlogs[slot].connected) {
+        printf("Message before client intro. Closing connection.\n");
+        return 1;
+    }
+    switch (message->header.type) {
+        case 1: // client intro - requested batch size and window in message
+            return accept_client(slot, message);
+        case 3: // client task results
+            cres = &message->payload.result;
+            if (message->header.length != sizeof(struct client_result)) {
+                printf("Incorrect message. Ignoring.\n");
+                break;
+            }
+            result_sink_put_number(&results, cres->number, cres->is_prime, client_id);
+            verdict_cache_put(&verdicts, cres->number, cres->is_prime);
+            return_credit(slot, cres->number);
+            break;
+        case 4: // client closed
+            printf("Client %d exited.\n", client_table_id(&client_table, slot));
+            return 2;
+        case 5: // client batch results
+            bres = &message->payload.batch_result;
+            if (message->header.length < BATCH_RESULT_SIZE(0) || bres->count <= 0 || bres->count > MAX_BATCH_SIZE
+                || message->header.length != BATCH_RESULT_SIZE(bres->count)) {
+                printf("Incorrect message. Ignoring.\n");
+                break;
+            }
+            store_batch_result(bres, client_id);
+            return_credit(slot, bres->numbers[0]);
+            break;
+        case 6: // client range results
+            rres = &message->payload.range_result;
+            if (message->header.length < RANGE_RESULT_SIZE(0) || (rres->with_bitmap
+                && (rres->hi - rres->lo > MAX_BITMAP_RANGE_SIZE
+                    || message->header.length < RANGE_RESULT_SIZE(rres->hi - rres->lo)))) {
+                printf("Incorrect message. Ignoring.\n");
+                break;
+            }
+            range_result(slot, rres, client_id);
+            break;
+        case 7: // client factors of number
+            fres = &message->payload.factor_result;
+            if (message->header.length < FACTOR_RESULT_SIZE(0) || fres->count < 0 || fres->count > MAX_FACTORS
+                || message->header.length != FACTOR_RESULT_SIZE(fres->count)) {
+                printf("Incorrect message. Ignoring.\n");
+                break;
+            }
+            result_sink_put_factors(&results, fres->number, fres->factors, fres->count, client_id);
+            return_credit(slot, fres->number);
+            break;
+    }
+    return 0;
+}
+
+int accept_client(int slot, struct message *message) {
+    struct client_intro *intro = &message->payload.intro;
+    int client_id = client_table_id(&client_table, slot);
+    if (message->header.length != sizeof(struct client_intro) || backlogs[slot].connected) {
+        printf("Incorrect client intro. Closing connection.\n");
+        return 1;
+    }
+    int client_batch_size = intro->batch_size;
+    if (client_batch_size < 1)
+        client_batch_size = 1;
+    if (client_batch_size > MAX_BATCH_SIZE)
+        client_batch_size = MAX_BATCH_SIZE;
+    int client_window = intro->window;
+    if (client_window < 1)
+        client_window = 1;
+    if (client_window > MAX_WINDOW)
+        client_window = MAX_WINDOW;
+
+    pthread_mutex_lock(&backlogs[slot].lock);
+    if (inflight_reserve(&backlogs[slot].inflight, client_window,
+                         options.range_size > 0 ? 0 : client_batch_size) != 0) {
+        printf("Error while allocating memory occurred.\n");
+        message->payload.accept.client_id = -1;
+        message->payload.accept.batch_size = 0;
+        message->payload.accept.window = 0;
+        send_message(slot, message, 1, sizeof(struct client_accept));
+        pthread_mutex_unlock(&backlogs[slot].lock);
+        return 1;
+    }
+    message->payload.accept.client_id = client_id;
+    message->payload.accept.batch_size = client_batch_size;
+    message->payload.accept.window = client_window;
+    if (send_message(slot, message, 1, sizeof(struct client_accept)) != 0) {
+        printf("Error while accepting new client occurred.\n");
+        pthread_mutex_unlock(&backlogs[slot].lock);
+        return 1;
+    }
+    client_batch_sizes[slot] = client_batch_size;
+    client_windows[slot] = client_window;
+    printf("Client %d connected.\n", client_id);
+    stats_client_start(stats, slot, client_id);
+    batch_sizer_init(&backlogs[slot].sizer, server_dispatch_limit(&options, client_batch_sizes[slot]));
+    backlogs[slot].connected = 1;
+    // whole window is filled at once, then every result brings one credit back
+    backlogs[slot].credits = client_window;
+    if (flush_backlog(slot) != 0)
+        printf("Error while sending a new task to the client.\n");
+    pthread_mutex_unlock(&backlogs[slot].lock);
+    return 0;
+}
+
+/*
+ * Client which closed connection without saying it closed, for example
+ * killed by a signal or on a host which went down, has its tasks sent to
+ * other clients.
+ */
+void drop_client(int slot, int exited) {
+    pthread_mutex_lock(&backlogs[slot].lock);
+    int client_id = client_table_id(&client_table, slot);
+    int connected = backlogs[slot].connected && !backlogs[slot].evicted && !exited;
+    int in_flight = backlogs[slot].inflight.count;
+    release_client(slot);
+    pthread_mutex_unlock(&backlogs[slot].lock);
+    if (connected && in_flight > 0)
+        printf("Client %d disconnected, its tasks are sent to other clients.\n", client_id);
+}
+
+int read_args(int argc, char *argv[], char **address) {
+    if (parse_server_options(argc, argv, &options, MAX_RANGE_SIZE, MAX_BITMAP_RANGE_SIZE, MAX_SERVER_THREADS) != 0)
+        return 1;
+    if (argc - optind != 1) {
+        printf("Incorrect number of arguments.\n");
+        return 1;
+    }
+    if (options.pool_tasks > 0) {
+        printf("Shared task queue is supported only by SysV server.\n");
+        return 1;
+    }
+    char *text = argv[optind];
+    if (strlen(text) > MAX_ADDRESS_SIZE) {
+        printf("Address must be shorter than %d.\n", MAX_ADDRESS_SIZE + 1);
+        return 1;
+    }
+    if (text[0] != '/' && strchr(text, ':') == NULL) {
+        printf("Address must be a path (with preceding /) or host:port.\n");
+        return 1;
+    }
+    *address = text;
+
+    return 0;
+}
+
+/*
+ * SIGINT and SIGTSTP are blocked and read from descriptor in event loop.
+ */
+int open_signal_fd() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTSTP);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0)
+        return -1;
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+int open_timer_fd(int interval_ms) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = interval_ms / 1000;
+    spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(fd, 0, &spec, NULL) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int watch_fd(int fd) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/*
+ * Periodic work, output is flushed, so it is not delayed by buffering when
+ * redirected to file. Tasks which missed deadline are sent to clients with
+ * free credits.
+ */
+void on_timer() {
+    if (stalled_count > 0)
+        evict_stuck_clients();
+    task_feed_expire(&feed, &deadlines, requeue_expired);
+    task_feed_send_retried(&feed, client_table.size, send_retried);
+    fflush(stdout);
+}
+
+/*
+ * Every connected client keeps its socket and its duplicate open in server.
+ */
+void raise_descriptor_limit(int client_max) {
+    struct rlimit limit;
+    rlim_t needed = 2 * client_max + 16;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= needed)
+        return;
+    limit.rlim_cur = needed;
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < needed)
+        limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur < needed)
+        printf("Descriptor limit is too low for %d clients.\n", client_max);
+}
+
+void store_batch_result(struct batch_result *bres, int client_id) {
+    for (int i = 0; i < bres->count && i < MAX_BATCH_SIZE; i++) {
+        int is_prime = bres->is_prime[i / 8] & (1 << (i % 8));
+        result_sink_put_number(&results, bres->numbers[i], is_prime, client_id);
+        verdict_cache_put(&verdicts, bres->numbers[i], is_prime);
+    }
+}
+
+size_t build_task(int slot, struct message *message) {
+    if (options.range_size > 0)
+        return build_range_task(slot, message);
+    if (client_batch_sizes[slot] > 1 && !options.factorize)
+        return build_task_batch(slot, message);
+    if (task_feed_next(&feed, &message->payload.task.number) != 0)
+        return 0;
+    return fill_header(message, options.factorize ? 6 : 2, sizeof(struct task_payload));
+}
+
+size_t build_task_batch(int slot, struct message *message) {
+    struct task_batch *batch = &message->payload.batch;
+    int count = 0;
+    int size = (int) server_dispatch_size(&options, &backlogs[slot].sizer, client_batch_sizes[slot]);
+    while (count < size && task_feed_next(&feed, &batch->numbers[count]) == 0)
+        count++;
+    if (count == 0)
+        return 0;
+    batch->count = count;
+    return fill_header(message, 4, TASK_BATCH_SIZE(count));
+}
+
+size_t build_range_task(int slot, struct message *message) {
+    struct range_task *range = &message->payload.range;
+    uint64_t size = server_dispatch_size(&options, &backlogs[slot].sizer, client_batch_sizes[slot]);
+    if (retry_queue_pop(&retried, &range->lo, &range->hi) != 0
+        && task_source_next_range(&source, size, &range->lo, &range->hi) != 0)
+        return 0;
+    range->with_bitmap = options.range_bitmap;
+    return fill_header(message, 5, sizeof(struct range_task));
+}
+
+/*
+ * Results carry the same key as their tasks, so they can be matched.
+ */
+int track_task(int slot, struct message *message) {
+    struct inflight_table *inflight = &backlogs[slot].inflight;
+    switch (message->header.type) {
+        case 4: // batch of tasks
+            return task_feed_track(&feed, inflight, message->payload.batch.numbers, message->payload.batch.count);
+        case 5: // range task
+            return task_feed_track_range(&feed, inflight, message->payload.range.lo, message->payload.range.hi);
+        default: // single task
+            return task_feed_track(&feed, inflight, &message->payload.task.number, 1);
+    }
+}
+
+/*
+ * Every result returns one credit of client of the connection, so next task
+ * is sent right away. Key identifies task of the result in inflight table -
+ * late result of task which was sent again only returns credit.
+ */
+void return_credit(int slot, uint64_t key) {
+    pthread_mutex_lock(&backlogs[slot].lock);
+    if (backlogs[slot].connected) {
+        struct inflight_task task;
+        int tracked = task_feed_result(&feed, &backlogs[slot].inflight, key, &task) == 0;
+        // repeated result does not make window bigger than the table
+        if (backlogs[slot].credits + backlogs[slot].inflight.count < backlogs[slot].inflight.capacity)
+            backlogs[slot].credits++;
+        if (tracked && options.target_ms > 0)
+            batch_sizer_update(&backlogs[slot].sizer, inflight_task_size(&task), stats_now() - task.sent_at,
+                               options.target_ms * 1000000ULL,
+                               server_dispatch_limit(&options, client_batch_sizes[slot]));
+        if (flush_backlog(slot) != 0)
+            printf("Error while sending a new task to the client.\n");
+        if (tracked)
+            task_feed_done(&feed, 1);
+    }
+    pthread_mutex_unlock(&backlogs[slot].lock);
+}
+
+/*
+ * Builds task for every credit of client and sends them all with one
+ * writev. Bytes socket does not take are kept and client socket is watched
+ * by epoll until it has free space. Lock of the slot has to be held.
+ */
+int flush_backlog(int slot) {
+    static _Thread_local struct message burst[MAX_WINDOW];
+    struct iovec iov[MAX_WINDOW];
+    struct client_backlog *backlog = &backlogs[slot];
+    ssize_t flushed = stream_flush(clients[slot], &backlog->output);
+    if (flushed == -1)
+        return -1;
+    if (flushed > 0)
+        backlog->stuck_since = time(NULL);
+    int count = 0;
+    int untracked = 0;
+    while (backlog->credits > 0 && count < MAX_WINDOW) {
+        task_feed_start(&feed);
+        size_t size = build_task(slot, &burst[count]);
+        if (size == 0) { // task source exhausted
+            task_feed_done(&feed, 1);
+            break;
+        }
+        backlog->credits--;
+        if (track_task(slot, &burst[count]) != 0) { // tasks built before it are still sent
+            task_feed_done(&feed, 1);
+            untracked = 1;
+            break;
+        }
+        iov[count].iov_base = &burst[count];
+        iov[count].iov_len = size;
+        count++;
+    }
+    if (count > 0 && stream_write(clients[slot], &backlog->output, iov, count) != 0)
+        return -1;
+    return watch_output(slot) != 0 || untracked ? -1 : 0;
+}
+
+/*
+ * Lock of the slot has to be held.
+ */
+int send_message(int slot, struct message *message, int type, size_t length) {
+    struct iovec iov;
+    iov.iov_base = message;
+    iov.iov_len = fill_header(message, type, length);
+    if (stream_write(clients[slot], &backlogs[slot].output, &iov, 1) != 0)
+        return -1;
+    return watch_output(slot);
+}
+
+/*
+ * Client socket is watched for free space only while bytes wait for it.
+ */
+int watch_output(int slot) {
+    struct client_backlog *backlog = &backlogs[slot];
+    int pending = stream_pending(&backlog->output);
+    if (pending == backlog->watching_output)
+        return 0;
+    backlog->watching_output = pending;
+    if (!pending) {
+        stalled_count--;
+        return epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_out_fds[slot], NULL);
+    }
+    backlog->stuck_since = time(NULL);
+    stalled_count++;
+    struct epoll_event event;
+    event.events = EPOLLOUT;
+    event.data.u64 = CLIENT_EVENT | slot;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_out_fds[slot], &event);
+}
+
+/*
+ * Evicts clients which socket did not take anything for CLIENT_STUCK_TIMEOUT
+ * seconds. Connection is only shut down here, thread reading it sees the
+ * end of stream and releases the client.
+ */
+void evict_stuck_clients() {
+    time_t now = time(NULL);
+    for (int i = 0; i < client_table.size; i++) {
+        if (!backlogs[i].watching_output)
+            continue;
+        pthread_mutex_lock(&backlogs[i].lock);
+        if (backlogs[i].watching_output && !backlogs[i].evicted
+            && now - backlogs[i].stuck_since >= CLIENT_STUCK_TIMEOUT) {
+            backlogs[i].evicted = 1;
+            shutdown(clients[i], SHUT_RDWR);
+            printf("Client %d evicted, its socket was full for %d s.\n", client_table_id(&client_table, i),
+                   CLIENT_STUCK_TIMEOUT);
+        }
+        pthread_mutex_unlock(&backlogs[i].lock);
+    }
+}
+
+/*
+ * Lock of the slot has to be held.
+ */
+void release_client(int slot) {
+    client_table_release(&client_table, client_table_id(&client_table, slot));
+    reset_backlog(slot);
+    close(clients[slot]);
+    if (client_out_fds[slot] != -1)
+        close(client_out_fds[slot]);
+    clients[slot] = -1;
+    client_out_fds[slot] = -1;
+}
+
+void reset_backlog(int slot) {
+    struct client_backlog *backlog = &backlogs[slot];
+    if (backlog->watching_output) {
+        stalled_count--;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_out_fds[slot], NULL);
+        backlog->watching_output = 0;
+    }
+    // tasks sent to client are sent to other clients
+    task_feed_requeue_all(&feed, &backlog->inflight);
+    if (backlog->connected)
+        stats_client_end(stats, slot);
+    backlog->connected = 0;
+    stream_output_free(&backlog->output);
+    backlog->credits = 0;
+}
+
+int requeue_expired(int owner, uint64_t now) {
+    int slot = INFLIGHT_OWNER_SLOT(owner);
+    pthread_mutex_lock(&backlogs[slot].lock);
+    int expired = task_feed_requeue_expired(&feed, &backlogs[slot].inflight, INFLIGHT_OWNER_INDEX(owner), now);
+    pthread_mutex_unlock(&backlogs[slot].lock);
+    return expired;
+}
+
+int send_retried(int slot) {
+    pthread_mutex_lock(&backlogs[slot].lock);
+    int error = clients[slot] != -1 && backlogs[slot].credits > 0 ? flush_backlog(slot) : 0;
+    pthread_mutex_unlock(&backlogs[slot].lock);
+    return error;
+}
+
+/*
+ * Range of result is taken from its task, client could send any. Result of
+ * range which is not in flight at the client - late one or one never sent -
+ * is not stored and only returns credit.
+ */
+void range_result(int slot, struct range_result *rres, int client_id) {
+    struct inflight_task task;
+    pthread_mutex_lock(&backlogs[slot].lock);
+    int found = inflight_find(&backlogs[slot].inflight, rres->lo, &task) == 0;
+    pthread_mutex_unlock(&backlogs[slot].lock);
+    if (found && (task.hi == 0 || (rres->with_bitmap && task.hi - task.lo > rres->hi - rres->lo))) {
+        printf("Incorrect message. Ignoring.\n");
+        return;
+    }
+    if (found) {
+        rres->hi = task.hi;
+        store_range_result(rres, client_id);
+    }
+    return_credit(slot, rres->lo);
+}
+
+void store_range_result(struct range_result *rres, int client_id) {
+    if (!rres->with_bitmap) {
+        result_sink_put(&results, rres->lo, rres->hi, rres->count, client_id);
+        return;
+    }
+    uint64_t size = rres->hi - rres->lo;
+    if (size > MAX_BITMAP_RANGE_SIZE)
+        size = MAX_BITMAP_RANGE_SIZE;
+    for (uint64_t i = 0; i < size; i++)
+        if (rres->bitmap[i / 8] & (1 << (i % 8)))
+            result_sink_put_number(&results, rres->lo + i, 1, client_id);
+}
+
+/*
+ * Returns size of whole message.
+ */
+size_t fill_header(struct message *message, int type, size_t length) {
+    message->header.version = PROTOCOL_VERSION;
+    message->header.type = type;
+    message->header.length = length;
+    message->header.reserved = 0;
+    return sizeof(struct msg_header) + length;
+}
+
+void close_results() {
+    task_feed_close(&feed);
+}
+
+void remove_stats() {
+    stats_remove(options.stats_name, stats);
+}
+
+/*
+ * Called by sampler thread, each slot is read with its lock. Queue of client
+ * are messages waiting in server until its socket takes them.
+ */
+void sample_queues(struct stats_segment *stats) {
+    for (int i = 0; i < client_table.size; i++) {
+        pthread_mutex_lock(&backlogs[i].lock);
+        if (clients[i] != -1)
+            atomic_store(&stats->clients[i].queue_depth, backlogs[i].output.messages);
+        pthread_mutex_unlock(&backlogs[i].lock);
+    }
+    atomic_store(&stats->cache_hits, atomic_load(&verdicts.hits));
+}
+
+/*
+ * "Server closed" is only tried - client which does not read finds out
+ * from closed connection.
+ */
+void remove_socket() {
+    if (listen_fd != -1 && clients != NULL) {
+        close(listen_fd);
+        struct message message;
+        for (int i = 0; i < client_table.size; i++) {
+            if (clients[i] != -1) {
+                write(clients[i], &message, fill_header(&message, 3, 0));
+                close(clients[i]);
+            }
+        }
+    }
+    if (address != NULL && address[0] == '/')
+        unlink(address);
+}
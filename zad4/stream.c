@@ -0,0 +1,248 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "stream.h"
+
+int open_unix(const char *path, int listening);
+int open_tcp(const char *address, int listening);
+int append(struct stream_output *output, const char *data, size_t size);
+
+/*
+ * Address is a path of unix socket (with preceding /) or host:port of TCP
+ * socket. Listening socket is non-blocking, unix socket left by previous
+ * server is replaced.
+ */
+int stream_listen(const char *address) {
+    return address[0] == '/' ? open_unix(address, 1) : open_tcp(address, 1);
+}
+
+/*
+ * Connected socket is blocking.
+ */
+int stream_connect(const char *address) {
+    return address[0] == '/' ? open_unix(address, 0) : open_tcp(address, 0);
+}
+
+int open_unix(const char *path, int listening) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | (listening ? SOCK_NONBLOCK : 0), 0);
+    if (fd == -1)
+        return -1;
+    if (listening) {
+        unlink(path);
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0 && listen(fd, SOMAXCONN) == 0)
+            return fd;
+    } else if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+        return fd;
+    }
+    close(fd);
+    return -1;
+}
+
+/*
+ * Host may be empty for listening socket - it listens on all addresses then.
+ */
+int open_tcp(const char *address, int listening) {
+    const char *colon = strrchr(address, ':');
+    if (colon == NULL || colon[1] == '\0' || colon - address > MAX_ADDRESS_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+    char host[MAX_ADDRESS_SIZE + 1];
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+    struct addrinfo hints, *found;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    if (getaddrinfo(host[0] == '\0' ? NULL : host, colon + 1, &hints, &found) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *info = found; info != NULL && fd == -1; info = info->ai_next) {
+        fd = socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC | (listening ? SOCK_NONBLOCK : 0),
+                    info->ai_protocol);
+        if (fd == -1)
+            continue;
+        int on = 1;
+        if (listening && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0
+            && bind(fd, info->ai_addr, info->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0)
+            break;
+        if (!listening && connect(fd, info->ai_addr, info->ai_addrlen) == 0) {
+            stream_set_nodelay(fd);
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+/*
+ * Small results and tasks are sent at once instead of waiting for more
+ * data. Fails harmlessly on unix sockets.
+ */
+void stream_set_nodelay(int fd) {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+/*
+ * Reads what fits after data not taken yet. Returns 0 when peer closed
+ * connection and -1 on error (EAGAIN when there is nothing to read).
+ */
+ssize_t stream_read(int fd, struct stream_input *input) {
+    if (input->start > 0) {
+        memmove(input->data, input->data + input->start, input->end - input->start);
+        input->end -= input->start;
+        input->start = 0;
+    }
+    ssize_t count;
+    do {
+        count = read(fd, input->data + input->end, sizeof(input->data) - input->end);
+    } while (count == -1 && errno == EINTR);
+    if (count > 0)
+        input->end += count;
+    return count;
+}
+
+/*
+ * Returns 1 if whole message was taken, 0 if it did not come yet and -1 if
+ * the stream is malformed (wrong protocol version or too long payload) -
+ * nothing that follows can be trusted then.
+ */
+int stream_next_message(struct stream_input *input, struct message *message) {
+    size_t available = input->end - input->start;
+    if (available < sizeof(struct msg_header))
+        return 0;
+    memcpy(&message->header, input->data + input->start, sizeof(struct msg_header));
+    if (message->header.version != PROTOCOL_VERSION
+        || message->header.length > MAX_MSG_SIZE - sizeof(struct msg_header))
+        return -1;
+    size_t size = sizeof(struct msg_header) + message->header.length;
+    if (available < size)
+        return 0;
+    memcpy(message, input->data + input->start, size);
+    input->start += size;
+    if (input->start == input->end)
+        input->start = input->end = 0;
+    return 1;
+}
+
+/*
+ * Sends count messages with one writev, unless earlier bytes still wait -
+ * then messages only wait behind them. Whatever socket does not take is
+ * kept for stream_flush. Returns -1 on error.
+ */
+int stream_write(int fd, struct stream_output *output, struct iovec *iov, int count) {
+    ssize_t written = 0;
+    if (!stream_pending(output)) {
+        do {
+            written = writev(fd, iov, count);
+        } while (written == -1 && errno == EINTR);
+        if (written == -1) {
+            if (errno != EAGAIN)
+                return -1;
+            written = 0;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (written >= iov[i].iov_len) {
+            written -= iov[i].iov_len;
+            continue;
+        }
+        if (append(output, (char *) iov[i].iov_base + written, iov[i].iov_len - written) != 0)
+            return -1;
+        output->messages++;
+        written = 0;
+    }
+    return 0;
+}
+
+/*
+ * Writes waiting bytes until socket is full. Returns number of bytes
+ * written or -1 on error.
+ */
+ssize_t stream_flush(int fd, struct stream_output *output) {
+    ssize_t total = 0;
+    while (stream_pending(output)) {
+        ssize_t written = write(fd, output->data + output->start, output->end - output->start);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN ? total : -1;
+        }
+        output->start += written;
+        total += written;
+    }
+    output->start = output->end = 0;
+    output->messages = 0;
+    return total;
+}
+
+int stream_pending(struct stream_output *output) {
+    return output->end > output->start;
+}
+
+void stream_output_free(struct stream_output *output) {
+    free(output->data);
+    memset(output, 0, sizeof(struct stream_output));
+}
+
+int append(struct stream_output *output, const char *data, size_t size) {
+    if (output->end + size > output->capacity) {
+        if (output->start > 0) {
+            memmove(output->data, output->data + output->start, output->end - output->start);
+            output->end -= output->start;
+            output->start = 0;
+        }
+        size_t capacity = output->capacity > 0 ? output->capacity : MAX_MSG_SIZE;
+        while (output->end + size > capacity)
+            capacity *= 2;
+        if (capacity != output->capacity) {
+            char *resized = realloc(output->data, capacity);
+            if (resized == NULL)
+                return -1;
+            output->data = resized;
+            output->capacity = capacity;
+        }
+    }
+    memcpy(output->data + output->end, data, size);
+    output->end += size;
+    return 0;
+}
+
+/*
+ * For blocking sockets.
+ */
+int stream_write_all(int fd, const void *data, size_t size) {
+    const char *next = data;
+    while (size > 0) {
+        ssize_t written = write(fd, next, size);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        next += written;
+        size -= written;
+    }
+    return 0;
+}
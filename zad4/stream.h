@@ -0,0 +1,41 @@
+#ifndef ZAD4_STREAM_H
+#define ZAD4_STREAM_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include "messages.h"
+
+/*
+ * Bytes read from socket. Whole messages are taken from the front, a message
+ * cut by read stays until the rest of it comes.
+ */
+struct stream_input {
+    size_t start;
+    size_t end;
+    char data[2 * MAX_MSG_SIZE];
+};
+
+/*
+ * Bytes socket did not take yet. They go out before anything sent later,
+ * so messages are never interleaved.
+ */
+struct stream_output {
+    char *data;
+    size_t start;
+    size_t end;
+    size_t capacity;
+    int messages; // messages appended since output was empty
+};
+
+int stream_listen(const char *address);
+int stream_connect(const char *address);
+void stream_set_nodelay(int fd);
+ssize_t stream_read(int fd, struct stream_input *input);
+int stream_next_message(struct stream_input *input, struct message *message);
+int stream_write(int fd, struct stream_output *output, struct iovec *iov, int count);
+ssize_t stream_flush(int fd, struct stream_output *output);
+int stream_pending(struct stream_output *output);
+void stream_output_free(struct stream_output *output);
+int stream_write_all(int fd, const void *data, size_t size);
+
+#endif //ZAD4_STREAM_H